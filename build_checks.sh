@@ -0,0 +1,17 @@
+#!/bin/bash
+
+# Standalone checks and benchmarks, one program per file in src/checks/. Each
+# one exits non-zero when its check fails.
+
+mkdir -p build/checks
+for check in src/checks/*.cpp; do
+  name=$(basename "$check" .cpp)
+  clang++ \
+    -O2 -g -std=c++17 -fno-exceptions \
+    "$check" \
+    -o "./build/checks/$name" \
+    -I ./src/ -I ./ -I ./third_party/ \
+    -I ./third_party/freetype/include ./third_party/freetype/build/libfreetype.a \
+    || exit 1
+  "./build/checks/$name" || exit 1
+done
@@ -8,6 +8,11 @@ constant u32 TEXTURE_RECT = 3 << 18;
 constant u32 BITMAP_GLYPH = 4 << 18;
 constant u32 VECTOR_GLYPH = 5 << 18;
 constant u32 LINE         = 6 << 18;
+constant u32 GLYPH_RUN    = 7 << 18;
+
+constant u32 GLYPH_SHAPE_VECTOR = 0xFFFFFFFF;
+
+constant u32 GLYPH_BANDS = 8;
 
 struct RectPrimitive {
   Vec4f rect;
@@ -33,6 +38,7 @@ struct BitmapGlyphPrimitive {
   Vec4f uv_bounds;
   u32 clip_rect_idx;
   u32 color;
+  u32 atlas_page;
 };
 
 struct ConicCurvePrimitive {
@@ -41,12 +47,50 @@ struct ConicCurvePrimitive {
   Vec2f p2;
 };
 
+struct CurveBoundsPrimitive {
+  Vec2f min;
+  Vec2f max;
+  u32 is_line;
+  u32 pad;
+};
+
+struct GlyphBandPrimitive {
+  u32 start_idx;
+  u32 count;
+};
+
 struct VectorGlyphPrimitive {
   Vec4f dimensions;
   u32 curve_start_idx;
   u32 curve_count;
   u32 color;
   u32 clip_rect_idx;
+  u32 band_start_idx;
+};
+
+struct GlyphRunPrimitive {
+  Vec2f origin;
+  f32 scale;
+  u32 color;
+  u32 clip_rect_idx;
+  u32 glyph_start_idx;
+  u32 glyph_count;
+};
+
+struct RunGlyphPrimitive {
+  f32 x;
+  u32 run_idx;
+  u32 shape_idx;
+};
+
+struct GlyphShapePrimitive {
+  Vec4f uv_bounds;
+  Vec2f bearing;
+  Vec2f size;
+  u32 curve_start_idx;
+  u32 curve_count;
+  u32 band_start_idx;
+  u32 atlas_page;
 };
 
 struct LinePrimitive {
@@ -56,21 +100,41 @@ struct LinePrimitive {
   u32 clip_rect_idx;
 };
 
+// Starts the primitive buffer. Every region's offset is in bytes from the
+// start of the buffer, see upload_primitives.
 struct Primitives {
-  RectPrimitive clip_rects[1024];
-  RoundedRectPrimitive rounded_rects[1024];
-  BitmapGlyphPrimitive bitmap_glyphs[1024];
-  TextureRectPrimitive texture_rects[1024];
-  VectorGlyphPrimitive vector_glyphs[1024];
-  ConicCurvePrimitive conic_curves[4096];
-  LinePrimitive lines[4096];
+  u32 clip_rects;
+  u32 rounded_rects;
+  u32 bitmap_glyphs;
+  u32 texture_rects;
+  u32 vector_glyphs;
+  u32 conic_curves;
+  u32 curve_bounds;
+  u32 glyph_bands;
+  u32 band_curves;
+  u32 lines;
+  u32 glyph_runs;
+  u32 run_glyphs;
+  u32 glyph_shapes;
   packed_float4 canvas_size;
 };
 
+template <typename T>
+device T *region(device Primitives *primitives, u32 offset)
+{
+  return (device T *)((device u8 *)primitives + offset);
+}
+
 struct Args {
     device Primitives *primitives;
 };
 
+// One per instance in draw order, see expand_draw_stream in draw.hpp.
+struct PrimitiveInstance {
+    u32 type;
+    u32 idx;
+};
+
 struct VertexOut {
     float4 ndc_position [[position]];
     float2 position;
@@ -83,6 +147,8 @@ struct VertexOut {
     u32 primitive_type [[flat]];
     u32 primitive_idx [[flat]];
     u32 texture_idx [[flat]];
+    u32 curve_start_idx [[flat]];
+    u32 band_start_idx [[flat]];
 };
 
 Vec4f uint_to_vec_color(u32 color) {
@@ -94,23 +160,80 @@ Vec4f uint_to_vec_color(u32 color) {
     return Vec4f(r, g, b, a);
 }
 
+void bitmap_glyph_vertex(thread VertexOut &out, device Primitives *primitives, BitmapGlyphPrimitive p, u32 corner)
+{
+    RectPrimitive clip = region<RectPrimitive>(primitives, primitives->clip_rects)[p.clip_rect_idx];
+
+    float2 verts[] = {
+        {p.dimensions.x, p.dimensions.y},
+        {p.dimensions.x + p.dimensions.z, p.dimensions.y},
+        {p.dimensions.x,  p.dimensions.y + p.dimensions.w},
+        {p.dimensions.x + p.dimensions.z,  p.dimensions.y + p.dimensions.w},
+    };
+    float2 uvs[] = {
+        {p.uv_bounds.x, p.uv_bounds.y},
+        {p.uv_bounds.z, p.uv_bounds.y},
+        {p.uv_bounds.x,  p.uv_bounds.w},
+        {p.uv_bounds.z,  p.uv_bounds.w},
+    };
+
+    out.ndc_position = float4(verts[corner] / primitives->canvas_size.xy * float2(2, 2) - float2(1, 1), 0, 1);
+
+    out.uv = uvs[corner];
+    out.color = uint_to_vec_color(p.color);
+    out.position = verts[corner];
+    out.texture_idx = p.atlas_page;
+    out.clip_rect_bounds = float4(clip.rect.x, clip.rect.y, clip.rect.x + clip.rect.z, clip.rect.y + clip.rect.w);
+}
+
+void vector_glyph_vertex(thread VertexOut &out, device Primitives *primitives, VectorGlyphPrimitive p, u32 corner)
+{
+    RectPrimitive clip = region<RectPrimitive>(primitives, primitives->clip_rects)[p.clip_rect_idx];
+
+    float2 verts[] = {
+        {p.dimensions.x - 1 , p.dimensions.y - 1},
+        {p.dimensions.x + p.dimensions.z + 1, p.dimensions.y - 1},
+        {p.dimensions.x - 1,  p.dimensions.y + p.dimensions.w + 1},
+        {p.dimensions.x + p.dimensions.z + 1,  p.dimensions.y + p.dimensions.w + 1},
+    };
+    float2 uvs[] = {
+        {-(1 / p.dimensions.z),       1 + (1 / p.dimensions.w)},
+        {1 + (1 / p.dimensions.z),   1 + (1 / p.dimensions.w)},
+        {-(1 / p.dimensions.z),     -(1 / p.dimensions.w)},
+        {1 + (1 / p.dimensions.z), -(1 / p.dimensions.w)},
+    };
+
+    out.ndc_position = float4(verts[corner] / primitives->canvas_size.xy * float2(2, 2) - float2(1, 1), 0, 1);
+
+    out.uv = uvs[corner];
+    out.color = uint_to_vec_color(p.color);
+    out.position = verts[corner];
+    out.curve_start_idx = p.curve_start_idx;
+    out.band_start_idx = p.band_start_idx;
+    out.clip_rect_bounds = float4(clip.rect.x, clip.rect.y, clip.rect.x + clip.rect.z, clip.rect.y + clip.rect.w);
+}
+
 vertex VertexOut
 vertex_shader(u32 vertex_id [[vertex_id]],
-              constant Args *args)
+              u32 instance_id [[instance_id]],
+              constant Args *args [[buffer(0)]],
+              const device PrimitiveInstance *instances [[buffer(1)]])
 {
     VertexOut out;
     device Primitives *primitives = args->primitives;
 
-    u32 primitive_idx = vertex_id & 0xFFFF;
+    // every primitive is a 4 vertex triangle strip, the vertex is its corner.
+    PrimitiveInstance instance = instances[instance_id];
+    u32 primitive_idx = instance.idx;
+    u32 corner = vertex_id;
 
-    out.primitive_type = vertex_id & 0xFFFC0000;
+    out.primitive_type = instance.type;
     out.primitive_idx = primitive_idx;
 
     if (out.primitive_type == ROUNDED_RECT) {
-        RoundedRectPrimitive r = primitives->rounded_rects[primitive_idx];
-        RectPrimitive clip = primitives->clip_rects[r.clip_rect_idx];
+        RoundedRectPrimitive r = region<RoundedRectPrimitive>(primitives, primitives->rounded_rects)[primitive_idx];
+        RectPrimitive clip = region<RectPrimitive>(primitives, primitives->clip_rects)[r.clip_rect_idx];
 
-        u32 corner = (vertex_id >> 16) & 0x3;
         float2 verts[] = {
             {r.dimensions.x,  r.dimensions.y},
             {r.dimensions.x + r.dimensions.z,  r.dimensions.y},
@@ -130,10 +253,9 @@ vertex_shader(u32 vertex_id [[vertex_id]],
         out.rect_corner_radius = r.corner_radius * metal::smoothstep(0.f, 1.f, r.corner_mask & (1 << corner));
         out.clip_rect_bounds = float4(clip.rect.x, clip.rect.y, clip.rect.x + clip.rect.z, clip.rect.y + clip.rect.w);
     } else if (out.primitive_type == TEXTURE_RECT) {
-        TextureRectPrimitive p = primitives->texture_rects[primitive_idx];
-        RectPrimitive clip = primitives->clip_rects[p.clip_rect_idx];
+        TextureRectPrimitive p = region<TextureRectPrimitive>(primitives, primitives->texture_rects)[primitive_idx];
+        RectPrimitive clip = region<RectPrimitive>(primitives, primitives->clip_rects)[p.clip_rect_idx];
 
-        u32 corner = (vertex_id >> 16) & 0x3;
         float2 verts[] = {
             {p.dimensions.x,  p.dimensions.y},
             {p.dimensions.x + p.dimensions.z,  p.dimensions.y},
@@ -154,61 +276,50 @@ vertex_shader(u32 vertex_id [[vertex_id]],
         out.texture_idx = p.texture_idx;
         out.clip_rect_bounds = float4(clip.rect.x, clip.rect.y, clip.rect.x + clip.rect.z, clip.rect.y + clip.rect.w);
     } else if (out.primitive_type == BITMAP_GLYPH) {
-        BitmapGlyphPrimitive p = primitives->bitmap_glyphs[primitive_idx];
-        RectPrimitive clip = primitives->clip_rects[p.clip_rect_idx];
-
-        u32 corner = (vertex_id >> 16) & 0x3;
-        float2 verts[] = {
-            {p.dimensions.x, p.dimensions.y},
-            {p.dimensions.x + p.dimensions.z, p.dimensions.y},
-            {p.dimensions.x,  p.dimensions.y + p.dimensions.w},
-            {p.dimensions.x + p.dimensions.z,  p.dimensions.y + p.dimensions.w},
-        };
-        float2 uvs[] = {
-            {p.uv_bounds.x, p.uv_bounds.y},
-            {p.uv_bounds.z, p.uv_bounds.y},
-            {p.uv_bounds.x,  p.uv_bounds.w},
-            {p.uv_bounds.z,  p.uv_bounds.w},
-        };
-
-        out.ndc_position = float4(verts[corner] / primitives->canvas_size.xy * float2(2, 2) - float2(1, 1), 0, 1);
-
-        out.uv = uvs[corner];
-        out.color = uint_to_vec_color(p.color);
-        out.position = verts[corner];
-        out.clip_rect_bounds = float4(clip.rect.x, clip.rect.y, clip.rect.x + clip.rect.z, clip.rect.y + clip.rect.w);
+        BitmapGlyphPrimitive p = region<BitmapGlyphPrimitive>(primitives, primitives->bitmap_glyphs)[primitive_idx];
+        bitmap_glyph_vertex(out, primitives, p, corner);
     } else if (out.primitive_type == VECTOR_GLYPH) {
-        VectorGlyphPrimitive p = primitives->vector_glyphs[primitive_idx];
-        RectPrimitive clip = primitives->clip_rects[p.clip_rect_idx];
-
-        u32 corner = (vertex_id >> 16) & 0x3;
-        float2 verts[] = {
-            {p.dimensions.x - 1 , p.dimensions.y - 1},
-            {p.dimensions.x + p.dimensions.z + 1, p.dimensions.y - 1},
-            {p.dimensions.x - 1,  p.dimensions.y + p.dimensions.w + 1},
-            {p.dimensions.x + p.dimensions.z + 1,  p.dimensions.y + p.dimensions.w + 1},
-        };
-        float2 uvs[] = {
-            {-(1 / p.dimensions.z),       1 + (1 / p.dimensions.w)},
-            {1 + (1 / p.dimensions.z),   1 + (1 / p.dimensions.w)},
-            {-(1 / p.dimensions.z),     -(1 / p.dimensions.w)},
-            {1 + (1 / p.dimensions.z), -(1 / p.dimensions.w)},
-        };
-
-        out.ndc_position = float4(verts[corner] / primitives->canvas_size.xy * float2(2, 2) - float2(1, 1), 0, 1);
-
-        out.uv = uvs[corner];
-        out.color = uint_to_vec_color(p.color);
-        out.position = verts[corner];
-        out.clip_rect_bounds = float4(clip.rect.x, clip.rect.y, clip.rect.x + clip.rect.z, clip.rect.y + clip.rect.w);
+        VectorGlyphPrimitive p = region<VectorGlyphPrimitive>(primitives, primitives->vector_glyphs)[primitive_idx];
+        vector_glyph_vertex(out, primitives, p, corner);
+    } else if (out.primitive_type == GLYPH_RUN) {
+        // a run is drawn as an instance per glyph, idx is the glyph's. Each
+        // glyph is drawn as the bitmap or vector glyph it expands to, the same
+        // way expand_run_glyph in software_renderer.hpp does it.
+        RunGlyphPrimitive glyph = region<RunGlyphPrimitive>(primitives, primitives->run_glyphs)[primitive_idx];
+        GlyphRunPrimitive run = region<GlyphRunPrimitive>(primitives, primitives->glyph_runs)[glyph.run_idx];
+        GlyphShapePrimitive shape = region<GlyphShapePrimitive>(primitives, primitives->glyph_shapes)[glyph.shape_idx];
+
+        f32 x = run.origin.x + glyph.x + (run.scale * shape.bearing.x);
+        f32 y = run.origin.y - (run.scale * shape.bearing.y);
+        if (shape.atlas_page != GLYPH_SHAPE_VECTOR) {
+            BitmapGlyphPrimitive p;
+            p.dimensions = Vec4f(metal::round(x), metal::round(y), shape.size.x, shape.size.y);
+            p.uv_bounds = shape.uv_bounds;
+            p.clip_rect_idx = run.clip_rect_idx;
+            p.color = run.color;
+            p.atlas_page = shape.atlas_page;
+
+            out.primitive_type = BITMAP_GLYPH;
+            bitmap_glyph_vertex(out, primitives, p, corner);
+        } else {
+            VectorGlyphPrimitive p;
+            p.dimensions = Vec4f(x, y, run.scale * shape.size.x, run.scale * shape.size.y);
+            p.curve_start_idx = shape.curve_start_idx;
+            p.curve_count = shape.curve_count;
+            p.color = run.color;
+            p.clip_rect_idx = run.clip_rect_idx;
+            p.band_start_idx = shape.band_start_idx;
+
+            out.primitive_type = VECTOR_GLYPH;
+            vector_glyph_vertex(out, primitives, p, corner);
+        }
     } else if (out.primitive_type == LINE) {
-        LinePrimitive p = primitives->lines[primitive_idx];
-        RectPrimitive clip = primitives->clip_rects[p.clip_rect_idx];
+        LinePrimitive p = region<LinePrimitive>(primitives, primitives->lines)[primitive_idx];
+        RectPrimitive clip = region<RectPrimitive>(primitives, primitives->clip_rects)[p.clip_rect_idx];
 
         float2 d = metal::normalize(p.b - p.a);
         float2 tangent = float2(-d.y, d.x) * 10;
 
-        u32 corner = (vertex_id >> 16) & 0x3;
         float2 verts[] = {
             p.a + tangent,
             p.a - tangent,
@@ -244,11 +355,16 @@ Vec2f rotate(Vec2f p, f32 cos_theta, f32 sin_theta) {
   return p2;
 }
 
-// copied from https://github.com/GreenLightning/gpu-font-rendering
-f32 compute_coverage(ConicCurvePrimitive curve, Vec2f origin, f32 rotation, f32 pixel_width)
+// based on https://github.com/GreenLightning/gpu-font-rendering
+// direction is (cos, sin) of the ray angle, the ray starts at origin.
+// Curves are split to be monotonic when fonts are loaded, so the ray crosses
+// a curve at most once, and the crossing is clamped onto the curve so a ray
+// through the point where two curves meet counts it exactly once. Curves that
+// came from straight segments are tagged and skip the quadratic.
+f32 compute_coverage(ConicCurvePrimitive curve, bool is_line, Vec2f origin, Vec2f direction, f32 pixel_width)
 {
-  f32 cos_theta = metal::cos(rotation);
-  f32 sin_theta = metal::sin(rotation);
+  f32 cos_theta = direction.x;
+  f32 sin_theta = direction.y;
 
   curve.p0 -= origin;
   curve.p1 -= origin;
@@ -262,49 +378,35 @@ f32 compute_coverage(ConicCurvePrimitive curve, Vec2f origin, f32 rotation, f32
   Vec2f p1 = curve.p1;
   Vec2f p2 = curve.p2;
 
-  if (p0.y >= 0 && p1.y >= 0 && p2.y >= 0) return 0.0;
-  if (p0.y < 0 && p1.y < 0 && p2.y < 0) return 0.0;
+  // the control point is between the end points on a monotonic curve.
+  if (p0.y >= 0 && p2.y >= 0) return 0.0;
+  if (p0.y < 0 && p2.y < 0) return 0.0;
 
   // Note: Simplified from abc formula by extracting a factor of (-2) from b.
   Vec2f a = p0 - 2 * p1 + p2;
   Vec2f b = p0 - p1;
   Vec2f c = p0;
 
-  f32 t0, t1;
-  if (metal::abs(a.y) >= 1e-5) {
-    f32 radicand = b.y * b.y - a.y * c.y;
-    if (radicand <= 0) return 0.0;
-
-    f32 s = metal::sqrt(radicand);
-    t0      = (b.y - s) / a.y;
-    t1      = (b.y + s) / a.y;
+  f32 t;
+  if (is_line || metal::abs(a.y) < 1e-5) {
+    t = p0.y / (p0.y - p2.y);
   } else {
-    f32 t = p0.y / (p0.y - p2.y);
-    if (p0.y < p2.y) {
-      t0 = -1.0;
-      t1 = t;
-    } else {
-      t0 = t;
-      t1 = -1.0;
-    }
+    f32 s  = metal::sqrt(metal::max(b.y * b.y - a.y * c.y, 0.f));
+    f32 t0 = (b.y - s) / a.y;
+    f32 t1 = (b.y + s) / a.y;
+    t      = metal::abs(t0 - .5f) < metal::abs(t1 - .5f) ? t0 : t1;
   }
+  t = metal::clamp(t, 0.f, 1.f);
 
-  f32 alpha = 0;
-
-  if (t0 >= 0 && t0 < 1) {
-    f32 x = (a.x * t0 - 2.0 * b.x) * t0 + c.x;
-    alpha += metal::clamp(x * (1.f / pixel_width) + .5f, 0.f, 1.f);
-  }
-
-  if (t1 >= 0 && t1 < 1) {
-    f32 x = (a.x * t1 - 2.0 * b.x) * t1 + c.x;
-    alpha -= metal::clamp(x * (1.f / pixel_width) + .5f, 0.f, 1.f);
-  }
-
-  return alpha;
+  f32 sign = p0.y < p2.y ? -1.f : 1.f;
+  f32 x    = (a.x * t - 2.0 * b.x) * t + c.x;
+  return sign * metal::clamp(x * (1.f / pixel_width) + .5f, 0.f, 1.f);
 }
 
-fragment float4 fragment_shader(VertexOut in [[stage_in]], constant Args *args) {
+constexpr metal::sampler glyph_atlas_sampler(metal::filter::linear);
+
+fragment float4 fragment_shader(VertexOut in [[stage_in]], constant Args *args,
+                                metal::texture2d_array<f32> glyph_atlas [[texture(0)]]) {
     Vec4f out(0);
 
     device Primitives *primitives = args->primitives;
@@ -322,26 +424,47 @@ fragment float4 fragment_shader(VertexOut in [[stage_in]], constant Args *args)
       // out = texture(tex_samplers[in.texture_idx], in.uv);
       out.a *= clip(in.position, in.clip_rect_bounds);
     } else if (in.primitive_type == BITMAP_GLYPH) {
-      // out = Vec4f(in.color.rgb, in.color.a * texture(tex_samplers[0], in.uv).r);
+      out = Vec4f(in.color.rgb, in.color.a * glyph_atlas.sample(glyph_atlas_sampler, in.uv, in.texture_idx).r);
       out.a *= clip(in.position, in.clip_rect_bounds);
     } else if (in.primitive_type == VECTOR_GLYPH) {
-      VectorGlyphPrimitive glyph = primitives->vector_glyphs[in.primitive_idx];
-
-      u32 n_samples = 8;
+      Vec2f width   = metal::fwidth(in.uv) * 2;
       f32 coverage  = 0.f;
-      for (u32 curve_i = 0; curve_i < glyph.curve_count; curve_i++) {
-        ConicCurvePrimitive curve = primitives->conic_curves[glyph.curve_start_idx + curve_i];
-        for (u32 s = 0; s < n_samples; s++) {
-          f32 angle = 3.1415 * s / n_samples;
-          f32 width = metal::length(metal::fwidth(in.uv) * Vec2f(metal::cos(angle), metal::sin(angle))) * 2;
-          coverage += compute_coverage(curve, in.uv, angle, width) /
-                      n_samples;
-        }
+
+      device GlyphBandPrimitive *bands   = region<GlyphBandPrimitive>(primitives, primitives->glyph_bands);
+      device u16 *band_curves            = region<u16>(primitives, primitives->band_curves);
+      device ConicCurvePrimitive *curves = region<ConicCurvePrimitive>(primitives, primitives->conic_curves) + in.curve_start_idx;
+      device CurveBoundsPrimitive *bounds = region<CurveBoundsPrimitive>(primitives, primitives->curve_bounds) + in.curve_start_idx;
+
+      // a ray towards +x through the pixel's horizontal band, curves are
+      // sorted so everything after the first one behind the pixel is too.
+      // A ray only crosses curves whose height range holds it, the rest are
+      // skipped before their control points are even loaded.
+      u32 hband_i = metal::clamp(i32(metal::floor(in.uv.y * GLYPH_BANDS)), 0, i32(GLYPH_BANDS - 1));
+      GlyphBandPrimitive hband = bands[in.band_start_idx + hband_i];
+      for (u32 i = 0; i < hband.count; i++) {
+        u32 curve_i = band_curves[hband.start_idx + i];
+        CurveBoundsPrimitive b = bounds[curve_i];
+        if (b.max.x - in.uv.x < -.5 * width.x) break;
+        if (in.uv.y <= b.min.y || in.uv.y > b.max.y) continue;
+        coverage += compute_coverage(curves[curve_i], b.is_line, in.uv, Vec2f(1, 0), width.x);
+      }
+
+      // and a ray towards -y through its vertical band.
+      u32 vband_i = metal::clamp(i32(metal::floor(in.uv.x * GLYPH_BANDS)), 0, i32(GLYPH_BANDS - 1));
+      GlyphBandPrimitive vband = bands[in.band_start_idx + GLYPH_BANDS + vband_i];
+      for (u32 i = 0; i < vband.count; i++) {
+        u32 curve_i = band_curves[vband.start_idx + i];
+        CurveBoundsPrimitive b = bounds[curve_i];
+        if (b.min.y - in.uv.y > .5 * width.y) break;
+        if (in.uv.x <= b.min.x || in.uv.x > b.max.x) continue;
+        coverage += compute_coverage(curves[curve_i], b.is_line, in.uv, Vec2f(0, 1), width.y);
       }
+      coverage /= 2;
+
       out = Vec4f(in.color.rgb, in.color.a * coverage);
       out.a *= clip(in.position, in.clip_rect_bounds);
     } else if (in.primitive_type == LINE) {
-      LinePrimitive line = primitives->lines[in.primitive_idx];
+      LinePrimitive line = region<LinePrimitive>(primitives, primitives->lines)[in.primitive_idx];
 
       // ACK: https://iquilezles.org/articles/distfunctions2d/
       Vec2f pa    = in.position - line.a;
@@ -0,0 +1,131 @@
+#include <chrono>
+#include <cmath>
+
+#include "logging.hpp"
+#include "mesh/bvh.hpp"
+
+// Builds a BVH over a dense sphere, checks its closest hits against a brute
+// force loop over every triangle and reports build time and rays per second.
+
+f64 now_ms()
+{
+  return std::chrono::duration<f64, std::milli>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+StandardMesh3d make_sphere(u32 segments)
+{
+  StandardMesh3d mesh;
+  u32 row            = segments + 1;
+  mesh.vertices_size = row * row;
+  mesh.vertices      = (Vertex *)system_allocator
+                      .alloc(mesh.vertices_size * sizeof(Vertex))
+                      .data;
+  for (u32 y = 0; y <= segments; y++) {
+    for (u32 x = 0; x <= segments; x++) {
+      f32 theta = 3.14159265f * y / segments;
+      f32 phi   = 2.f * 3.14159265f * x / segments;
+      mesh.vertices[y * row + x] = {
+          {sinf(theta) * cosf(phi), sinf(theta) * sinf(phi), cosf(theta)},
+          {},
+          {}};
+    }
+  }
+
+  mesh.indexes_size = segments * segments * 6;
+  mesh.indexes =
+      (u32 *)system_allocator.alloc(mesh.indexes_size * sizeof(u32)).data;
+  u32 next = 0;
+  for (u32 y = 0; y < segments; y++) {
+    for (u32 x = 0; x < segments; x++) {
+      u32 a       = y * row + x;
+      u32 c       = a + row;
+      u32 quad[6] = {a, a + 1, c + 1, a, c + 1, c};
+      for (u32 i = 0; i < 6; i++) mesh.indexes[next++] = quad[i];
+    }
+  }
+  return mesh;
+}
+
+f32 brute_force_hit(StandardMesh3d *mesh, Ray ray)
+{
+  f32 best = INFINITY;
+  for (u32 t = 0; t < mesh->indexes_size / 3; t++) {
+    Vec3f v0 = mesh->vertices[mesh->indexes[t * 3 + 0]].position;
+    Vec3f e1 = mesh->vertices[mesh->indexes[t * 3 + 1]].position - v0;
+    Vec3f e2 = mesh->vertices[mesh->indexes[t * 3 + 2]].position - v0;
+
+    Vec3f p = cross(ray.direction, e2);
+    f32 det = dot(e1, p);
+    if (fabsf(det) < 1e-12f) continue;
+    f32 inv_det     = 1.f / det;
+    Vec3f to_origin = ray.origin - v0;
+    f32 u           = dot(to_origin, p) * inv_det;
+    if (u < 0 || u > 1) continue;
+    Vec3f q = cross(to_origin, e1);
+    f32 v   = dot(ray.direction, q) * inv_det;
+    if (v < 0 || u + v > 1) continue;
+    f32 hit_t = dot(e2, q) * inv_det;
+    if (hit_t > 0 && hit_t < best) best = hit_t;
+  }
+  return best;
+}
+
+int main()
+{
+  StandardMesh3d mesh = make_sphere(700);
+
+  f64 build_start = now_ms();
+  Bvh bvh         = build_bvh(&mesh);
+  f64 build_ms    = now_ms() - build_start;
+  info("bvh: ", bvh.triangles_size, " triangles, ", bvh.nodes_size,
+       " nodes, built in ", build_ms, " ms");
+
+  u32 failures = 0;
+  if ((u64)bvh.nodes % 64 != 0) {
+    error("bvh: nodes aren't 64 byte aligned");
+    failures++;
+  }
+
+  const u32 RAYS_COUNT    = 20000;
+  const u32 CHECKED_COUNT = 400;
+  f64 single_ms           = 0;
+  f64 packet_ms           = 0;
+  srand(1);
+  for (u32 r = 0; r < RAYS_COUNT; r += 4) {
+    Ray rays[4];
+    for (u32 l = 0; l < 4; l++) {
+      rays[l].origin    = {(rand() % 2000 - 1000) / 500.f,
+                           (rand() % 2000 - 1000) / 500.f, 3};
+      rays[l].direction = normalize(Vec3f{(rand() % 200 - 100) / 300.f,
+                                          (rand() % 200 - 100) / 300.f, -1});
+    }
+
+    RayHit hits[4], packet_hits[4];
+    f64 start = now_ms();
+    for (u32 l = 0; l < 4; l++) intersect_bvh(&bvh, rays[l], &hits[l]);
+    f64 mid = now_ms();
+    intersect_bvh_packet(&bvh, rays, packet_hits);
+    single_ms += mid - start;
+    packet_ms += now_ms() - mid;
+
+    for (u32 l = 0; l < 4; l++) {
+      if (hits[l].triangle != packet_hits[l].triangle) failures++;
+      if (r >= CHECKED_COUNT) continue;
+
+      f32 expected = brute_force_hit(&mesh, rays[l]);
+      if (expected != hits[l].t && fabsf(expected - hits[l].t) > 1e-4f) {
+        failures++;
+      }
+    }
+  }
+
+  info("bvh: ", RAYS_COUNT / single_ms / 1000, " Mrays/s single, ",
+       RAYS_COUNT / packet_ms / 1000, " Mrays/s packet");
+  if (failures > 0) {
+    error("bvh: ", failures, " hits didn't match");
+    return 1;
+  }
+  return 0;
+}
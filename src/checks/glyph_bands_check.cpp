@@ -0,0 +1,26 @@
+#include <cmath>
+
+#include "font/glyph_coverage.hpp"
+#include "logging.hpp"
+
+// Extracts printable ASCII from the UI font and checks that the banded
+// coverage matches testing every curve, at a few pixel sizes.
+
+int main()
+{
+  VectorFont font = create_font("resources/fonts/OpenSans-Regular.ttf");
+  for (u32 c = 32; c < 127; c++) font.get_glyph_idx(c);
+
+  u32 sizes[]    = {8, 13, 32, 100};
+  u32 mismatches = 0;
+  for (u32 i = 0; i < 4; i++) {
+    mismatches += validate_glyph_bands(&font, sizes[i]);
+  }
+
+  destroy_font(&font);
+  if (mismatches > 0) {
+    error("glyph bands: ", mismatches, " pixels didn't match");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,143 @@
+#include <chrono>
+#include <cmath>
+
+#include "font/glyph_coverage.hpp"
+#include "logging.hpp"
+
+// Checks rasterize_glyph against glyph_coverage at every pixel center and
+// against the golden images in resources/checks/, then reports glyphs per
+// second for one core and for rasterize_glyphs. Pass --update to rewrite the
+// golden images after an intended change.
+
+const char GOLDEN_TEXT[]   = "Rag@&%8W";
+const u32 GOLDEN_SIZES[]   = {11, 24, 64};
+const u32 GOLDEN_TEXT_SIZE = sizeof(GOLDEN_TEXT) - 1;
+
+f64 now_ms()
+{
+  return std::chrono::duration<f64, std::milli>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Each glyph is stretched over a size x size cell, left to right.
+void rasterize_golden(VectorFont *font, u32 size, u8 *alpha)
+{
+  u32 stride = size * GOLDEN_TEXT_SIZE;
+  for (u32 i = 0; i < GOLDEN_TEXT_SIZE; i++) {
+    rasterize_glyph(font, font->get_glyph(GOLDEN_TEXT[i]), size, size,
+                    alpha + i * size, stride);
+  }
+}
+
+u32 count_coverage_mismatches(VectorFont *font, u32 size, u8 *alpha)
+{
+  u32 stride     = size * GOLDEN_TEXT_SIZE;
+  u32 mismatches = 0;
+  for (u32 i = 0; i < GOLDEN_TEXT_SIZE; i++) {
+    Glyph glyph      = font->get_glyph(GOLDEN_TEXT[i]);
+    Vec2f pixel_size = {1.f / size, 1.f / size};
+    for (u32 y = 0; y < size; y++) {
+      for (u32 x = 0; x < size; x++) {
+        Vec2f uv     = {(x + .5f) / size, 1.f - (y + .5f) / size};
+        f32 coverage = glyph_coverage(font, glyph, uv, pixel_size);
+        i32 expected = (i32)(fminf(fmaxf(coverage, 0.f), 1.f) * 255.f + .5f);
+        i32 actual   = alpha[y * stride + i * size + x];
+        if (abs(expected - actual) > 1) mismatches++;
+      }
+    }
+  }
+  return mismatches;
+}
+
+// Goldens are binary PGMs, so they can be looked at with any image viewer.
+// Pixels may be off by one level, SSE, NEON and scalar don't round the same.
+b8 compare_golden(const char *path, u32 width, u32 height, u8 *alpha,
+                  b8 update)
+{
+  u64 size = (u64)width * height;
+  char header[32];
+  u32 header_size =
+      snprintf(header, sizeof(header), "P5 %u %u 255\n", width, height);
+
+  if (update) {
+    FILE *out = fopen(path, "wb");
+    if (!out) return false;
+    fwrite(header, 1, header_size, out);
+    fwrite(alpha, 1, size, out);
+    fclose(out);
+    return true;
+  }
+
+  MappedFile golden = map_file({(u8 *)path, (u32)strlen(path)});
+  b8 matches        = golden.data.size == header_size + size &&
+               memcmp(golden.data.data, header, header_size) == 0;
+  for (u64 i = 0; matches && i < size; i++) {
+    matches = abs(golden.data.data[header_size + i] - alpha[i]) <= 1;
+  }
+  unmap_file(&golden);
+  return matches;
+}
+
+int main(int argc, char **argv)
+{
+  b8 update = argc > 1 && strcmp(argv[1], "--update") == 0;
+
+  VectorFont font = create_font("resources/fonts/OpenSans-Regular.ttf");
+  for (u32 c = 32; c < 127; c++) font.get_glyph_idx(c);
+
+  u32 failures = 0;
+  for (u32 size : GOLDEN_SIZES) {
+    u32 width = size * GOLDEN_TEXT_SIZE;
+    Mem mem   = system_allocator.alloc(width * size);
+    u8 *alpha = mem.data;
+    rasterize_golden(&font, size, alpha);
+
+    u32 mismatches = count_coverage_mismatches(&font, size, alpha);
+    if (mismatches > 0) {
+      error("glyph raster: ", mismatches, " pixels at ", size,
+            "px don't match glyph_coverage");
+      failures++;
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "resources/checks/glyph_raster_%u.pgm", size);
+    if (!compare_golden(path, width, size, alpha, update)) {
+      error("glyph raster: ", path, " doesn't match");
+      failures++;
+    }
+    system_allocator.free(mem);
+  }
+
+  // every printable glyph at 32px, one core and then spread over all of them.
+  const u32 SIZE      = 32;
+  const u32 REPEATS   = 50;
+  const u32 JOBS_SIZE = 95 * REPEATS;
+
+  Mem bitmaps_mem = system_allocator.alloc(JOBS_SIZE * SIZE * SIZE);
+  Mem jobs_mem = system_allocator.alloc(JOBS_SIZE * sizeof(GlyphRasterJob));
+  GlyphRasterJob *jobs = (GlyphRasterJob *)jobs_mem.data;
+  for (u32 i = 0; i < JOBS_SIZE; i++) {
+    u8 *alpha = bitmaps_mem.data + (u64)i * SIZE * SIZE;
+    jobs[i]   = {font.glyphs[i % 95], SIZE, SIZE, alpha, SIZE};
+  }
+
+  f64 start = now_ms();
+  for (u32 i = 0; i < JOBS_SIZE; i++) {
+    rasterize_glyph(&font, jobs[i].glyph, SIZE, SIZE, jobs[i].alpha, SIZE);
+  }
+  f64 single_ms = now_ms() - start;
+
+  start = now_ms();
+  rasterize_glyphs(&font, jobs, JOBS_SIZE);
+  f64 parallel_ms = now_ms() - start;
+
+  info("glyph raster: ", JOBS_SIZE / single_ms * 1000,
+       " glyphs/s on one core, ", JOBS_SIZE / parallel_ms * 1000,
+       " glyphs/s on ", worker_thread_count(), " threads at ", SIZE, "px");
+
+  system_allocator.free(bitmaps_mem);
+  system_allocator.free(jobs_mem);
+  destroy_font(&font);
+  return failures > 0 ? 1 : 0;
+}
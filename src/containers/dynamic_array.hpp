@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cassert>
+#include <cstring>
+
+#include "memory.hpp"
+#include "types.hpp"
+
+// Array that grows by doubling. Copies are shallow, the memory belongs to
+// whoever calls release().
+template <typename T>
+struct DynamicArray {
+  T *data      = nullptr;
+  u32 size     = 0;
+  u32 capacity = 0;
+
+  Mem mem              = {};
+  Allocator *allocator = &system_allocator;
+
+  T &operator[](u32 i)
+  {
+    assert(i < size);
+    return data[i];
+  }
+
+  T &operator[](i32 i)
+  {
+    assert(i < size);
+    return data[i];
+  }
+
+  void reserve(u32 new_capacity)
+  {
+    if (new_capacity <= capacity) return;
+
+    Mem new_mem = allocator->alloc((u64)new_capacity * sizeof(T));
+    if (data) {
+      memcpy(new_mem.data, data, (u64)size * sizeof(T));
+      allocator->free(mem);
+    }
+    mem      = new_mem;
+    data     = (T *)mem.data;
+    capacity = new_capacity;
+  }
+
+  u32 push_back(T val)
+  {
+    if (size == capacity) reserve(capacity ? capacity * 2 : 16);
+
+    data[size] = val;
+    return size++;
+  }
+
+  void resize(u32 new_size)
+  {
+    reserve(new_size);
+    size = new_size;
+  }
+
+  void clear() { size = 0; }
+
+  void release()
+  {
+    if (data) allocator->free(mem);
+    data     = nullptr;
+    size     = 0;
+    capacity = 0;
+  }
+};
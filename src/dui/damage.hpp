@@ -0,0 +1,401 @@
+#pragma once
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "containers/dynamic_array.hpp"
+#include "dui/primitives.hpp"
+#include "dui/software_renderer.hpp"
+#include "dui/tile_bins.hpp"
+#include "font/glyph_atlas.hpp"
+#include "hash.hpp"
+#include "types.hpp"
+
+// Finds the parts of the canvas that look different from the last frame a
+// target was rendered with, so only those are redrawn and the target keeps
+// the rest.
+//
+// Every primitive in the draw stream gets a stamp: a hash of what it draws
+// and the pixels it can touch. The stream is sorted by z and every root window
+// has its own z, so the stamps split into a layer per window, which is
+// matched to the last frame's layer with the same z. Stamps before the first
+// and after the last difference are the same in both frames. Between them, a
+// primitive that is in both frames is left alone as long as those primitives
+// are still drawn in the same order, the rest is damaged where it was and
+// where it is now. Layers that are only in one of the frames are damaged
+// entirely.
+//
+// Damage is collected on a grid of DAMAGE_CELL_SIZE cells and the damaged
+// cells are turned into rects, so what is redrawn is at most a cell larger
+// than what changed.
+
+namespace Dui
+{
+
+const u32 DAMAGE_CELL_SIZE = 16;
+
+// scattered damage is redrawn as one rect around all of it instead, each
+// rect is another pass over the whole draw stream on the GPU.
+const u32 MAX_DAMAGE_RECTS = 16;
+
+struct DamageStamp {
+  u64 hash;
+  TileBinRect bounds;
+};
+
+// A run of stamps with the same z.
+struct DamageLayer {
+  i32 z;
+  u32 start;
+  u32 count;
+};
+
+// How often a hash is in each frame's part of a layer, and how many of those
+// were kept so far.
+struct DamageMatch {
+  u32 last_count = 0;
+  u32 count      = 0;
+  u32 last_kept  = 0;
+  u32 kept       = 0;
+};
+
+struct Damage {
+  i32 width  = -1;
+  i32 height = -1;
+  u64 frame  = 0;
+
+  DynamicArray<DamageStamp> stamps;
+  DynamicArray<DamageStamp> last_stamps;
+  DynamicArray<DamageLayer> layers;
+  DynamicArray<DamageLayer> last_layers;
+
+  // what has to be redrawn, and how many pixels that is.
+  DynamicArray<TileBinRect> rects;
+  u64 pixels = 0;
+
+  // scratch
+  DynamicArray<u8> cells;
+  u32 cells_x = 0;
+  u32 cells_y = 0;
+  std::unordered_map<u64, DamageMatch> matches;
+  DynamicArray<u64> kept;
+  DynamicArray<u64> last_kept;
+};
+
+void release_damage(Damage *damage)
+{
+  damage->stamps.release();
+  damage->last_stamps.release();
+  damage->layers.release();
+  damage->last_layers.release();
+  damage->rects.release();
+  damage->cells.release();
+  damage->kept.release();
+  damage->last_kept.release();
+}
+
+// Primitives are compared by value with their clip rect index left out, it
+// shifts whenever a scissor is pushed earlier in the frame. What the clip
+// rect does is in the bounds.
+template <typename T>
+u64 hash_primitive(T primitive, u32 type, TileBinRect bounds)
+{
+  primitive.clip_rect_idx = 0;
+  u64 hash                = hash_memory(&primitive, sizeof(primitive), type);
+  return hash_memory(&bounds, sizeof(bounds), hash);
+}
+
+// A bitmap glyph whose part of the atlas was written to since it was
+// uploaded may now show a different glyph, so it never matches.
+b8 bitmap_glyph_rewritten(GlyphAtlas *atlas, BitmapGlyphPrimitive glyph)
+{
+  if (!atlas || glyph.atlas_page >= atlas->pages.size) return false;
+
+  GlyphAtlasPage *page = &atlas->pages[glyph.atlas_page];
+  if (!page->dirty) return false;
+
+  f32 size = GLYPH_ATLAS_PAGE_SIZE;
+  return glyph.uv_bounds.x * size < page->dirty_x1 &&
+         glyph.uv_bounds.z * size > page->dirty_x0 &&
+         glyph.uv_bounds.y * size < page->dirty_y1 &&
+         glyph.uv_bounds.w * size > page->dirty_y0;
+}
+
+// A run is stamped as a whole, by its glyphs' carets and shapes rather than
+// where they are in run_glyphs and glyph_shapes, which moves whenever text
+// pushed before it changes.
+u64 hash_glyph_run(Damage *damage, Primitives *primitives, GlyphAtlas *atlas,
+                   u32 idx, TileBinRect bounds)
+{
+  GlyphRunPrimitive run = primitives->glyph_runs[idx];
+  u32 glyph_start_idx   = run.glyph_start_idx;
+  run.glyph_start_idx   = 0;
+  u64 hash = hash_primitive(run, (u32)PrimitiveIds::GLYPH_RUN, bounds);
+
+  for (u32 i = 0; i < run.glyph_count; i++) {
+    RunGlyphPrimitive glyph   = primitives->run_glyphs[glyph_start_idx + i];
+    GlyphShapePrimitive shape = primitives->glyph_shapes[glyph.shape_idx];
+    hash = hash_memory(&glyph.x, sizeof(glyph.x), hash);
+    hash = hash_memory(&shape, sizeof(shape), hash);
+
+    BitmapGlyphPrimitive bitmap;
+    VectorGlyphPrimitive vector;
+    if (expand_run_glyph(primitives, run, glyph, &bitmap, &vector) ==
+            PrimitiveIds::BITMAP_GLYPH &&
+        bitmap_glyph_rewritten(atlas, bitmap)) {
+      hash = hash_memory(&damage->frame, sizeof(u64), hash);
+    }
+  }
+  return hash;
+}
+
+DamageStamp make_damage_stamp(Damage *damage, Primitives *primitives,
+                              GlyphAtlas *atlas, PrimitiveInstance instance)
+{
+  DamageStamp stamp = {};
+  u32 color;
+  if (!primitive_pixel_bounds(primitives, instance, damage->width,
+                              damage->height, &stamp.bounds, &color)) {
+    // draws nothing, so it can't damage anything either.
+    stamp.bounds = {0, 0, 0, 0};
+    return stamp;
+  }
+
+  u32 type = instance.type;
+  u32 idx  = instance.idx;
+  BitmapGlyphPrimitive bitmap;
+  switch ((PrimitiveIds)type) {
+    case PrimitiveIds::ROUNDED_RECT:
+      stamp.hash = hash_primitive(primitives->rounded_rects[idx], type,
+                                  stamp.bounds);
+      break;
+    case PrimitiveIds::TEXTURE_RECT:
+      stamp.hash = hash_primitive(primitives->texture_rects[idx], type,
+                                  stamp.bounds);
+      break;
+    case PrimitiveIds::BITMAP_GLYPH:
+      bitmap     = primitives->bitmap_glyphs[idx];
+      stamp.hash = hash_primitive(bitmap, type, stamp.bounds);
+      if (bitmap_glyph_rewritten(atlas, bitmap)) {
+        stamp.hash = hash_memory(&damage->frame, sizeof(u64), stamp.hash);
+      }
+      break;
+    case PrimitiveIds::VECTOR_GLYPH:
+      stamp.hash = hash_primitive(primitives->vector_glyphs[idx], type,
+                                  stamp.bounds);
+      break;
+    case PrimitiveIds::GLYPH_RUN:
+      stamp.hash = hash_glyph_run(damage, primitives, atlas, idx, stamp.bounds);
+      break;
+    case PrimitiveIds::LINE:
+      stamp.hash = hash_primitive(primitives->lines[idx], type, stamp.bounds);
+      break;
+    default:
+      break;
+  }
+  return stamp;
+}
+
+void damage_bounds(Damage *damage, TileBinRect bounds)
+{
+  if (bounds.x0 >= bounds.x1 || bounds.y0 >= bounds.y1) return;
+
+  i32 cell_size = DAMAGE_CELL_SIZE;
+  for (i32 y = bounds.y0 / cell_size; y <= (bounds.y1 - 1) / cell_size; y++) {
+    u8 *row = damage->cells.data + y * damage->cells_x;
+    for (i32 x = bounds.x0 / cell_size; x <= (bounds.x1 - 1) / cell_size;
+         x++) {
+      row[x] = true;
+    }
+  }
+}
+
+void damage_stamps(Damage *damage, DamageStamp *stamps, u32 count)
+{
+  for (u32 i = 0; i < count; i++) damage_bounds(damage, stamps[i].bounds);
+}
+
+void damage_layer(Damage *damage, DamageLayer last_layer, DamageLayer layer)
+{
+  DamageStamp *last = damage->last_stamps.data + last_layer.start;
+  DamageStamp *now  = damage->stamps.data + layer.start;
+  u32 last_count    = last_layer.count;
+  u32 count         = layer.count;
+
+  u32 same_count = std::min(last_count, count);
+  u32 prefix     = 0;
+  while (prefix < same_count && last[prefix].hash == now[prefix].hash) {
+    prefix++;
+  }
+  u32 suffix = 0;
+  while (suffix < same_count - prefix &&
+         last[last_count - 1 - suffix].hash == now[count - 1 - suffix].hash) {
+    suffix++;
+  }
+  last += prefix;
+  now += prefix;
+  last_count -= prefix + suffix;
+  count -= prefix + suffix;
+  if (last_count == 0 && count == 0) return;
+
+  // keeps as many of each hash as both frames have, the first ones in each.
+  damage->matches.clear();
+  for (u32 i = 0; i < last_count; i++) {
+    damage->matches[last[i].hash].last_count++;
+  }
+  for (u32 i = 0; i < count; i++) damage->matches[now[i].hash].count++;
+
+  damage->last_kept.clear();
+  for (u32 i = 0; i < last_count; i++) {
+    DamageMatch *match = &damage->matches[last[i].hash];
+    if (match->last_kept < std::min(match->last_count, match->count)) {
+      match->last_kept++;
+      damage->last_kept.push_back(last[i].hash);
+    } else {
+      damage_bounds(damage, last[i].bounds);
+    }
+  }
+  damage->kept.clear();
+  for (u32 i = 0; i < count; i++) {
+    DamageMatch *match = &damage->matches[now[i].hash];
+    if (match->kept < std::min(match->last_count, match->count)) {
+      match->kept++;
+      damage->kept.push_back(now[i].hash);
+    } else {
+      damage_bounds(damage, now[i].bounds);
+    }
+  }
+
+  // kept primitives that changed order can change how they overlap.
+  if (damage->kept.size > 0 &&
+      memcmp(damage->kept.data, damage->last_kept.data,
+             damage->kept.size * sizeof(u64)) != 0) {
+    damage_stamps(damage, last, last_count);
+    damage_stamps(damage, now, count);
+  }
+}
+
+// Turns runs of damaged cells into rects, growing a rect down while the next
+// row has a run with the same span.
+void collect_damage_rects(Damage *damage)
+{
+  damage->rects.clear();
+  b8 scattered = false;
+  for (u32 y = 0; y < damage->cells_y && !scattered; y++) {
+    u8 *row = damage->cells.data + y * damage->cells_x;
+    u32 x   = 0;
+    while (x < damage->cells_x && !scattered) {
+      if (!row[x]) {
+        x++;
+        continue;
+      }
+      u32 x0 = x;
+      while (x < damage->cells_x && row[x]) x++;
+
+      TileBinRect run = {
+          (i32)(x0 * DAMAGE_CELL_SIZE), (i32)(y * DAMAGE_CELL_SIZE),
+          (i32)(x * DAMAGE_CELL_SIZE), (i32)((y + 1) * DAMAGE_CELL_SIZE)};
+      b8 extended = false;
+      for (u32 i = 0; i < damage->rects.size; i++) {
+        TileBinRect *r = &damage->rects[i];
+        if (r->x0 == run.x0 && r->x1 == run.x1 && r->y1 == run.y0) {
+          r->y1    = run.y1;
+          extended = true;
+          break;
+        }
+      }
+      if (!extended) damage->rects.push_back(run);
+      scattered = damage->rects.size > MAX_DAMAGE_RECTS;
+    }
+  }
+
+  if (scattered) {
+    TileBinRect all = {INT32_MAX, INT32_MAX, 0, 0};
+    for (u32 y = 0; y < damage->cells_y; y++) {
+      for (u32 x = 0; x < damage->cells_x; x++) {
+        if (!damage->cells[y * damage->cells_x + x]) continue;
+        all.x0 = std::min(all.x0, (i32)(x * DAMAGE_CELL_SIZE));
+        all.y0 = std::min(all.y0, (i32)(y * DAMAGE_CELL_SIZE));
+        all.x1 = std::max(all.x1, (i32)((x + 1) * DAMAGE_CELL_SIZE));
+        all.y1 = std::max(all.y1, (i32)((y + 1) * DAMAGE_CELL_SIZE));
+      }
+    }
+    damage->rects.clear();
+    damage->rects.push_back(all);
+  }
+
+  damage->pixels = 0;
+  for (u32 i = 0; i < damage->rects.size; i++) {
+    TileBinRect *r = &damage->rects[i];
+    r->x1          = std::min(r->x1, damage->width);
+    r->y1          = std::min(r->y1, damage->height);
+    damage->pixels += (u64)(r->x1 - r->x0) * (r->y1 - r->y0);
+  }
+}
+
+// Stamps the frame and finds what changed since the last call. instances are
+// in draw order and split into layers, see build_draw_stream. Returns false if
+// everything has to be redrawn: on the first frame and when the canvas size
+// changed, rects is the whole canvas then.
+b8 find_damage(Damage *damage, Primitives *primitives, GlyphAtlas *atlas,
+               PrimitiveInstance *instances, DrawCall *layers,
+               u32 layers_count, i32 width, i32 height)
+{
+  b8 partial     = damage->width == width && damage->height == height;
+  damage->width  = width;
+  damage->height = height;
+  damage->frame++;
+
+  std::swap(damage->stamps, damage->last_stamps);
+  std::swap(damage->layers, damage->last_layers);
+  damage->stamps.clear();
+  damage->layers.clear();
+  for (u32 i = 0; i < layers_count; i++) {
+    DrawCall layer = layers[i];
+    damage->layers.push_back(
+        {layer.z, damage->stamps.size, (u32)layer.instance_count});
+    for (i32 j = 0; j < layer.instance_count; j++) {
+      damage->stamps.push_back(make_damage_stamp(
+          damage, primitives, atlas, instances[layer.instance_offset + j]));
+    }
+  }
+
+  if (!partial) {
+    damage->rects.clear();
+    damage->rects.push_back({0, 0, width, height});
+    damage->pixels = (u64)width * height;
+    return false;
+  }
+
+  damage->cells_x = (width + DAMAGE_CELL_SIZE - 1) / DAMAGE_CELL_SIZE;
+  damage->cells_y = (height + DAMAGE_CELL_SIZE - 1) / DAMAGE_CELL_SIZE;
+  damage->cells.resize(damage->cells_x * damage->cells_y);
+  memset(damage->cells.data, 0, damage->cells.size);
+
+  // both are sorted from the highest z down.
+  u32 last_i = 0;
+  u32 i      = 0;
+  while (last_i < damage->last_layers.size || i < damage->layers.size) {
+    DamageLayer *last = last_i < damage->last_layers.size
+                            ? &damage->last_layers[last_i]
+                            : nullptr;
+    DamageLayer *now = i < damage->layers.size ? &damage->layers[i] : nullptr;
+    if (last && (!now || last->z > now->z)) {
+      damage_stamps(damage, damage->last_stamps.data + last->start,
+                    last->count);
+      last_i++;
+    } else if (now && (!last || now->z > last->z)) {
+      damage_stamps(damage, damage->stamps.data + now->start, now->count);
+      i++;
+    } else {
+      damage_layer(damage, *last, *now);
+      last_i++;
+      i++;
+    }
+  }
+
+  collect_damage_rects(damage);
+  return true;
+}
+
+}  // namespace Dui
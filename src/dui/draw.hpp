@@ -1,96 +1,29 @@
 #pragma once
 
+#include <iterator>
+#include <unordered_map>
+
 #include "containers/static_stack.hpp"
+#include "dui/damage.hpp"
+#include "dui/occlusion.hpp"
+#include "dui/primitives.hpp"
+#include "dui/software_renderer.hpp"
 #include "font.hpp"
+#include "font/font_cache.hpp"
+#include "font/glyph_atlas.hpp"
 #include "font/vector_font.hpp"
 #include "gpu/gpu.hpp"
+#include "hash.hpp"
 #include "math/math.hpp"
+#include "radix_sort.hpp"
 #include "types.hpp"
 
 namespace Dui
 {
 
-const u32 CORNERS[] = {
-    0x00000000,
-    0x00010000,
-    0x00020000,
-    0x00030000,
-};
-
-enum struct PrimitiveIds : u32 {
-  RECT         = 1 << 18,
-  ROUNDED_RECT = 2 << 18,
-  TEXTURE_RECT = 3 << 18,
-  BITMAP_GLYPH = 4 << 18,
-  VECTOR_GLYPH = 5 << 18,
-  LINE         = 6 << 18,
-};
-
-struct RectPrimitive {
-  Engine::Rect rect;
-};
-
-struct RoundedRectPrimitive {
-  Engine::Rect dimensions;
-  u32 clip_rect_idx;
-  u32 color;
-  f32 corner_radius;
-  u32 corner_mask;
-};
-
-struct TextureRectPrimitive {
-  Engine::Rect dimensions;
-  Vec4f uv_bounds;
-  u32 texture_idx;
-  u32 clip_rect_idx;
-  // Vec2f pad;
-};
-
-struct BitmapGlyphPrimitive {
-  Engine::Rect dimensions;
-  Vec4f uv_bounds;
-  u32 clip_rect_idx;
-  u32 color;
-  // Vec2f pad;
-};
-
-struct ConicCurvePrimitive {
-  Vec2f p0, p1, p2;
-  // Vec2f pad;
-};
-
-struct VectorGlyphPrimitive {
-  Engine::Rect dimensions;
+struct UploadedGlyph {
   u32 curve_start_idx;
-  u32 curve_count;
-  u32 color;
-  u32 clip_rect_idx;
-};
-
-struct LinePrimitive {
-  Vec2f a;
-  Vec2f b;
-  u32 color;
-  u32 clip_rect_idx;
-  // Vec2f pad;
-};
-
-struct Primitives {
-  RectPrimitive clip_rects[1024];
-  RoundedRectPrimitive rounded_rects[1024];
-  BitmapGlyphPrimitive bitmap_glyphs[1024];
-  TextureRectPrimitive texture_rects[1024];
-  VectorGlyphPrimitive vector_glyphs[1024];
-  ConicCurvePrimitive conic_curves[4096];
-  LinePrimitive lines[4096];
-  Vec4f canvas_size;
-};
-
-struct DrawCall {
-  i32 vert_offset;
-  i32 tri_count;
-
-  i32 z;
+  u32 band_start_idx;
 };
 
 struct DrawSettings {
@@ -99,7 +32,14 @@ struct DrawSettings {
 }; 
 
 struct DrawList {
-  u64 frame = 0;
+  u64 frame          = 0;
+  u64 uploaded_frame = 0;
+
+  // frame_hash covers everything the GPU reads for the frame, see hash_frame.
+  // drawn_hash is the frame_hash of the last frame that was rendered, a frame
+  // with the same hash looks exactly like what is on screen already.
+  u64 frame_hash = 0;
+  u64 drawn_hash = 0;
 
   Gpu::Pipeline pipeline;
   Gpu::Buffer primitive_buffer;
@@ -110,28 +50,70 @@ struct DrawList {
   VectorFont vfont;
   VectorFont icon_font;
 
+  GlyphAtlas glyph_atlas;
+  Gpu::Texture glyph_atlas_texture;
+
+  // (font id, codepoint) -> where the glyph's curves live in primitives
+  std::unordered_map<u64, UploadedGlyph> uploaded_glyphs;
+
+  // glyph_atlas_key -> the glyph shape pushed for it this frame
+  std::unordered_map<u64, u32> glyph_shape_idxs;
+
   u32 texture_count = 1;
 
   Primitives primitives;
-  i32 clip_rects_count    = 0;
-  i32 rounded_rects_count = 0;
-  i32 texture_rects_count = 0;
-  i32 bitmap_glyphs_count = 0;
-  i32 conic_curves_count  = 0;
-  i32 vector_glyphs_count = 0;
-  i32 lines_count         = 0;
+
+  // where the regions were last uploaded to. Glyph curves stay in the buffer
+  // across frames, so only the ones added since are uploaded.
+  PrimitiveRegions regions        = {};
+  u32 uploaded_conic_curves_count = 0;
+  u32 uploaded_curve_bounds_count = 0;
+  u32 uploaded_glyph_bands_count  = 0;
+  u32 uploaded_band_curves_count  = 0;
 
   StaticStack<Engine::Rect, 1024> scissors;
   StaticStack<u32, 1024> scissor_idxs;
 
+  // hash of the rect -> the clip rect pushed for it this frame, so every
+  // distinct clip region is in clip_rects once.
+  std::unordered_map<u64, u32> clip_rect_idxs;
+
+  // scissors this frame that got a new clip rect and that reused one, they
+  // hold the last frame's counts until the next one starts.
+  u32 clip_rects_pushed = 0;
+  u32 clip_rects_reused = 0;
+
   StaticStack<DrawSettings, 32> settings;
 
-  u32 *verts     = nullptr;
-  i32 vert_count = 0;
-  Gpu::Buffer index_buffer;
+  DynamicArray<PrimitiveInstance> instances;
+  Gpu::Buffer instance_buffer;
 
-  Array<DrawCall, 128> draw_calls;
+  DynamicArray<DrawCall> draw_calls;
   i32 max_z = 0;
+
+  // instances reordered into the order they are drawn in, see
+  // build_draw_stream.
+  DynamicArray<PrimitiveInstance> draw_stream;
+  u64 draw_stream_hash = 0;
+  DynamicArray<u64> draw_call_keys;
+  DynamicArray<u64> draw_call_keys_scratch;
+
+  // the draw stream's runs of instances with the same z, one per root window.
+  DynamicArray<DrawCall> draw_layers;
+
+  // what changed since the last frame drawn to the backbuffer.
+  Damage damage;
+
+  // a rect of the clear color, drawn under each damage rect of a partial
+  // redraw since the render pass only clears the target for full ones. It is
+  // the last instance in instance_buffer, after the draw stream.
+  u32 background_rect_idx = 0;
+
+  // what instance_buffer holds, see expand_draw_stream.
+  DynamicArray<PrimitiveInstance> gpu_instances;
+
+  // the opaque parts of the frame, what is behind them isn't drawn.
+  Occlusion occlusion;
 };
 
 void push_draw_settings(DrawList *dl, DrawSettings ds) {
@@ -153,6 +135,10 @@ Engine::Rect get_current_scissor(DrawList *dl) {
   }
   return dl->scissors.top(); 
 }
+// The scissor is the intersection of rect and the current scissor. A scissor
+// that clips no more than its parent reuses the parent's clip rect, and one
+// that is the same as another scissor pushed this frame reuses that one's, so
+// the shader never fetches two copies of the same clip rect.
 u32 push_scissor(DrawList *dl, Engine::Rect rect)
 {
   auto to_bounds = [](Engine::Rect r) {
@@ -171,11 +157,28 @@ u32 push_scissor(DrawList *dl, Engine::Rect rect)
             rect_bounds.w - rect_bounds.y};
   }
 
-  dl->primitives.clip_rects[dl->clip_rects_count++] = {rect};
-  dl->scissor_idxs.push_back(dl->clip_rects_count - 1);
+  u32 clip_rect_idx;
+  if (dl->scissors.size > 0 && rect == dl->scissors.top()) {
+    clip_rect_idx = dl->scissor_idxs.top();
+    dl->clip_rects_reused++;
+  } else {
+    // a hash collision just gets its own clip rect.
+    u64 key = hash_memory(&rect, sizeof(rect));
+    auto it = dl->clip_rect_idxs.find(key);
+    if (it != dl->clip_rect_idxs.end() &&
+        dl->primitives.clip_rects[it->second].rect == rect) {
+      clip_rect_idx = it->second;
+      dl->clip_rects_reused++;
+    } else {
+      clip_rect_idx = dl->primitives.clip_rects.push_back({rect});
+      dl->clip_rect_idxs.insert({key, clip_rect_idx});
+      dl->clip_rects_pushed++;
+    }
+  }
+  dl->scissor_idxs.push_back(clip_rect_idx);
   dl->scissors.push_back(rect);
 
-  return dl->clip_rects_count - 1;
+  return clip_rect_idx;
 }
 void pop_scissor(DrawList *dl)
 {
@@ -195,21 +198,129 @@ u32 push_texture(Gpu::Device *device, DrawList *dl, VkImageView image_view,
   return dl->texture_count - 1;
 }
 
-void push_draw_call(DrawList *dl, i32 tri_count, i32 z)
+// Adds a primitive to the current draw call, or to a new one if it is at a
+// different z.
+void push_instance(DrawList *dl, PrimitiveIds type, u32 primitive_idx, i32 z)
 {
+  u32 instance_idx = dl->instances.push_back({(u32)type, primitive_idx});
+
   if (dl->draw_calls.size > 0) {
     DrawCall *last_draw_call = &dl->draw_calls[dl->draw_calls.size - 1];
     if (last_draw_call->z == z) {
-      last_draw_call->tri_count += tri_count;
+      last_draw_call->instance_count++;
       return;
     }
   }
 
-  DrawCall dc = {dl->vert_count - (tri_count * 3), tri_count, z};
+  DrawCall dc = {(i32)instance_idx, 1, z};
   dl->draw_calls.push_back(dc);
   dl->max_z = std::max(dl->max_z, z);
 }
 
+// Higher z is further back, so draw calls are drawn from the highest z down,
+// and in the order they were pushed within a z so primitives in the same
+// layer overlap the way they were pushed. Clip rects and primitive types are
+// per primitive in the shader and every primitive goes through the same
+// pipeline, so they don't split draw calls and aren't part of the key.
+//
+// Negative z is never drawn (it is what unplaced groups and containers
+// default to), so z is at most INT32_MAX here and the subtraction can't wrap.
+u64 draw_call_sort_key(DrawCall call, u32 draw_call_idx)
+{
+  return ((u64)((u32)INT32_MAX - (u32)call.z) << 32) | draw_call_idx;
+}
+
+// Copies the instances of every draw call into draw_stream in the order they
+// are drawn in, sorting the draw calls once instead of scanning all of them
+// for every z. Every draw call is compatible with the others, so the whole
+// stream is then drawn with a single instanced draw. The stream is hashed as
+// it is copied, while it is still in cache.
+//
+// A glyph run stays one instance here, see expand_draw_stream. Instances
+// entirely behind an occluder in front of their draw call are left out, a
+// glyph run only as a whole.
+void build_draw_stream(DrawList *dl)
+{
+  u32 count = 0;
+  dl->draw_call_keys.resize(dl->draw_calls.size);
+  dl->draw_call_keys_scratch.resize(dl->draw_calls.size);
+  for (u32 i = 0; i < dl->draw_calls.size; i++) {
+    if (dl->draw_calls[i].z < 0) continue;
+    dl->draw_call_keys[count++] = draw_call_sort_key(dl->draw_calls[i], i);
+  }
+  radix_sort(dl->draw_call_keys.data, dl->draw_call_keys_scratch.data, count);
+
+  dl->draw_stream.clear();
+  dl->draw_stream.reserve(dl->instances.size);
+  dl->draw_layers.clear();
+  u64 hash             = hash_memory(nullptr, 0);
+  Occlusion *occlusion = &dl->occlusion;
+  for (u32 i = 0; i < count; i++) {
+    DrawCall call          = dl->draw_calls[(u32)dl->draw_call_keys[i]];
+    PrimitiveInstance *src = dl->instances.data + call.instance_offset;
+    PrimitiveInstance *dst = dl->draw_stream.data + dl->draw_stream.size;
+    i32 dst_count          = 0;
+
+    occlusion->in_front.clear();
+    for (u32 j = 0; j < occlusion->occluders.size; j++) {
+      Occluder o = occlusion->occluders[j];
+      if (o.z < call.z) occlusion->in_front.push_back(o.rect);
+    }
+    for (i32 j = 0; j < call.instance_count; j++) {
+      PrimitiveInstance instance = src[j];
+      if (occlusion->in_front.size > 0 &&
+          primitive_occluded(&dl->primitives, instance,
+                             occlusion->in_front.data,
+                             occlusion->in_front.size)) {
+        occlusion->culled_primitives++;
+        continue;
+      }
+      dst[dst_count++] = instance;
+    }
+    if (dst_count == 0) continue;
+    hash = hash_memory(dst, dst_count * sizeof(PrimitiveInstance), hash);
+
+    u32 layers_count = dl->draw_layers.size;
+    if (layers_count > 0 && dl->draw_layers[layers_count - 1].z == call.z) {
+      dl->draw_layers[layers_count - 1].instance_count += dst_count;
+    } else {
+      dl->draw_layers.push_back(
+          {(i32)dl->draw_stream.size, dst_count, call.z});
+    }
+    dl->draw_stream.size += dst_count;
+  }
+  dl->draw_stream_hash = hash;
+}
+
+// The draw stream as the GPU draws it, every instance id indexes its own
+// record. A glyph run becomes an instance per glyph with idx into run_glyphs,
+// the glyph has its run's index. Only the records are written, the glyphs
+// aren't read. The background rect goes last.
+void expand_draw_stream(DrawList *dl)
+{
+  PrimitiveInstance *stream = dl->draw_stream.data;
+  GlyphRunPrimitive *runs   = dl->primitives.glyph_runs.data;
+  u32 count                 = 1;
+  for (u32 i = 0; i < dl->draw_stream.size; i++) {
+    b8 is_run = stream[i].type == (u32)PrimitiveIds::GLYPH_RUN;
+    count += is_run ? runs[stream[i].idx].glyph_count : 1;
+  }
+  dl->gpu_instances.resize(count);
+
+  PrimitiveInstance *dst = dl->gpu_instances.data;
+  for (u32 i = 0; i < dl->draw_stream.size; i++) {
+    if (stream[i].type != (u32)PrimitiveIds::GLYPH_RUN) {
+      *dst++ = stream[i];
+      continue;
+    }
+    GlyphRunPrimitive run = runs[stream[i].idx];
+    for (u32 j = 0; j < run.glyph_count; j++) {
+      *dst++ = {stream[i].type, run.glyph_start_idx + j};
+    }
+  }
+  *dst = {(u32)PrimitiveIds::ROUNDED_RECT, dl->background_rect_idx};
+}
+
 enum CornerMask : u32 {
   TOP_LEFT     = 0b0001,
   TOP_RIGHT    = 0b0010,
@@ -222,77 +333,71 @@ enum CornerMask : u32 {
 u32 push_primitive_rounded_rect(DrawList *dl, Engine::Rect rect, Color color,
                                 f32 corner_radius, u32 corner_mask)
 {
-  dl->primitives.rounded_rects[dl->rounded_rects_count++] = {
-      rect, get_current_scissor_idx(dl), color_to_int(color), corner_radius,
-      corner_mask};
-
-  return dl->rounded_rects_count - 1;
+  return push_primitive(
+      &dl->primitives.rounded_rects,
+      {rect, get_current_scissor_idx(dl), color_to_int(color), corner_radius,
+       corner_mask});
 }
 
-RoundedRectPrimitive *push_rounded_rect(DrawList *dl, i32 z, Engine::Rect rect,
-                                        f32 corner_radius, Color color,
-                                        u32 corner_mask = CornerMask::ALL)
+// Returns the index of the rect in primitives.rounded_rects, or -1 if it was
+// clipped away. The primitive can still be changed until the frame ends.
+i32 push_rounded_rect(DrawList *dl, i32 z, Engine::Rect rect, f32 corner_radius,
+                      Color color, u32 corner_mask = CornerMask::ALL)
 {
-  auto push_rect_vert = [](DrawList *dl, u32 primitive_index, u8 corner) {
-    dl->verts[dl->vert_count++] = {(u32)PrimitiveIds::ROUNDED_RECT |
-                                   CORNERS[corner] | primitive_index};
-  };
-
   if (!overlaps(rect, get_current_scissor(dl))) {
-    return nullptr;
+    return -1;
   }
 
   u32 primitive_idx =
       push_primitive_rounded_rect(dl, rect, color, corner_radius, corner_mask);
 
-  push_rect_vert(dl, primitive_idx, 0);
-  push_rect_vert(dl, primitive_idx, 1);
-  push_rect_vert(dl, primitive_idx, 2);
-  push_rect_vert(dl, primitive_idx, 1);
-  push_rect_vert(dl, primitive_idx, 3);
-  push_rect_vert(dl, primitive_idx, 2);
-
-  push_draw_call(dl, 2, z);
+  push_instance(dl, PrimitiveIds::ROUNDED_RECT, primitive_idx, z);
 
-  return &dl->primitives.rounded_rects[primitive_idx];
+  return primitive_idx;
 }
 
-RoundedRectPrimitive *push_rect(DrawList *dl, i32 z, Engine::Rect rect, Color color)
+i32 push_rect(DrawList *dl, i32 z, Engine::Rect rect, Color color)
 {
   return push_rounded_rect(dl, z, rect, 0, color);
 }
 
-u32 push_primitive_bitmap_glyph(DrawList *dl, Engine::Rect rect, Vec4f uv_bounds,
-                                Color color)
+// Marks rect, inside the current scissor, as drawn fully opaque at z, see
+// occlusion.hpp.
+void push_occluder(DrawList *dl, i32 z, Engine::Rect rect)
 {
-  dl->primitives.bitmap_glyphs[dl->bitmap_glyphs_count++] = {
-      rect, uv_bounds, get_current_scissor_idx(dl), color_to_int(color)};
+  Engine::Rect scissor = get_current_scissor(dl);
+  f32 x0               = fmaxf(rect.x, scissor.x);
+  f32 y0               = fmaxf(rect.y, scissor.y);
+  f32 x1               = fminf(rect.right(), scissor.right());
+  f32 y1               = fminf(rect.bottom(), scissor.bottom());
+  add_occluder(&dl->occlusion, z, {x0, y0, x1 - x0, y1 - y0});
+}
 
-  return dl->bitmap_glyphs_count - 1;
+// Whether rect is hidden behind the occluders in front of z.
+b8 is_occluded(DrawList *dl, Engine::Rect rect, i32 z)
+{
+  return rect_occluded(&dl->occlusion, rect, z);
 }
 
-void push_bitmap_glyph(DrawList *dl, i32 z, Engine::Rect rect, Vec4f uv_bounds,
-                       Color color)
+u32 push_primitive_bitmap_glyph(DrawList *dl, Engine::Rect rect, Vec4f uv_bounds,
+                                u32 atlas_page, Color color)
 {
-  auto push_glyph_vert = [](DrawList *dl, u32 primitive_index, u8 corner) {
-    dl->verts[dl->vert_count++] = {(u32)PrimitiveIds::BITMAP_GLYPH |
-                                   CORNERS[corner] | primitive_index};
-  };
+  return push_primitive(&dl->primitives.bitmap_glyphs,
+                        {rect, uv_bounds, get_current_scissor_idx(dl),
+                         color_to_int(color), atlas_page});
+}
 
+void push_bitmap_glyph(DrawList *dl, i32 z, Engine::Rect rect, Vec4f uv_bounds,
+                       u32 atlas_page, Color color)
+{
   if (!overlaps(rect, get_current_scissor(dl))) {
     return;
   }
 
-  u32 primitive_idx = push_primitive_bitmap_glyph(dl, rect, uv_bounds, color);
-
-  push_glyph_vert(dl, primitive_idx, 0);
-  push_glyph_vert(dl, primitive_idx, 1);
-  push_glyph_vert(dl, primitive_idx, 2);
-  push_glyph_vert(dl, primitive_idx, 1);
-  push_glyph_vert(dl, primitive_idx, 3);
-  push_glyph_vert(dl, primitive_idx, 2);
+  u32 primitive_idx =
+      push_primitive_bitmap_glyph(dl, rect, uv_bounds, atlas_page, color);
 
-  push_draw_call(dl, 2, z);
+  push_instance(dl, PrimitiveIds::BITMAP_GLYPH, primitive_idx, z);
 }
 
 void push_text(DrawList *dl, i32 z, String text, Vec2f pos, Color color,
@@ -312,7 +417,7 @@ void push_text(DrawList *dl, i32 z, String text, Vec2f pos, Color color,
 
     Vec4f uv_bounds = {c.uv.x, c.uv.y + c.uv.height, c.uv.x + c.uv.width,
                        c.uv.y};
-    push_bitmap_glyph(dl, z, shape_rect, uv_bounds, color);
+    push_bitmap_glyph(dl, z, shape_rect, uv_bounds, 0, color);
   }
 };
 
@@ -333,69 +438,147 @@ void push_text_centered(DrawList *dl, i32 z, String text, Vec2f pos,
 u32 push_primitive_vector_glyph(DrawList *dl, Engine::Rect rect, Glyph glyph,
                                 Color color)
 {
-  dl->primitives.vector_glyphs[dl->vector_glyphs_count++] = {
-      rect, glyph.curve_start_idx, glyph.curve_count, color_to_int(color),
-      get_current_scissor_idx(dl)};
-
-  return dl->vector_glyphs_count - 1;
+  return push_primitive(
+      &dl->primitives.vector_glyphs,
+      {rect, glyph.curve_start_idx, glyph.curve_count, color_to_int(color),
+       get_current_scissor_idx(dl), glyph.band_start_idx});
 }
 
 void push_vector_glyph(DrawList *dl, i32 z, Engine::Rect rect, Glyph glyph, Color color)
 {
-  auto push_glyph_vert = [](DrawList *dl, u32 primitive_index, u8 corner) {
-    dl->verts[dl->vert_count++] = {(u32)PrimitiveIds::VECTOR_GLYPH |
-                                   CORNERS[corner] | primitive_index};
-  };
-
   if (!overlaps(rect, get_current_scissor(dl))) {
     return;
   }
 
   u32 primitive_idx = push_primitive_vector_glyph(dl, rect, glyph, color);
 
-  push_glyph_vert(dl, primitive_idx, 0);
-  push_glyph_vert(dl, primitive_idx, 1);
-  push_glyph_vert(dl, primitive_idx, 2);
-  push_glyph_vert(dl, primitive_idx, 1);
-  push_glyph_vert(dl, primitive_idx, 3);
-  push_glyph_vert(dl, primitive_idx, 2);
-
-  push_draw_call(dl, 2, z);
+  push_instance(dl, PrimitiveIds::VECTOR_GLYPH, primitive_idx, z);
 }
 
-void push_vector_text(DrawList *dl, i32 z, String text, Vec2f pos, Color color,
-                      f32 size)
+// Glyphs are extracted lazily, so their curves are copied into the primitive
+// buffer the first time they are drawn as vector glyphs. Returns the glyph
+// with its indexes pointing into the primitive buffer.
+Glyph upload_vector_glyph(DrawList *dl, VectorFont *font, u32 codepoint,
+                          Glyph glyph)
 {
-  for (int i = 0; i < text.size; i++) {
-    Glyph g = dl->vfont.glyphs[text.data[i]];
+  u64 key = ((u64)font->id << 32) | codepoint;
+  auto it = dl->uploaded_glyphs.find(key);
+  if (it != dl->uploaded_glyphs.end()) {
+    glyph.curve_start_idx = it->second.curve_start_idx;
+    glyph.band_start_idx  = it->second.band_start_idx;
+    return glyph;
+  }
+
+  Primitives *p          = &dl->primitives;
+  UploadedGlyph uploaded = {p->conic_curves.size, p->glyph_bands.size};
+  for (u32 i = 0; i < glyph.curve_count; i++) {
+    QuadCurve2 c  = font->curves[glyph.curve_start_idx + i];
+    CurveBounds b = font->curve_bounds[glyph.curve_start_idx + i];
+    p->conic_curves.push_back({c.p0, c.p1, c.p2});
+    p->curve_bounds.push_back({b.min, b.max, b.is_line});
+  }
+  for (u32 i = 0; i < GLYPH_BANDS * 2; i++) {
+    GlyphBand band = font->bands[glyph.band_start_idx + i];
+    p->glyph_bands.push_back({p->band_curves.size, band.count});
+    for (u32 j = 0; j < band.count; j++) {
+      p->band_curves.push_back(font->band_curves[band.start_idx + j]);
+    }
+  }
+  dl->uploaded_glyphs[key] = uploaded;
 
-    f32 width       = size * g.size.x;
-    f32 height      = size * g.size.y;
-    Engine::Rect shape_rect = {pos.x + (size * g.bearing.x),
-                       pos.y + (size * dl->vfont.ascent) - (size * g.bearing.y),
-                       width, height};
-    pos.x += size * g.advance;
+  glyph.curve_start_idx = uploaded.curve_start_idx;
+  glyph.band_start_idx  = uploaded.band_start_idx;
+  return glyph;
+}
 
-    push_vector_glyph(dl, z, shape_rect, dl->vfont.glyphs[text.data[i]], color);
+// Text goes through the glyph atlas where it can, so the common sizes cost a
+// texture fetch instead of a curve evaluation per pixel. A shape is pushed the
+// first time a frame uses it, every run glyph after that shares it.
+u32 push_glyph_shape(DrawList *dl, VectorFont *font, u32 codepoint, Glyph g,
+                     f32 size)
+{
+  u64 key = glyph_atlas_key(font->id, codepoint, quantize_glyph_size(size));
+  auto it = dl->glyph_shape_idxs.find(key);
+  if (it != dl->glyph_shape_idxs.end()) return it->second;
+
+  GlyphShapePrimitive shape = {};
+  shape.bearing             = g.bearing;
+
+  GlyphAtlasEntry *entry =
+      get_atlas_glyph(&dl->glyph_atlas, font, codepoint, g, size);
+  if (entry) {
+    shape.uv_bounds  = entry->uv_bounds;
+    shape.size       = entry->size;
+    shape.atlas_page = entry->page;
+  } else {
+    Glyph uploaded        = upload_vector_glyph(dl, font, codepoint, g);
+    shape.size            = g.size;
+    shape.curve_start_idx = uploaded.curve_start_idx;
+    shape.curve_count     = uploaded.curve_count;
+    shape.band_start_idx  = uploaded.band_start_idx;
+    shape.atlas_page      = GLYPH_SHAPE_VECTOR;
   }
-};
 
+  u32 shape_idx = push_primitive(&dl->primitives.glyph_shapes, shape);
+  dl->glyph_shape_idxs[key] = shape_idx;
+  return shape_idx;
+}
+
+// Pushes the string as a single glyph run, culled as a whole against the
+// scissor. A run that is only partly inside it leaves out the glyphs that are
+// outside, so their bitmaps aren't rasterized for nothing.
 void push_vector_text(DrawList *dl, VectorFont *font, i32 z, String text,
                       Vec2f pos, Color color, f32 size)
 {
-  for (int i = 0; i < text.size; i++) {
-    Glyph g = font->glyphs[text.data[i]];
-    g.curve_start_idx += font->char_buffer_offset;
-
-    f32 width       = size * g.size.x;
-    f32 height      = size * g.size.y;
-    Engine::Rect shape_rect = {pos.x + (size * g.bearing.x),
-                       pos.y + (size * font->ascent) - (size * g.bearing.y),
-                       width, height};
-    pos.x += size * g.advance;
+  TextLayout *layout = font->layout_text(text, size);
+  if (layout->ink_min.x > layout->ink_max.x) return;
+
+  // glyphs are tested by their boxes like any other primitive, the ink is
+  // their union.
+  Engine::Rect ink     = {pos + layout->ink_min,
+                          layout->ink_max - layout->ink_min};
+  Engine::Rect scissor = get_current_scissor(dl);
+  if (!overlaps(ink, scissor)) return;
+  b8 inside = ink.x >= scissor.x && ink.y >= scissor.y &&
+              ink.right() <= scissor.right() &&
+              ink.bottom() <= scissor.bottom();
+
+  Primitives *p = &dl->primitives;
+  GlyphRunPrimitive run;
+  run.origin          = {pos.x, pos.y + (size * font->ascent)};
+  run.scale           = size;
+  run.color           = color_to_int(color);
+  run.clip_rect_idx   = get_current_scissor_idx(dl);
+  run.glyph_start_idx = p->run_glyphs.size;
+  u32 run_idx         = p->glyph_runs.size;
+
+  for (u32 i = 0; i < layout->glyphs.size; i++) {
+    LayoutGlyph lg = layout->glyphs[i];
+    Glyph g        = font->glyphs[lg.glyph_idx];
+    if (g.curve_count == 0) continue;
+
+    if (!inside) {
+      Engine::Rect shape_rect = {
+          run.origin.x + layout->carets[i] + (size * g.bearing.x),
+          run.origin.y - (size * g.bearing.y), size * g.size.x,
+          size * g.size.y};
+      if (!overlaps(shape_rect, scissor)) continue;
+    }
 
-    push_vector_glyph(dl, z, shape_rect, g, color);
+    u32 shape_idx = push_glyph_shape(dl, font, lg.codepoint, g, size);
+    push_primitive(&p->run_glyphs, {layout->carets[i], run_idx, shape_idx});
   }
+
+  run.glyph_count = p->run_glyphs.size - run.glyph_start_idx;
+  if (run.glyph_count == 0) return;
+  push_instance(dl, PrimitiveIds::GLYPH_RUN,
+                push_primitive(&p->glyph_runs, run), z);
+};
+
+void push_vector_text(DrawList *dl, i32 z, String text, Vec2f pos, Color color,
+                      f32 size)
+{
+  push_vector_text(dl, &dl->vfont, z, text, pos, color, size);
 };
 
 // axes: 0 for left, 1 for center, 2 for right
@@ -415,18 +598,7 @@ void push_vector_text_justified(DrawList *dl, i32 z, String text, Vec2f pos,
     pos.y -= size / 2.f;
   }
 
-  for (int i = 0; i < text.size; i++) {
-    Glyph g = dl->vfont.glyphs[text.data[i]];
-
-    f32 width       = size * g.size.x;
-    f32 height      = size * g.size.y;
-    Engine::Rect shape_rect = {pos.x + (size * g.bearing.x),
-                       pos.y + (size * dl->vfont.ascent) - (size * g.bearing.y),
-                       width, height};
-    pos.x += size * g.advance;
-
-    push_vector_glyph(dl, z, shape_rect, dl->vfont.glyphs[text.data[i]], color);
-  }
+  push_vector_text(dl, &dl->vfont, z, text, pos, color, size);
 };
 
 void push_vector_text_centered(DrawList *dl, i32 z, String text, Vec2f pos,
@@ -438,18 +610,7 @@ void push_vector_text_centered(DrawList *dl, i32 z, String text, Vec2f pos,
   }
   if (center.y) pos.y -= size / 2;
 
-  for (int i = 0; i < text.size; i++) {
-    Glyph g = dl->vfont.glyphs[text.data[i]];
-
-    f32 width       = size * g.size.x;
-    f32 height      = size * g.size.y;
-    Engine::Rect shape_rect = {pos.x + (size * g.bearing.x),
-                       pos.y + (size * dl->vfont.ascent) - (size * g.bearing.y),
-                       width, height};
-    pos.x += size * g.advance;
-
-    push_vector_glyph(dl, z, shape_rect, dl->vfont.glyphs[text.data[i]], color);
-  }
+  push_vector_text(dl, &dl->vfont, z, text, pos, color, size);
 };
 
 void push_texture_rect(DrawList *dl, i32 z, Engine::Rect rect, Vec4f uv_bounds,
@@ -457,17 +618,10 @@ void push_texture_rect(DrawList *dl, i32 z, Engine::Rect rect, Vec4f uv_bounds,
 {
   auto push_primitive_texture_rect = [](DrawList *dl, Engine::Rect rect,
                                         Vec4f uv_bounds, u32 texture_id) {
-    dl->primitives.texture_rects[dl->texture_rects_count++] = {
-        rect, uv_bounds, texture_id, get_current_scissor_idx(dl)};
-
-    return dl->texture_rects_count - 1;
-  };
-  auto push_texture_rect_vert = [](DrawList *dl, u32 primitive_index,
-                                   u8 corner) {
-    dl->verts[dl->vert_count++] = {(u32)PrimitiveIds::TEXTURE_RECT |
-                                   CORNERS[corner] | primitive_index};
+    return push_primitive(
+        &dl->primitives.texture_rects,
+        {rect, uv_bounds, texture_id, get_current_scissor_idx(dl)});
   };
-
   if (!overlaps(rect, get_current_scissor(dl))) {
     return;
   }
@@ -475,31 +629,18 @@ void push_texture_rect(DrawList *dl, i32 z, Engine::Rect rect, Vec4f uv_bounds,
   u32 primitive_idx =
       push_primitive_texture_rect(dl, rect, uv_bounds, texture_id);
 
-  push_texture_rect_vert(dl, primitive_idx, 0);
-  push_texture_rect_vert(dl, primitive_idx, 1);
-  push_texture_rect_vert(dl, primitive_idx, 2);
-  push_texture_rect_vert(dl, primitive_idx, 1);
-  push_texture_rect_vert(dl, primitive_idx, 3);
-  push_texture_rect_vert(dl, primitive_idx, 2);
-
-  push_draw_call(dl, 2, z);
+  push_instance(dl, PrimitiveIds::TEXTURE_RECT, primitive_idx, z);
 }
 
 u32 push_primitive_line(DrawList *dl, Vec2f a, Vec2f b, Color color)
 {
-  dl->primitives.lines[dl->lines_count++] = {a, b, color_to_int(color),
-                                             get_current_scissor_idx(dl)};
-
-  return dl->lines_count - 1;
+  return push_primitive(
+      &dl->primitives.lines,
+      {a, b, color_to_int(color), get_current_scissor_idx(dl)});
 }
 
 void push_line(DrawList *dl, i32 z, Vec2f a, Vec2f b, Color color)
 {
-  auto push_vert = [](DrawList *dl, u32 primitive_index, u8 corner) {
-    dl->verts[dl->vert_count++] = {(u32)PrimitiveIds::LINE | CORNERS[corner] |
-                                   primitive_index};
-  };
-
   Vec2f mins        = min(a, b);
   Vec2f maxs        = max(a, b);
   Engine::Rect bounding_box = {mins.x, mins.y, maxs.x - mins.x, maxs.y - mins.y};
@@ -509,14 +650,7 @@ void push_line(DrawList *dl, i32 z, Vec2f a, Vec2f b, Color color)
 
   u32 primitive_idx = push_primitive_line(dl, a, b, color);
 
-  push_vert(dl, primitive_idx, 0);
-  push_vert(dl, primitive_idx, 1);
-  push_vert(dl, primitive_idx, 2);
-  push_vert(dl, primitive_idx, 1);
-  push_vert(dl, primitive_idx, 3);
-  push_vert(dl, primitive_idx, 2);
-
-  push_draw_call(dl, 2, z);
+  push_instance(dl, PrimitiveIds::LINE, primitive_idx, z);
 }
 
 void push_cubic_spline(DrawList *dl, i32 z, Vec2f p[4], Color color,
@@ -545,19 +679,10 @@ void push_cubic_spline(DrawList *dl, i32 z, Vec2f p[4], Color color,
 
 void init_draw_system(DrawList *dl, Gpu::Device *device)
 {
-  dl->vfont = create_font("resources/fonts/OpenSans-Regular.ttf");
-  for (i32 i = 0; i < dl->vfont.curves.size; i++) {
-    dl->primitives.conic_curves[dl->conic_curves_count++] = {
-        dl->vfont.curves[i].p0, dl->vfont.curves[i].p1, dl->vfont.curves[i].p2};
-  }
-
-  dl->icon_font = create_font("resources/fonts/fontello/fontello.ttf");
-  dl->icon_font.char_buffer_offset = dl->conic_curves_count;
-  for (i32 i = 0; i < dl->icon_font.curves.size; i++) {
-    dl->primitives.conic_curves[dl->conic_curves_count++] = {
-        dl->icon_font.curves[i].p0, dl->icon_font.curves[i].p1,
-        dl->icon_font.curves[i].p2};
-  }  
+  String font_files[] = {"resources/fonts/OpenSans-Regular.ttf",
+                         "resources/fonts/fontello/fontello.ttf"};
+  VectorFont *fonts[] = {&dl->vfont, &dl->icon_font};
+  load_vector_fonts(font_files, fonts, std::size(fonts));
   
   Gpu::ShaderArgumentDefinition shader_arg_def_primitives;
   shader_arg_def_primitives.type = Gpu::ShaderArgumentDefinition::Type::DATA;
@@ -579,54 +704,272 @@ void init_draw_system(DrawList *dl, Gpu::Device *device)
   dl->primitive_buffer = Gpu::create_buffer(device, 128*MB, "primitive_buffer");
   Gpu::bind_shader_buffer_data(dl->shader_args, dl->primitive_buffer, 0);
 
-  dl->verts        = (u32 *)malloc(sizeof(u32) * 1024 * 1024);
-  dl->index_buffer = create_buffer(device, MB, "index_buffer");
+  dl->instance_buffer = Gpu::create_buffer(
+      device, sizeof(PrimitiveInstance) * (1 << 16), "instance_buffer");
+
+  init_glyph_atlas(&dl->glyph_atlas, &system_allocator);
+  dl->glyph_atlas_texture = Gpu::create_texture_array(
+      device, GLYPH_ATLAS_PAGE_SIZE, GLYPH_ATLAS_PAGE_SIZE,
+      GLYPH_ATLAS_MAX_PAGES, PixelFormat::R8U);
 }
 
 void draw_system_start_frame(DrawList *dl)
 {
-  dl->vert_count = 0;
+  dl->instances.clear();
   dl->draw_calls.clear();
   dl->max_z = -1;
 
-  dl->clip_rects_count    = 0;
-  dl->rounded_rects_count = 0;
-  dl->texture_rects_count = 0;
-  dl->bitmap_glyphs_count = 0;
-  dl->vector_glyphs_count = 0;
-  dl->lines_count         = 0;
+  dl->primitives.clip_rects.clear();
+  dl->clip_rect_idxs.clear();
+  dl->clip_rects_pushed = 0;
+  dl->clip_rects_reused = 0;
+  dl->primitives.rounded_rects.clear();
+  dl->primitives.texture_rects.clear();
+  dl->primitives.bitmap_glyphs.clear();
+  dl->primitives.vector_glyphs.clear();
+  dl->primitives.lines.clear();
+  dl->primitives.glyph_runs.clear();
+  dl->primitives.run_glyphs.clear();
+  dl->primitives.glyph_shapes.clear();
+  dl->glyph_shape_idxs.clear();
 
   dl->scissor_idxs.clear();
   dl->scissors.clear();
+  dl->occlusion.occluders.clear();
+
+  glyph_atlas_start_frame(&dl->glyph_atlas);
+  text_layout_start_frame(&dl->vfont);
+  text_layout_start_frame(&dl->icon_font);
 
   push_scissor(dl, {0, 0, 100000, 100000});
+  dl->background_rect_idx = push_primitive_rounded_rect(
+      dl, {0, 0, 100000, 100000}, SOFTWARE_CLEAR_COLOR, 0, CornerMask::ALL);
+}
+
+// Swaps buffer for a bigger one if size bytes don't fit in it, at least double
+// the size so a growing UI doesn't reallocate every frame. What was in it is
+// lost. Returns true if it was swapped.
+b8 reserve_gpu_buffer(Gpu::Device *device, Gpu::Buffer *buffer, u64 size,
+                      String name)
+{
+  if (size <= (u64)buffer->size) return false;
+  if (size > INT32_MAX) fatal("a frame doesn't fit in a gpu buffer");
+
+  u64 new_size = std::max(size, (u64)buffer->size * 2);
+  new_size     = std::min(new_size, (u64)INT32_MAX);
+  Gpu::destroy_buffer(*buffer);
+  *buffer = Gpu::create_buffer(device, (i32)new_size, name);
+  return true;
 }
 
-void draw_system_end_frame(DrawList *dl, Gpu::Device *device, Vec2f canvas_size, u64 frame)
+// Lays the regions out after the PrimitiveRegions header and copies only what
+// was pushed. The glyph curve regions come first and are placed by capacity,
+// so they only move when one of them grows and otherwise just their new
+// entries are uploaded. The per frame regions follow, placed by size.
+void upload_primitives(DrawList *dl, Gpu::Device *device)
+{
+  Primitives *p = &dl->primitives;
+  u64 offset    = (sizeof(PrimitiveRegions) + 15) & ~15ull;
+  auto place    = [&](auto *region, u32 count) {
+    u32 start = offset;
+    offset += ((u64)count * sizeof(region->data[0]) + 15) & ~15ull;
+    return start;
+  };
+
+  PrimitiveRegions regions;
+  regions.conic_curves  = place(&p->conic_curves, p->conic_curves.capacity);
+  regions.curve_bounds  = place(&p->curve_bounds, p->curve_bounds.capacity);
+  regions.glyph_bands   = place(&p->glyph_bands, p->glyph_bands.capacity);
+  regions.band_curves   = place(&p->band_curves, p->band_curves.capacity);
+  regions.clip_rects    = place(&p->clip_rects, p->clip_rects.size);
+  regions.rounded_rects = place(&p->rounded_rects, p->rounded_rects.size);
+  regions.bitmap_glyphs = place(&p->bitmap_glyphs, p->bitmap_glyphs.size);
+  regions.texture_rects = place(&p->texture_rects, p->texture_rects.size);
+  regions.vector_glyphs = place(&p->vector_glyphs, p->vector_glyphs.size);
+  regions.lines         = place(&p->lines, p->lines.size);
+  regions.glyph_runs    = place(&p->glyph_runs, p->glyph_runs.size);
+  regions.run_glyphs    = place(&p->run_glyphs, p->run_glyphs.size);
+  regions.glyph_shapes  = place(&p->glyph_shapes, p->glyph_shapes.size);
+  regions.canvas_size   = p->canvas_size;
+
+  if (reserve_gpu_buffer(device, &dl->primitive_buffer, offset,
+                         "primitive_buffer")) {
+    // the new buffer doesn't have any of the glyph curves yet.
+    dl->uploaded_conic_curves_count = 0;
+    dl->uploaded_curve_bounds_count = 0;
+    dl->uploaded_glyph_bands_count  = 0;
+    dl->uploaded_band_curves_count  = 0;
+  }
+
+  auto upload = [&](auto *region, u32 region_offset, u32 from) {
+    if (region->size <= from) return;
+    u32 stride = sizeof(region->data[0]);
+    Gpu::upload_buffer(dl->primitive_buffer, region->data + from,
+                       (region->size - from) * stride,
+                       region_offset + from * stride);
+  };
+  auto upload_new = [&](auto *region, u32 region_offset, u32 last_offset,
+                        u32 *uploaded_count) {
+    if (region_offset != last_offset) *uploaded_count = 0;
+    upload(region, region_offset, *uploaded_count);
+    *uploaded_count = region->size;
+  };
+  upload_new(&p->conic_curves, regions.conic_curves, dl->regions.conic_curves,
+             &dl->uploaded_conic_curves_count);
+  upload_new(&p->curve_bounds, regions.curve_bounds, dl->regions.curve_bounds,
+             &dl->uploaded_curve_bounds_count);
+  upload_new(&p->glyph_bands, regions.glyph_bands, dl->regions.glyph_bands,
+             &dl->uploaded_glyph_bands_count);
+  upload_new(&p->band_curves, regions.band_curves, dl->regions.band_curves,
+             &dl->uploaded_band_curves_count);
+  upload(&p->clip_rects, regions.clip_rects, 0);
+  upload(&p->rounded_rects, regions.rounded_rects, 0);
+  upload(&p->bitmap_glyphs, regions.bitmap_glyphs, 0);
+  upload(&p->texture_rects, regions.texture_rects, 0);
+  upload(&p->vector_glyphs, regions.vector_glyphs, 0);
+  upload(&p->lines, regions.lines, 0);
+  upload(&p->glyph_runs, regions.glyph_runs, 0);
+  upload(&p->run_glyphs, regions.run_glyphs, 0);
+  upload(&p->glyph_shapes, regions.glyph_shapes, 0);
+
+  Gpu::upload_buffer(dl->primitive_buffer, &regions, sizeof(regions), 0);
+  dl->regions = regions;
+}
+
+// Hash of the draw stream, the per frame primitives and the canvas size. Glyph
+// curves are only ever appended to, so their counts stand in for them.
+u64 hash_frame(DrawList *dl)
+{
+  Primitives *p    = &dl->primitives;
+  u64 hash         = dl->draw_stream_hash;
+  auto hash_region = [&](auto *region) {
+    u64 size = (u64)region->size * sizeof(region->data[0]);
+    hash     = hash_memory(region->data, size, hash);
+  };
+  hash_region(&p->clip_rects);
+  hash_region(&p->rounded_rects);
+  hash_region(&p->bitmap_glyphs);
+  hash_region(&p->texture_rects);
+  hash_region(&p->vector_glyphs);
+  hash_region(&p->lines);
+  hash_region(&p->glyph_runs);
+  hash_region(&p->run_glyphs);
+  hash_region(&p->glyph_shapes);
+
+  u32 curve_counts[] = {p->conic_curves.size, p->glyph_bands.size,
+                        p->band_curves.size};
+  hash = hash_memory(curve_counts, sizeof(curve_counts), hash);
+  return hash_memory(&p->canvas_size, sizeof(p->canvas_size), hash);
+}
+
+// Finishes the frame's draw list. Returns false if the frame looks exactly
+// like the last one rendered, nothing has to be submitted then.
+b8 draw_system_end_frame(DrawList *dl, Vec2f canvas_size, u64 frame)
 {
   dl->primitives.canvas_size = Vec4f{canvas_size.x, canvas_size.y, 0 , 0};
 
   if (dl->frame != frame) {
     dl->frame = frame;
-    Gpu::upload_buffer(dl->primitive_buffer, &dl->primitives, sizeof(dl->primitives), 0);
-    Gpu::upload_buffer(dl->index_buffer, dl->verts, dl->vert_count * sizeof(u32), 0);
+    build_draw_stream(dl);
+    dl->frame_hash = hash_frame(dl);
+  }
+
+  for (u32 i = 0; i < dl->glyph_atlas.pages.size; i++) {
+    if (dl->glyph_atlas.pages[i].dirty) return true;
+  }
+  return dl->frame_hash != dl->drawn_hash;
+}
+
+// Uploads the frame and encodes its draw, between Gpu::start_frame and
+// Gpu::end_frame. If the backbuffer still holds the last frame only what
+// changed is redrawn, the background and the stream are drawn once per damage
+// rect with that rect as the scissor. The scissor is the whole backbuffer
+// again afterwards.
+void draw_system_render(DrawList *dl, Gpu::Device *device)
+{
+  Vec4f canvas_size = dl->primitives.canvas_size;
+  b8 partial        = Gpu::backbuffer_preserved(device);
+  if (!find_damage(&dl->damage, &dl->primitives, &dl->glyph_atlas,
+                   dl->draw_stream.data, dl->draw_layers.data,
+                   dl->draw_layers.size, (i32)canvas_size.x,
+                   (i32)canvas_size.y)) {
+    partial = false;
+  }
+
+  if (dl->uploaded_frame != dl->frame) {
+    dl->uploaded_frame = dl->frame;
+    upload_primitives(dl, device);
+
+    expand_draw_stream(dl);
+    u64 size = (u64)dl->gpu_instances.size * sizeof(PrimitiveInstance);
+    reserve_gpu_buffer(device, &dl->instance_buffer, size, "instance_buffer");
+    Gpu::upload_buffer(dl->instance_buffer, dl->gpu_instances.data, size, 0);
+  }
+  for (u32 i = 0; i < dl->glyph_atlas.pages.size; i++) {
+    GlyphAtlasPage *page = &dl->glyph_atlas.pages[i];
+    if (!page->dirty) continue;
+    page->dirty = false;
+    Gpu::upload_texture_region(device, dl->glyph_atlas_texture, i, page->image,
+                               page->dirty_x0, page->dirty_y0,
+                               page->dirty_x1 - page->dirty_x0,
+                               page->dirty_y1 - page->dirty_y0);
   }
   Gpu::bind_shader_buffer_data(dl->shader_args, dl->primitive_buffer, 0);
   
   device->render_command_encoder->setVertexBuffer(dl->shader_args.buffer.mtl_buffer, 0, 0);
   device->render_command_encoder->setFragmentBuffer(dl->shader_args.buffer.mtl_buffer, 0, 0);
   device->render_command_encoder->useResource(dl->primitive_buffer.mtl_buffer, MTL::ResourceUsageRead, MTL::RenderStageFragment | MTL::RenderStageVertex);
+  device->render_command_encoder->setFragmentTexture(dl->glyph_atlas_texture.mtl_texture, 0);
 
   Gpu::bind_pipeline(device, dl->pipeline);
-  for (i32 z = dl->max_z; z >= 0; z--) {
-    for (i32 i = 0; i < dl->draw_calls.size; i++) {
-      DrawCall call = dl->draw_calls[i];
-      if (call.z == z) {
-        Gpu::draw_indexed(device, dl->index_buffer, call.vert_offset,
-                          call.tri_count * 3);
-      }
+  i32 stream_instances = dl->gpu_instances.size - 1;
+  if (!partial) {
+    Gpu::draw_instanced(device, dl->instance_buffer, 4, stream_instances, 0);
+  } else {
+    // the backbuffer can lag behind the window while it is resized.
+    Vec2i size = Gpu::backbuffer_size(device);
+    f32 sx     = size.x / canvas_size.x;
+    f32 sy     = size.y / canvas_size.y;
+    for (u32 i = 0; i < dl->damage.rects.size; i++) {
+      TileBinRect r = dl->damage.rects[i];
+      i32 x0        = (i32)floorf(r.x0 * sx);
+      i32 y0        = (i32)floorf(r.y0 * sy);
+      Gpu::set_scissor(device, x0, y0, (i32)ceilf(r.x1 * sx) - x0,
+                       (i32)ceilf(r.y1 * sy) - y0);
+      Gpu::draw_instanced(device, dl->instance_buffer, 4, 1, stream_instances);
+      Gpu::draw_instanced(device, dl->instance_buffer, 4, stream_instances, 0);
     }
+    Gpu::set_scissor(device, 0, 0, size.x, size.y);
+  }
+
+  dl->drawn_hash = dl->frame_hash;
+}
+
+// Renders the frame on the CPU instead, see software_renderer.hpp. target is
+// an RGBA8 image the size of the canvas. With damage, only what changed since
+// the last frame rendered with it is redrawn, target has to still hold that
+// frame.
+void draw_system_render_software(DrawList *dl, Image *target,
+                                 Damage *damage = nullptr)
+{
+  dl->primitives.canvas_size =
+      Vec4f{(f32)target->width, (f32)target->height, 0, 0};
+
+  build_draw_stream(dl);
+
+  SoftwareFrame frame;
+  frame.primitives      = &dl->primitives;
+  frame.instances       = dl->draw_stream.data;
+  frame.instances_count = dl->draw_stream.size;
+  frame.glyph_atlas     = &dl->glyph_atlas;
+  if (damage &&
+      find_damage(damage, &dl->primitives, &dl->glyph_atlas,
+                  dl->draw_stream.data, dl->draw_layers.data,
+                  dl->draw_layers.size, target->width, target->height)) {
+    frame.damage_rects       = damage->rects.data;
+    frame.damage_rects_count = damage->rects.size;
   }
+  render_software_frame(frame, target);
 }
 
 }  // namespace Dui
\ No newline at end of file
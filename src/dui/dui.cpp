@@ -749,15 +749,21 @@ void end_popup()
   cc->expand_rect_to_content();
   cc->end_frame(&s, true);
 
-  pop_scissor(&s.dl);
-
   Popup *current_popup = get_current_popup();
-  if (current_popup->outline_rect)
-    current_popup->outline_rect->dimensions = current_popup->container.rect;
-  if (current_popup->background_rect)
-    current_popup->background_rect->dimensions =
+  auto &rounded_rects  = s.dl.primitives.rounded_rects;
+  if (current_popup->outline_rect >= 0)
+    rounded_rects[current_popup->outline_rect].dimensions =
+        current_popup->container.rect;
+  if (current_popup->background_rect >= 0) {
+    rounded_rects[current_popup->background_rect].dimensions =
         inset(current_popup->container.rect, 1);
 
+    // the background is opaque away from its rounded corners.
+    push_occluder(&s.dl, 0, inset(current_popup->container.rect, 4));
+  }
+
+  pop_scissor(&s.dl);
+
   s.started_popups_count--;
 }
 
@@ -891,6 +897,20 @@ void submenu2(Vec2f pos)
 
 namespace Dui
 {
+// A leaf's titlebar and border rects are opaque and cover all of it.
+void push_group_occluders(Group *g)
+{
+  if (!g->is_leaf()) {
+    for (i32 i = 0; i < g->splits.size; i++) {
+      push_group_occluders(g->splits[i].child.get());
+    }
+    return;
+  }
+
+  push_occluder(&s.dl, g->z, g->get_titlebar_full_rect());
+  push_occluder(&s.dl, g->z, g->get_border_rect());
+}
+
 void draw_group_and_children(Group *g)
 {
   if (!g->is_leaf()) {
@@ -1552,9 +1572,20 @@ void start_frame(Input *input, Platform::GlfwWindow *window)
     propagate_groups(root_group);
   }
 
+  // one pass for occlusion, in z order so a group hidden behind the ones in
+  // front of it doesn't hide anything itself
+  for (i32 i = 0; i < s.root_groups.size; i++) {
+    Group *g = s.root_groups[i].get();
+    if (!is_occluded(&s.dl, g->rect, g->z)) push_group_occluders(g);
+  }
+
   // one pass for drawing, in reverse z order
   for (i32 i = s.root_groups.size - 1; i >= 0; i--) {
     Group *g = s.root_groups[i].get();
+    if (is_occluded(&s.dl, g->rect, g->z)) {
+      s.dl.occlusion.culled_containers++;
+      continue;
+    }
     draw_group_and_children(g);
   }
 
@@ -1566,11 +1597,13 @@ void start_frame(Input *input, Platform::GlfwWindow *window)
   }
 }
 
-void end_frame(Platform::GlfwWindow *window, Gpu::Device *device)
+// Returns whether the frame has to be rendered, see draw_system_end_frame.
+b8 end_frame(Platform::GlfwWindow *window)
 {
   if (s.menubar_visible) {
     Engine::Rect menubar_rect = {0, 0, s.window_span.x, MENUBAR_HEIGHT};
     push_rect(&s.dl, 0, menubar_rect, d);
+    push_occluder(&s.dl, 0, menubar_rect);
 
     String menuitems[]           = {"File", "Edit", "View", "Window"};
     f32 next_menubar_item_offset = MENUBAR_MARGIN;
@@ -1609,11 +1642,15 @@ void end_frame(Platform::GlfwWindow *window, Gpu::Device *device)
     }
   }
 
-  draw_system_end_frame(&s.dl, device, s.window_span, s.frame);
+  b8 changed = draw_system_end_frame(&s.dl, s.window_span, s.frame);
 
   window->set_cursor_shape(s.cursor_shape);
+
+  return changed;
 }
 
+void render(Gpu::Device *device) { draw_system_render(&s.dl, device); }
+
 DuiId start_window(String name, Engine::Rect initial_rect)
 {
   DuiId id = hash(name);
@@ -1634,6 +1671,13 @@ DuiId start_window(String name, Engine::Rect initial_rect)
     return id;
   }
 
+  // a window hidden behind the ones in front of it is skipped the same way,
+  // its widgets aren't even laid out.
+  if (is_occluded(&s.dl, c->rect, c->z)) {
+    s.dl.occlusion.culled_containers++;
+    return id;
+  }
+
   push_rect(&s.dl, c->z, c->rect, d_dark);
   c->start_frame(&s);
 
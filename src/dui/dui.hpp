@@ -19,8 +19,8 @@ namespace Dui
 
 void init_dui(Gpu::Device *device, Gpu::Pipeline pipeline);
 void start_frame(Input *input, Platform::GlfwWindow *window);
-void end_frame(Platform::GlfwWindow *window, Gpu::Device *device,
-               Gpu::Pipeline pipeline);
+b8 end_frame(Platform::GlfwWindow *window);
+void render(Gpu::Device *device);
 DuiId start_window(String name, Engine::Rect initial_rect);
 void end_window();
 b8 button(String text, Vec2f size, Color color, b8 fill = false);
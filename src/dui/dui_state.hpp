@@ -16,8 +16,8 @@ namespace Dui
 
 struct Popup {
   Container container;
-  RoundedRectPrimitive *outline_rect;
-  RoundedRectPrimitive *background_rect;
+  i32 outline_rect    = -1;  // indexes into primitives.rounded_rects
+  i32 background_rect = -1;
 };
 
 struct DuiState {
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "containers/dynamic_array.hpp"
+#include "dui/primitives.hpp"
+#include "dui/software_renderer.hpp"
+#include "math/math.hpp"
+#include "types.hpp"
+
+// Keeps what is hidden behind opaque parts of the UI from being drawn.
+//
+// An occluder is a rect that is drawn fully opaque at some z, every root
+// window covers its whole rect for example. Lower z is in front, so anything
+// at a higher z that is entirely inside an occluder can't be seen. The UI
+// asks before laying out a window whether it is hidden behind the occluders
+// in front of it, together if need be, and build_draw_stream leaves out every
+// primitive that is entirely behind a single one of them.
+//
+// Occluders have to be pushed before anything behind them is culled against
+// them, and only for what is actually drawn.
+
+namespace Dui
+{
+
+struct Occluder {
+  Engine::Rect rect;
+  i32 z;
+};
+
+struct Occlusion {
+  DynamicArray<Occluder> occluders;
+
+  // scratch, the occluders in front of the draw call being culled.
+  DynamicArray<Engine::Rect> in_front;
+
+  u64 culled_containers = 0;
+  u64 culled_primitives = 0;
+};
+
+void release_occlusion(Occlusion *occlusion)
+{
+  occlusion->occluders.release();
+  occlusion->in_front.release();
+}
+
+// Negative z isn't drawn, so it can't hide anything.
+void add_occluder(Occlusion *occlusion, i32 z, Engine::Rect rect)
+{
+  if (z < 0 || rect.width <= 0 || rect.height <= 0) return;
+  occlusion->occluders.push_back({rect, z});
+}
+
+// Whether every point of rect is inside the occluders from first on that are
+// in front of z. The part of rect outside the first occluder that overlaps it
+// is split into up to 4 rects, which have to be covered by the later ones.
+b8 rect_occluded(Occlusion *occlusion, Engine::Rect rect, i32 z, u32 first = 0)
+{
+  for (u32 i = first; i < occlusion->occluders.size; i++) {
+    Occluder o = occlusion->occluders[i];
+    if (o.z >= z || o.rect.x >= rect.right() || o.rect.right() <= rect.x ||
+        o.rect.y >= rect.bottom() || o.rect.bottom() <= rect.y) {
+      continue;
+    }
+
+    Engine::Rect outside[4];
+    u32 outside_count = 0;
+    f32 top           = fmaxf(rect.y, o.rect.y);
+    f32 bottom        = fminf(rect.bottom(), o.rect.bottom());
+    if (rect.y < o.rect.y) {
+      outside[outside_count++] = {rect.x, rect.y, rect.width, top - rect.y};
+    }
+    if (rect.bottom() > o.rect.bottom()) {
+      outside[outside_count++] = {rect.x, bottom, rect.width,
+                                  rect.bottom() - bottom};
+    }
+    if (rect.x < o.rect.x) {
+      outside[outside_count++] = {rect.x, top, o.rect.x - rect.x,
+                                  bottom - top};
+    }
+    if (rect.right() > o.rect.right()) {
+      outside[outside_count++] = {o.rect.right(), top,
+                                  rect.right() - o.rect.right(), bottom - top};
+    }
+
+    for (u32 j = 0; j < outside_count; j++) {
+      if (!rect_occluded(occlusion, outside[j], z, i + 1)) return false;
+    }
+    return true;
+  }
+  return false;
+}
+
+// Whether the primitive draws nothing outside one of the occluders. The
+// occluder's quad covers the pixels with their centers in [min, max), the
+// primitive's quad does too but its clip rect reaches pixels with their
+// centers on its max edges.
+b8 primitive_occluded(Primitives *primitives, PrimitiveInstance instance,
+                      Engine::Rect *occluders, u32 occluders_count)
+{
+  Engine::Rect quad, clip;
+  u32 color;
+  if (!primitive_quad(primitives, instance, &quad, &clip, &color)) return false;
+
+  f32 x0 = fmaxf(quad.x, clip.x);
+  f32 y0 = fmaxf(quad.y, clip.y);
+  for (u32 i = 0; i < occluders_count; i++) {
+    Engine::Rect o = occluders[i];
+    if (x0 >= o.x && y0 >= o.y &&
+        (quad.right() <= o.right() || clip.right() < o.right()) &&
+        (quad.bottom() <= o.bottom() || clip.bottom() < o.bottom())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace Dui
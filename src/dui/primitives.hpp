@@ -0,0 +1,191 @@
+#pragma once
+
+#include "containers/dynamic_array.hpp"
+#include "logging.hpp"
+#include "math/math.hpp"
+#include "types.hpp"
+
+// What the draw list hands to the renderers, laid out the way dui.metal
+// declares it. Every primitive is drawn as an instance of a 4 vertex quad, its
+// instance record is the primitive type and the index into the type's array,
+// and the vertex shader picks the corner from the vertex id.
+//
+// Every primitive type is a region of the primitive buffer that grows as
+// needed, see upload_primitives.
+//
+// A string is pushed as a single glyph run: where it goes, its color and clip
+// rect, and a range of run_glyphs, the caret and shape of every glyph. The
+// run stays a single instance in the draw stream, so sorting, culling and
+// damage look at it once. Only the instance buffer has an instance per glyph,
+// and the vertex shader places each glyph from its run.
+
+namespace Dui
+{
+
+enum struct PrimitiveIds : u32 {
+  RECT         = 1 << 18,
+  ROUNDED_RECT = 2 << 18,
+  TEXTURE_RECT = 3 << 18,
+  BITMAP_GLYPH = 4 << 18,
+  VECTOR_GLYPH = 5 << 18,
+  LINE         = 6 << 18,
+  GLYPH_RUN    = 7 << 18,
+};
+
+struct RectPrimitive {
+  Engine::Rect rect;
+};
+
+struct RoundedRectPrimitive {
+  Engine::Rect dimensions;
+  u32 clip_rect_idx;
+  u32 color;
+  f32 corner_radius;
+  u32 corner_mask;
+};
+
+struct TextureRectPrimitive {
+  Engine::Rect dimensions;
+  Vec4f uv_bounds;
+  u32 texture_idx;
+  u32 clip_rect_idx;
+  // Vec2f pad;
+};
+
+struct BitmapGlyphPrimitive {
+  Engine::Rect dimensions;
+  Vec4f uv_bounds;
+  u32 clip_rect_idx;
+  u32 color;
+  u32 atlas_page;
+};
+
+struct ConicCurvePrimitive {
+  Vec2f p0, p1, p2;
+  // Vec2f pad;
+};
+
+// Parallel to conic_curves, see CurveBounds. pad keeps it the size of the
+// shader's struct, which aligns to its float2s.
+struct CurveBoundsPrimitive {
+  Vec2f min;
+  Vec2f max;
+  u32 is_line;
+  u32 pad;
+};
+
+struct GlyphBandPrimitive {
+  u32 start_idx;
+  u32 count;
+};
+
+struct VectorGlyphPrimitive {
+  Engine::Rect dimensions;
+  u32 curve_start_idx;
+  u32 curve_count;
+  u32 color;
+  u32 clip_rect_idx;
+  u32 band_start_idx;
+};
+
+// origin is the pen position on the baseline, scale the font size that takes
+// the glyph shapes from em units to pixels.
+struct GlyphRunPrimitive {
+  Vec2f origin;
+  f32 scale;
+  u32 color;
+  u32 clip_rect_idx;
+  u32 glyph_start_idx;
+  u32 glyph_count;
+};
+
+// x is the glyph's caret from the run's origin.
+struct RunGlyphPrimitive {
+  f32 x;
+  u32 run_idx;
+  u32 shape_idx;
+};
+
+const u32 GLYPH_SHAPE_VECTOR = 0xFFFFFFFF;
+
+// What a run glyph draws, shared by every run that uses it in a frame. A
+// bitmap shape is a glyph in the atlas, its size is in pixels. A vector shape
+// has GLYPH_SHAPE_VECTOR as its atlas_page and its curves in the curve
+// regions, its size is in em units. The bearing is in em units either way.
+struct GlyphShapePrimitive {
+  Vec4f uv_bounds;
+  Vec2f bearing;
+  Vec2f size;
+  u32 curve_start_idx;
+  u32 curve_count;
+  u32 band_start_idx;
+  u32 atlas_page;
+};
+
+struct LinePrimitive {
+  Vec2f a;
+  Vec2f b;
+  u32 color;
+  u32 clip_rect_idx;
+  // Vec2f pad;
+};
+
+// One per drawn primitive, in the order they are drawn. type is one of
+// PrimitiveIds.
+struct PrimitiveInstance {
+  u32 type;
+  u32 idx;
+};
+static_assert(sizeof(PrimitiveInstance) == 8);
+
+struct Primitives {
+  DynamicArray<RectPrimitive> clip_rects;
+  DynamicArray<RoundedRectPrimitive> rounded_rects;
+  DynamicArray<BitmapGlyphPrimitive> bitmap_glyphs;
+  DynamicArray<TextureRectPrimitive> texture_rects;
+  DynamicArray<VectorGlyphPrimitive> vector_glyphs;
+  DynamicArray<ConicCurvePrimitive> conic_curves;
+  DynamicArray<CurveBoundsPrimitive> curve_bounds;
+  DynamicArray<GlyphBandPrimitive> glyph_bands;
+  DynamicArray<u16> band_curves;
+  DynamicArray<LinePrimitive> lines;
+  DynamicArray<GlyphRunPrimitive> glyph_runs;
+  DynamicArray<RunGlyphPrimitive> run_glyphs;
+  DynamicArray<GlyphShapePrimitive> glyph_shapes;
+  Vec4f canvas_size;
+};
+
+// Starts the primitive buffer. Every region's offset is in bytes from the
+// start of the buffer.
+struct PrimitiveRegions {
+  u32 clip_rects;
+  u32 rounded_rects;
+  u32 bitmap_glyphs;
+  u32 texture_rects;
+  u32 vector_glyphs;
+  u32 conic_curves;
+  u32 curve_bounds;
+  u32 glyph_bands;
+  u32 band_curves;
+  u32 lines;
+  u32 glyph_runs;
+  u32 run_glyphs;
+  u32 glyph_shapes;
+  Vec4f canvas_size;
+};
+
+// Returns the index of the new primitive.
+template <typename T>
+u32 push_primitive(DynamicArray<T> *region, T primitive)
+{
+  return region->push_back(primitive);
+}
+
+struct DrawCall {
+  i32 instance_offset;
+  i32 instance_count;
+
+  i32 z;
+};
+
+}  // namespace Dui
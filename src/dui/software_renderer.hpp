@@ -0,0 +1,621 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "containers/dynamic_array.hpp"
+#include "dui/primitives.hpp"
+#include "dui/tile_bins.hpp"
+#include "font/glyph_atlas.hpp"
+#include "font/glyph_coverage.hpp"
+#include "image.hpp"
+#include "math/math.hpp"
+#include "math/simd.hpp"
+#include "parallel.hpp"
+#include "types.hpp"
+
+// Renders a frame's primitives on the CPU the way vertex_shader and
+// fragment_shader in dui.metal do, so the UI can be drawn without a GPU: in
+// tests, for thumbnails and screenshots, or to stream to a remote session.
+//
+// The instances are turned into a list of quads in draw order first, and the
+// quads are binned into the tiles of the canvas, see tile_bins.hpp. The tiles
+// are then rendered on all cores, every tile drawing only the quads in its
+// bin, in that same order. A tile keeps its pixels as separate r, g, b and a
+// floats so 4 pixels of a row are shaded and blended at once, and is only
+// converted to RGBA8 at the end.
+
+namespace Dui
+{
+
+const u32 SOFTWARE_TILE_SIZE = 32;
+
+// what the render pass clears to, see start_frame in gpu/metal/device.hpp.
+const Color SOFTWARE_CLEAR_COLOR = {41 / 255.f, 42 / 255.f, 48 / 255.f, 1.f};
+
+struct SoftwareFrame {
+  Primitives *primitives;
+  PrimitiveInstance *instances;  // in draw order, see build_draw_stream
+  u32 instances_count;
+
+  // only needed when there are bitmap glyphs.
+  GlyphAtlas *glyph_atlas = nullptr;
+
+  // if set, only the tiles touching these rects are rendered and the rest of
+  // the target keeps what it has, see damage.hpp.
+  TileBinRect *damage_rects = nullptr;
+  u32 damage_rects_count    = 0;
+};
+
+// A primitive's quad and the pixels it can touch, [x0, x1) x [y0, y1): those
+// with their centers inside both the quad and its clip rect.
+struct SoftwareQuad {
+  u32 type;
+  u32 idx;  // into run_glyphs for a glyph of run_idx
+  u32 run_idx;
+  Color color;
+  i32 x0, y0, x1, y1;
+};
+
+struct SoftwareTile {
+  i32 x, y;
+  f32 r[SOFTWARE_TILE_SIZE * SOFTWARE_TILE_SIZE];
+  f32 g[SOFTWARE_TILE_SIZE * SOFTWARE_TILE_SIZE];
+  f32 b[SOFTWARE_TILE_SIZE * SOFTWARE_TILE_SIZE];
+  f32 a[SOFTWARE_TILE_SIZE * SOFTWARE_TILE_SIZE];
+};
+
+// A glyph of a run as the bitmap or vector glyph it is drawn as, the way the
+// GLYPH_RUN branch of vertex_shader places it. Returns BITMAP_GLYPH or
+// VECTOR_GLYPH, for whichever of the two was filled.
+PrimitiveIds expand_run_glyph(Primitives *primitives, GlyphRunPrimitive run,
+                              RunGlyphPrimitive glyph,
+                              BitmapGlyphPrimitive *bitmap,
+                              VectorGlyphPrimitive *vector)
+{
+  GlyphShapePrimitive shape = primitives->glyph_shapes[glyph.shape_idx];
+
+  f32 x = run.origin.x + glyph.x + (run.scale * shape.bearing.x);
+  f32 y = run.origin.y - (run.scale * shape.bearing.y);
+  if (shape.atlas_page != GLYPH_SHAPE_VECTOR) {
+    *bitmap = {{roundf(x), roundf(y), shape.size.x, shape.size.y},
+               shape.uv_bounds,
+               run.clip_rect_idx,
+               run.color,
+               shape.atlas_page};
+    return PrimitiveIds::BITMAP_GLYPH;
+  }
+  *vector = {{x, y, run.scale * shape.size.x, run.scale * shape.size.y},
+             shape.curve_start_idx,
+             shape.curve_count,
+             run.color,
+             run.clip_rect_idx,
+             shape.band_start_idx};
+  return PrimitiveIds::VECTOR_GLYPH;
+}
+
+// The quad vertex_shader draws a glyph of a run with.
+Engine::Rect run_glyph_quad(Primitives *primitives, GlyphRunPrimitive run,
+                            RunGlyphPrimitive glyph)
+{
+  BitmapGlyphPrimitive bitmap;
+  VectorGlyphPrimitive vector;
+  if (expand_run_glyph(primitives, run, glyph, &bitmap, &vector) ==
+      PrimitiveIds::BITMAP_GLYPH) {
+    return bitmap.dimensions;
+  }
+  Engine::Rect d = vector.dimensions;
+  return {d.x - 1, d.y - 1, d.width + 2, d.height + 2};
+}
+
+// The quad vertex_shader draws a primitive with, or a rect around it for
+// lines and around every glyph for glyph runs, and its clip rect. Returns false for a primitive that
+// draws nothing. color is the primitive's packed color, texture rects have
+// none.
+b8 primitive_quad(Primitives *primitives, PrimitiveInstance instance,
+                  Engine::Rect *quad, Engine::Rect *clip, u32 *color)
+{
+  u32 type = instance.type;
+  u32 idx  = instance.idx;
+
+  Engine::Rect rect;
+  u32 clip_rect_idx;
+  *color = 0;
+  if (type == (u32)PrimitiveIds::ROUNDED_RECT) {
+    RoundedRectPrimitive p = primitives->rounded_rects[idx];
+    rect                   = p.dimensions;
+    clip_rect_idx          = p.clip_rect_idx;
+    *color                 = p.color;
+  } else if (type == (u32)PrimitiveIds::TEXTURE_RECT) {
+    TextureRectPrimitive p = primitives->texture_rects[idx];
+    rect                   = p.dimensions;
+    clip_rect_idx          = p.clip_rect_idx;
+  } else if (type == (u32)PrimitiveIds::BITMAP_GLYPH) {
+    BitmapGlyphPrimitive p = primitives->bitmap_glyphs[idx];
+    rect                   = p.dimensions;
+    clip_rect_idx          = p.clip_rect_idx;
+    *color                 = p.color;
+  } else if (type == (u32)PrimitiveIds::VECTOR_GLYPH) {
+    VectorGlyphPrimitive p = primitives->vector_glyphs[idx];
+    rect = {p.dimensions.x - 1, p.dimensions.y - 1, p.dimensions.width + 2,
+            p.dimensions.height + 2};
+    clip_rect_idx = p.clip_rect_idx;
+    *color        = p.color;
+  } else if (type == (u32)PrimitiveIds::GLYPH_RUN) {
+    GlyphRunPrimitive p = primitives->glyph_runs[idx];
+    Vec2f min           = {INFINITY, INFINITY};
+    Vec2f max           = {-INFINITY, -INFINITY};
+    for (u32 i = 0; i < p.glyph_count; i++) {
+      Engine::Rect glyph = run_glyph_quad(
+          primitives, p, primitives->run_glyphs[p.glyph_start_idx + i]);
+      min = Vec2f{fminf(min.x, glyph.x), fminf(min.y, glyph.y)};
+      max = Vec2f{fmaxf(max.x, glyph.right()), fmaxf(max.y, glyph.bottom())};
+    }
+    rect          = {min, max - min};
+    clip_rect_idx = p.clip_rect_idx;
+    *color        = p.color;
+  } else if (type == (u32)PrimitiveIds::LINE) {
+    LinePrimitive p = primitives->lines[idx];
+    if (p.a.x == p.b.x && p.a.y == p.b.y) return false;
+
+    // bounds of the line pushed out by its quad's half width of 10.
+    Vec2f d       = normalize(p.b - p.a);
+    Vec2f extent  = {fabsf(d.y) * 10.f, fabsf(d.x) * 10.f};
+    Vec2f min     = Vec2f{fminf(p.a.x, p.b.x), fminf(p.a.y, p.b.y)} - extent;
+    Vec2f max     = Vec2f{fmaxf(p.a.x, p.b.x), fmaxf(p.a.y, p.b.y)} + extent;
+    rect          = {min, max - min};
+    clip_rect_idx = p.clip_rect_idx;
+    *color        = p.color;
+  } else {
+    return false;
+  }
+
+  *quad = rect;
+  *clip = primitives->clip_rects[clip_rect_idx].rect;
+  return true;
+}
+
+// The pixels a quad can touch, [x0, x1) x [y0, y1), or false if it covers
+// none. A pixel is inside a quad edge when its center is in [min, max), like
+// the GPU's fill rule, and inside the clip rect when its center is in
+// [min, max], like clip() in the shader.
+b8 quad_pixel_bounds(Engine::Rect rect, Engine::Rect clip, i32 width,
+                     i32 height, TileBinRect *bounds)
+{
+  TileBinRect b;
+  b.x0 = std::max({(i32)ceilf(rect.x - .5f), (i32)ceilf(clip.x - .5f), 0});
+  b.y0 = std::max({(i32)ceilf(rect.y - .5f), (i32)ceilf(clip.y - .5f), 0});
+  b.x1 = std::min({(i32)ceilf(rect.x + rect.width - .5f),
+                   (i32)floorf(clip.x + clip.width - .5f) + 1, width});
+  b.y1 = std::min({(i32)ceilf(rect.y + rect.height - .5f),
+                   (i32)floorf(clip.y + clip.height - .5f) + 1, height});
+  *bounds = b;
+  return b.x0 < b.x1 && b.y0 < b.y1;
+}
+
+// The pixels a primitive's quad can touch, see quad_pixel_bounds.
+b8 primitive_pixel_bounds(Primitives *primitives, PrimitiveInstance instance,
+                          i32 width, i32 height, TileBinRect *bounds,
+                          u32 *color)
+{
+  Engine::Rect rect, clip;
+  if (!primitive_quad(primitives, instance, &rect, &clip, color)) {
+    return false;
+  }
+  return quad_pixel_bounds(rect, clip, width, height, bounds);
+}
+
+// Fills the quad, or returns false if it covers no pixels.
+b8 make_software_quad(Primitives *primitives, PrimitiveInstance instance,
+                      i32 width, i32 height, SoftwareQuad *quad)
+{
+  quad->type    = instance.type;
+  quad->idx     = instance.idx;
+  quad->run_idx = 0;
+
+  // texture rects are transparent until the shader samples textures.
+  if (quad->type == (u32)PrimitiveIds::TEXTURE_RECT) return false;
+
+  TileBinRect bounds;
+  u32 color;
+  if (!primitive_pixel_bounds(primitives, instance, width, height, &bounds,
+                              &color)) {
+    return false;
+  }
+  quad->color = int_to_color(color);
+  quad->x0    = bounds.x0;
+  quad->y0    = bounds.y0;
+  quad->x1    = bounds.x1;
+  quad->y1    = bounds.y1;
+  return true;
+}
+
+// A quad per glyph of the run, like the instance per glyph the GPU draws it
+// with.
+void push_software_run_quads(Primitives *primitives, u32 run_idx, i32 width,
+                             i32 height, DynamicArray<SoftwareQuad> *quads)
+{
+  GlyphRunPrimitive run = primitives->glyph_runs[run_idx];
+  Engine::Rect clip     = primitives->clip_rects[run.clip_rect_idx].rect;
+  for (u32 i = 0; i < run.glyph_count; i++) {
+    u32 glyph_idx = run.glyph_start_idx + i;
+    Engine::Rect rect =
+        run_glyph_quad(primitives, run, primitives->run_glyphs[glyph_idx]);
+
+    TileBinRect b;
+    if (!quad_pixel_bounds(rect, clip, width, height, &b)) continue;
+    quads->push_back({(u32)PrimitiveIds::GLYPH_RUN, glyph_idx, run_idx,
+                      int_to_color(run.color), b.x0, b.y0, b.x1, b.y1});
+  }
+}
+
+void build_software_quads(SoftwareFrame frame, i32 width, i32 height,
+                          DynamicArray<SoftwareQuad> *quads)
+{
+  for (u32 i = 0; i < frame.instances_count; i++) {
+    PrimitiveInstance instance = frame.instances[i];
+    if (instance.type == (u32)PrimitiveIds::GLYPH_RUN) {
+      push_software_run_quads(frame.primitives, instance.idx, width, height,
+                              quads);
+      continue;
+    }
+
+    SoftwareQuad quad;
+    if (make_software_quad(frame.primitives, instance, width, height, &quad)) {
+      quads->push_back(quad);
+    }
+  }
+}
+
+// Blends the quad into the tile over [x0, x1) x [y0, y1), which are inside
+// the tile. alpha(x, y) returns the coverage of the 4 pixels centered at
+// x, y, the quad's color and alpha are applied here.
+template <typename F>
+void fill_software_quad(SoftwareTile *tile, SoftwareQuad *quad, i32 x0, i32 y0,
+                        i32 x1, i32 y1, F alpha)
+{
+  F32x4 r     = f32x4(quad->color.r);
+  F32x4 g     = f32x4(quad->color.g);
+  F32x4 b     = f32x4(quad->color.b);
+  F32x4 a     = f32x4(quad->color.a);
+  F32x4 zero  = f32x4(0.f);
+  F32x4 one   = f32x4(1.f);
+  F32x4 lanes = f32x4(0.f, 1.f, 2.f, 3.f);
+  F32x4 min_x = f32x4((f32)x0);
+  F32x4 max_x = f32x4((f32)x1);
+
+  // spans start on a multiple of 4 so they never run past the tile's edge,
+  // the pixels before x0 get no coverage.
+  for (i32 y = y0; y < y1; y++) {
+    u32 row = (y - tile->y) * SOFTWARE_TILE_SIZE;
+    for (i32 x = x0 & ~3; x < x1; x += 4) {
+      F32x4 px     = f32x4((f32)x) + lanes;
+      F32x4 inside = (px >= min_x) & (px < max_x);
+      F32x4 src_a  = select(inside, alpha(px + f32x4(.5f), y + .5f), zero);
+      src_a        = clamp(src_a, zero, one) * a;
+
+      u32 i         = row + (x - tile->x);
+      F32x4 inv_a   = one - src_a;
+      store(tile->r + i, r * src_a + load_f32x4(tile->r + i) * inv_a);
+      store(tile->g + i, g * src_a + load_f32x4(tile->g + i) * inv_a);
+      store(tile->b + i, b * src_a + load_f32x4(tile->b + i) * inv_a);
+      store(tile->a + i, src_a + load_f32x4(tile->a + i) * inv_a);
+    }
+  }
+}
+
+// The corner radius is set per vertex, so it is interpolated across the quad's
+// two triangles, (top left, top right, bottom left) and (top right, bottom
+// right, bottom left), before the distance to the rounded rect is taken.
+void fill_software_rounded_rect(SoftwareTile *tile, SoftwareQuad *quad,
+                                RoundedRectPrimitive p, i32 x0, i32 y0, i32 x1,
+                                i32 y1)
+{
+  f32 radii[4];
+  b8 rounded = false;
+  for (u32 corner = 0; corner < 4; corner++) {
+    radii[corner] = p.corner_mask & (1 << corner) ? p.corner_radius : 0.f;
+    rounded       = rounded || radii[corner] > 0;
+  }
+  if (!rounded) {
+    fill_software_quad(tile, quad, x0, y0, x1, y1,
+                       [](F32x4, f32) { return f32x4(1.f); });
+    return;
+  }
+
+  Engine::Rect d = p.dimensions;
+  F32x4 zero     = f32x4(0.f);
+  F32x4 one      = f32x4(1.f);
+  F32x4 center_x = f32x4(d.x + d.width / 2);
+  F32x4 extent_x = f32x4(d.width / 2);
+  F32x4 extent_y = f32x4(d.height / 2);
+  fill_software_quad(tile, quad, x0, y0, x1, y1, [&](F32x4 x, f32 y) {
+    F32x4 u = (x - f32x4(d.x)) / f32x4(d.width);
+    F32x4 v = f32x4((y - d.y) / d.height);
+
+    F32x4 upper  = f32x4(radii[0]) + f32x4(radii[1] - radii[0]) * u +
+                  f32x4(radii[2] - radii[0]) * v;
+    F32x4 lower  = f32x4(radii[3]) + f32x4(radii[2] - radii[3]) * (one - u) +
+                  f32x4(radii[1] - radii[3]) * (one - v);
+    F32x4 radius = select(u + v <= one, upper, lower);
+
+    F32x4 qx   = abs(x - center_x) - (extent_x - radius);
+    F32x4 qy   = abs(f32x4(y - (d.y + d.height / 2))) - (extent_y - radius);
+    F32x4 mx   = max(qx, zero);
+    F32x4 my   = max(qy, zero);
+    F32x4 dist = sqrt(mx * mx + my * my) + min(max(qx, qy), zero) - radius;
+
+    F32x4 aa = one - smoothstep(f32x4(-1.f), zero, dist);
+    return select(radius > zero, aa, one);
+  });
+}
+
+// Only the pixels between the two ends of the line are inside its quad.
+void fill_software_line(SoftwareTile *tile, SoftwareQuad *quad, LinePrimitive p,
+                        i32 x0, i32 y0, i32 x1, i32 y1)
+{
+  Vec2f ba       = p.b - p.a;
+  f32 inv_length = 1.f / dot(ba, ba);
+  F32x4 zero     = f32x4(0.f);
+  F32x4 one      = f32x4(1.f);
+  fill_software_quad(tile, quad, x0, y0, x1, y1, [&](F32x4 x, f32 y) {
+    F32x4 pa_x = x - f32x4(p.a.x);
+    F32x4 pa_y = f32x4(y - p.a.y);
+    F32x4 t    = (pa_x * f32x4(ba.x) + pa_y * f32x4(ba.y)) * f32x4(inv_length);
+    F32x4 h    = clamp(t, zero, one);
+    F32x4 dx   = pa_x - h * f32x4(ba.x);
+    F32x4 dy   = pa_y - h * f32x4(ba.y);
+    F32x4 dist = sqrt(dx * dx + dy * dy);
+
+    F32x4 aa = one - smoothstep(zero, f32x4(2.f), dist);
+    return select((t >= zero) & (t <= one), aa, zero);
+  });
+}
+
+// Same as the VECTOR_GLYPH branch of fragment_shader, on the curves the draw
+// list copied into primitives.
+f32 primitive_glyph_coverage(Primitives *primitives, VectorGlyphPrimitive glyph,
+                             Vec2f uv, Vec2f width)
+{
+  u32 first                    = glyph.curve_start_idx;
+  ConicCurvePrimitive *curves  = &primitives->conic_curves.data[first];
+  CurveBoundsPrimitive *bounds = &primitives->curve_bounds.data[first];
+  f32 coverage                 = 0.f;
+
+  GlyphBandPrimitive hband =
+      primitives->glyph_bands[glyph.band_start_idx + glyph_band_index(uv.y)];
+  for (u32 i = 0; i < hband.count; i++) {
+    u32 curve_i            = primitives->band_curves[hband.start_idx + i];
+    CurveBoundsPrimitive b = bounds[curve_i];
+    if (b.max.x - uv.x < -.5f * width.x) break;
+    if (uv.y <= b.min.y || uv.y > b.max.y) continue;
+    ConicCurvePrimitive c = curves[curve_i];
+    coverage +=
+        compute_coverage({c.p0, c.p1, c.p2}, b.is_line, uv, {1, 0}, width.x);
+  }
+
+  GlyphBandPrimitive vband =
+      primitives->glyph_bands[glyph.band_start_idx + GLYPH_BANDS +
+                              glyph_band_index(uv.x)];
+  for (u32 i = 0; i < vband.count; i++) {
+    u32 curve_i            = primitives->band_curves[vband.start_idx + i];
+    CurveBoundsPrimitive b = bounds[curve_i];
+    if (b.min.y - uv.y > .5f * width.y) break;
+    if (uv.x <= b.min.x || uv.x > b.max.x) continue;
+    ConicCurvePrimitive c = curves[curve_i];
+    coverage +=
+        compute_coverage({c.p0, c.p1, c.p2}, b.is_line, uv, {0, 1}, width.y);
+  }
+
+  return coverage / 2.f;
+}
+
+// uv runs from 0 to 1 over the glyph box and y goes up, the quad reaches a
+// pixel past the box on every side.
+void fill_software_vector_glyph(SoftwareTile *tile, SoftwareQuad *quad,
+                                Primitives *primitives, VectorGlyphPrimitive p,
+                                i32 x0, i32 y0, i32 x1, i32 y1)
+{
+  Engine::Rect d = p.dimensions;
+  Vec2f width    = {2.f / d.width, 2.f / d.height};
+  fill_software_quad(tile, quad, x0, y0, x1, y1, [&](F32x4 x, f32 y) {
+    f32 xs[4], coverage[4];
+    store(xs, x);
+    f32 v = 1.f - (y - d.y) / d.height;
+    for (u32 i = 0; i < 4; i++) {
+      Vec2f uv    = {(xs[i] - d.x) / d.width, v};
+      coverage[i] = primitive_glyph_coverage(primitives, p, uv, width);
+    }
+    return load_f32x4(coverage);
+  });
+}
+
+// Bilinear with clamped edges, like glyph_atlas_sampler.
+f32 sample_glyph_atlas(GlyphAtlasPage *page, Vec2f uv)
+{
+  i32 size = GLYPH_ATLAS_PAGE_SIZE;
+  f32 tx   = uv.x * size - .5f;
+  f32 ty   = uv.y * size - .5f;
+  f32 fx   = floorf(tx);
+  f32 fy   = floorf(ty);
+
+  auto texel = [&](i32 x, i32 y) {
+    x = std::clamp(x, 0, size - 1);
+    y = std::clamp(y, 0, size - 1);
+    return page->image.data()[(u64)y * size + x] / 255.f;
+  };
+  i32 x = (i32)fx, y = (i32)fy;
+  f32 wx = tx - fx, wy = ty - fy;
+  f32 top    = texel(x, y) * (1 - wx) + texel(x + 1, y) * wx;
+  f32 bottom = texel(x, y + 1) * (1 - wx) + texel(x + 1, y + 1) * wx;
+  return top * (1 - wy) + bottom * wy;
+}
+
+void fill_software_bitmap_glyph(SoftwareTile *tile, SoftwareQuad *quad,
+                                GlyphAtlas *atlas, BitmapGlyphPrimitive p,
+                                i32 x0, i32 y0, i32 x1, i32 y1)
+{
+  if (!atlas || p.atlas_page >= atlas->pages.size) return;
+
+  GlyphAtlasPage *page = &atlas->pages[p.atlas_page];
+  Engine::Rect d       = p.dimensions;
+  Vec4f uv             = p.uv_bounds;
+  fill_software_quad(tile, quad, x0, y0, x1, y1, [&](F32x4 x, f32 y) {
+    f32 xs[4], coverage[4];
+    store(xs, x);
+    f32 v = uv.y + (y - d.y) / d.height * (uv.w - uv.y);
+    for (u32 i = 0; i < 4; i++) {
+      f32 u       = uv.x + (xs[i] - d.x) / d.width * (uv.z - uv.x);
+      coverage[i] = sample_glyph_atlas(page, {u, v});
+    }
+    return load_f32x4(coverage);
+  });
+}
+
+void render_software_tile(SoftwareFrame frame, SoftwareQuad *quads,
+                          u32 *bin, u32 bin_count, SoftwareTile *tile,
+                          i32 tile_x1, i32 tile_y1)
+{
+  for (u32 i = 0; i < SOFTWARE_TILE_SIZE * SOFTWARE_TILE_SIZE; i++) {
+    tile->r[i] = SOFTWARE_CLEAR_COLOR.r;
+    tile->g[i] = SOFTWARE_CLEAR_COLOR.g;
+    tile->b[i] = SOFTWARE_CLEAR_COLOR.b;
+    tile->a[i] = SOFTWARE_CLEAR_COLOR.a;
+  }
+
+  Primitives *primitives = frame.primitives;
+  for (u32 i = 0; i < bin_count; i++) {
+    SoftwareQuad *quad = &quads[bin[i]];
+    i32 x0             = std::max(quad->x0, tile->x);
+    i32 y0             = std::max(quad->y0, tile->y);
+    i32 x1             = std::min(quad->x1, tile_x1);
+    i32 y1             = std::min(quad->y1, tile_y1);
+
+    switch ((PrimitiveIds)quad->type) {
+      case PrimitiveIds::ROUNDED_RECT:
+        fill_software_rounded_rect(tile, quad,
+                                   primitives->rounded_rects[quad->idx], x0, y0,
+                                   x1, y1);
+        break;
+      case PrimitiveIds::BITMAP_GLYPH:
+        fill_software_bitmap_glyph(tile, quad, frame.glyph_atlas,
+                                   primitives->bitmap_glyphs[quad->idx], x0, y0,
+                                   x1, y1);
+        break;
+      case PrimitiveIds::VECTOR_GLYPH:
+        fill_software_vector_glyph(tile, quad, primitives,
+                                   primitives->vector_glyphs[quad->idx], x0, y0,
+                                   x1, y1);
+        break;
+      case PrimitiveIds::LINE:
+        fill_software_line(tile, quad, primitives->lines[quad->idx], x0, y0, x1,
+                           y1);
+        break;
+      case PrimitiveIds::GLYPH_RUN: {
+        BitmapGlyphPrimitive bitmap;
+        VectorGlyphPrimitive vector;
+        if (expand_run_glyph(primitives, primitives->glyph_runs[quad->run_idx],
+                             primitives->run_glyphs[quad->idx], &bitmap,
+                             &vector) == PrimitiveIds::BITMAP_GLYPH) {
+          fill_software_bitmap_glyph(tile, quad, frame.glyph_atlas, bitmap, x0,
+                                     y0, x1, y1);
+        } else {
+          fill_software_vector_glyph(tile, quad, primitives, vector, x0, y0, x1,
+                                     y1);
+        }
+      } break;
+      default:
+        break;
+    }
+  }
+}
+
+void store_software_tile(SoftwareTile *tile, i32 tile_x1, i32 tile_y1,
+                         Image *target)
+{
+  F32x4 zero  = f32x4(0.f);
+  F32x4 one   = f32x4(1.f);
+  F32x4 scale = f32x4(255.f);
+  auto to_u8  = [&](f32 *p, i32 out[4]) {
+    store(out, round_to_i32(clamp(load_f32x4(p), zero, one) * scale));
+  };
+
+  for (i32 y = tile->y; y < tile_y1; y++) {
+    u8 *dst = target->data() + ((u64)y * target->width + tile->x) * 4;
+    u32 row = (y - tile->y) * SOFTWARE_TILE_SIZE;
+    for (i32 x = 0; x < tile_x1 - tile->x; x += 4) {
+      i32 r[4], g[4], b[4], a[4];
+      to_u8(tile->r + row + x, r);
+      to_u8(tile->g + row + x, g);
+      to_u8(tile->b + row + x, b);
+      to_u8(tile->a + row + x, a);
+      for (i32 i = 0; i < 4 && x + i < tile_x1 - tile->x; i++) {
+        u8 *pixel = dst + (x + i) * 4;
+        pixel[0]  = r[i];
+        pixel[1]  = g[i];
+        pixel[2]  = b[i];
+        pixel[3]  = a[i];
+      }
+    }
+  }
+}
+
+// target is an RGBA8 image, its size is the canvas size. Damage rects have to
+// be inside it.
+void render_software_frame(SoftwareFrame frame, Image *target)
+{
+  i32 width  = target->width;
+  i32 height = target->height;
+
+  DynamicArray<SoftwareQuad> quads;
+  build_software_quads(frame, width, height, &quads);
+
+  TileBins bins;
+  bin_tiles(&bins, SOFTWARE_TILE_SIZE, width, height, quads.size, [&](u32 i) {
+    SoftwareQuad *q = &quads[i];
+    return TileBinRect{q->x0, q->y0, q->x1, q->y1};
+  });
+
+  DynamicArray<u32> tiles;
+  u32 tiles_count = bins.tiles_x * bins.tiles_y;
+  if (frame.damage_rects) {
+    DynamicArray<u8> damaged;
+    damaged.resize(tiles_count);
+    memset(damaged.data, 0, tiles_count);
+    i32 tile_size = SOFTWARE_TILE_SIZE;
+    for (u32 i = 0; i < frame.damage_rects_count; i++) {
+      TileBinRect r = frame.damage_rects[i];
+      for (i32 y = r.y0 / tile_size; y <= (r.y1 - 1) / tile_size; y++) {
+        for (i32 x = r.x0 / tile_size; x <= (r.x1 - 1) / tile_size; x++) {
+          damaged[y * bins.tiles_x + x] = true;
+        }
+      }
+    }
+    for (u32 i = 0; i < tiles_count; i++) {
+      if (damaged[i]) tiles.push_back(i);
+    }
+    damaged.release();
+  } else {
+    tiles.resize(tiles_count);
+    for (u32 i = 0; i < tiles_count; i++) tiles[i] = i;
+  }
+
+  parallel_for(tiles.size, [&](u32 tile_i) {
+    u32 i = tiles[tile_i];
+    SoftwareTile tile;
+    tile.x      = (i % bins.tiles_x) * SOFTWARE_TILE_SIZE;
+    tile.y      = (i / bins.tiles_x) * SOFTWARE_TILE_SIZE;
+    i32 tile_x1 = std::min(tile.x + (i32)SOFTWARE_TILE_SIZE, width);
+    i32 tile_y1 = std::min(tile.y + (i32)SOFTWARE_TILE_SIZE, height);
+
+    render_software_tile(frame, quads.data, bins.items.data + bins.offsets[i],
+                         tile_bin_count(&bins, i), &tile, tile_x1, tile_y1);
+    store_software_tile(&tile, tile_x1, tile_y1, target);
+  });
+
+  release_tile_bins(&bins);
+  tiles.release();
+  quads.release();
+}
+
+}  // namespace Dui
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+
+#include "containers/dynamic_array.hpp"
+#include "math/simd.hpp"
+#include "types.hpp"
+
+// Sorts screen space rects into the square tiles of the canvas they touch, so
+// whatever draws a tile only looks at what can cover it instead of everything
+// in the frame.
+//
+// The result is two flat arrays: the items of tile t are
+// items[offsets[t]..offsets[t + 1]), in the order they were binned, which is
+// the order they are drawn in. Being flat u32s they can be uploaded as they are
+// for a tile based GPU pass, the CPU renderer walks them directly.
+//
+// Binning is a counting sort: the tile range of every rect is found 4 rects at
+// a time, tiles count how many rects touch them, a prefix sum turns the counts
+// into offsets and a second pass writes the items.
+
+namespace Dui
+{
+
+// Pixel bounds, [x0, x1) x [y0, y1), already intersected with the clip rect
+// and the canvas.
+struct TileBinRect {
+  i32 x0, y0, x1, y1;
+};
+
+// Tiles touched by a rect, inclusive.
+struct TileRange {
+  u16 x0, y0, x1, y1;
+};
+
+struct TileBins {
+  u32 tile_size = 0;
+  u32 tiles_x   = 0;
+  u32 tiles_y   = 0;
+
+  DynamicArray<u32> offsets;
+  DynamicArray<u32> items;
+
+  // scratch, binning into the same TileBins again reuses all the arrays.
+  DynamicArray<TileRange> ranges;
+  DynamicArray<u32> cursors;
+};
+
+void release_tile_bins(TileBins *bins)
+{
+  bins->offsets.release();
+  bins->items.release();
+  bins->ranges.release();
+  bins->cursors.release();
+}
+
+u32 tile_bin_count(TileBins *bins, u32 tile)
+{
+  return bins->offsets[tile + 1] - bins->offsets[tile];
+}
+
+// Bins rects_count rects, rect(i) returns rect i as a TileBinRect. Rects that
+// cover nothing are left out.
+template <typename F>
+void bin_tiles(TileBins *bins, u32 tile_size, i32 width, i32 height,
+               u32 rects_count, F rect)
+{
+  bins->tile_size = tile_size;
+  bins->tiles_x   = (width + tile_size - 1) / tile_size;
+  bins->tiles_y   = (height + tile_size - 1) / tile_size;
+  u32 tiles_count = bins->tiles_x * bins->tiles_y;
+
+  bins->offsets.resize(tiles_count + 1);
+  memset(bins->offsets.data, 0, (tiles_count + 1) * sizeof(u32));
+  bins->ranges.resize(rects_count);
+
+  // the last pixel's tile, x1 and y1 are exclusive. Empty rects get a range
+  // that ends before it starts.
+  F32x4 inv_tile_size = f32x4(1.f / tile_size);
+  for (u32 i = 0; i < rects_count; i += 4) {
+    TileBinRect r[4] = {};
+    u32 lanes        = std::min(rects_count - i, 4u);
+    for (u32 lane = 0; lane < lanes; lane++) r[lane] = rect(i + lane);
+
+    F32x4 x0    = f32x4(r[0].x0, r[1].x0, r[2].x0, r[3].x0);
+    F32x4 y0    = f32x4(r[0].y0, r[1].y0, r[2].y0, r[3].y0);
+    F32x4 x1    = f32x4(r[0].x1, r[1].x1, r[2].x1, r[3].x1);
+    F32x4 y1    = f32x4(r[0].y1, r[1].y1, r[2].y1, r[3].y1);
+    F32x4 empty = (x1 <= x0) | (y1 <= y0);
+
+    i32 tx0[4], ty0[4], tx1[4], ty1[4];
+    store(tx0, truncate_to_i32(x0 * inv_tile_size));
+    store(ty0, truncate_to_i32(y0 * inv_tile_size));
+    store(tx1, truncate_to_i32((x1 - f32x4(1.f)) * inv_tile_size));
+    store(ty1, truncate_to_i32((y1 - f32x4(1.f)) * inv_tile_size));
+    i32 empty_mask = move_mask(empty);
+
+    for (u32 lane = 0; lane < lanes; lane++) {
+      TileRange range = {1, 1, 0, 0};
+      if (!(empty_mask & (1 << lane))) {
+        range = {(u16)tx0[lane], (u16)ty0[lane], (u16)tx1[lane],
+                 (u16)ty1[lane]};
+      }
+      bins->ranges[i + lane] = range;
+
+      for (u32 y = range.y0; y <= range.y1; y++) {
+        u32 *counts = bins->offsets.data + y * bins->tiles_x;
+        for (u32 x = range.x0; x <= range.x1; x++) counts[x + 1]++;
+      }
+    }
+  }
+
+  for (u32 t = 0; t < tiles_count; t++) {
+    bins->offsets[t + 1] += bins->offsets[t];
+  }
+  bins->items.resize(bins->offsets[tiles_count]);
+
+  bins->cursors.resize(tiles_count);
+  memcpy(bins->cursors.data, bins->offsets.data, tiles_count * sizeof(u32));
+  for (u32 i = 0; i < rects_count; i++) {
+    TileRange range = bins->ranges[i];
+    for (u32 y = range.y0; y <= range.y1; y++) {
+      u32 *cursors = bins->cursors.data + y * bins->tiles_x;
+      for (u32 x = range.x0; x <= range.x1; x++) {
+        bins->items[cursors[x]++] = i;
+      }
+    }
+  }
+}
+
+}  // namespace Dui
@@ -17,7 +17,8 @@ Color l_dark = Color::from_int(0x003e71);  //{1, 0.31373, 0.01176, 1};
 
 State init() {return {};}
 
-void do_frame(Gpu::Device *gpu, Platform::GlfwWindow *window, Input *input)
+// Returns whether the frame has to be rendered, see Dui::end_frame.
+b8 do_frame(Gpu::Device *gpu, Platform::GlfwWindow *window, Input *input)
 {
   Dui::start_frame(input, window);
 
@@ -84,7 +85,7 @@ void do_frame(Gpu::Device *gpu, Platform::GlfwWindow *window, Input *input)
     do_material_editor_window(&state, &state.material_editor_windows[i]);
   }
 
-  Dui::end_frame(window, gpu);
+  return Dui::end_frame(window);
 }
 
 };  // namespace Editor
\ No newline at end of file
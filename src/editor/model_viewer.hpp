@@ -1,6 +1,7 @@
 #pragma once
 
 #include "containers/array.hpp"
+#include "mesh/simplify.hpp"
 #include "model_import.hpp"
 #include "string.hpp"
 
@@ -11,6 +12,9 @@ struct UploadedMesh {
   String filename;
   Gpu::Buffer vertex_buffer;
   Gpu::Buffer index_buffer;
+  MeshLodChain lods;
+  // what lods are picked by the distance to.
+  Vec3f bounds_center;
 
   VkDescriptorSet desc_set;
   VkSampler sampler;
@@ -31,7 +35,25 @@ Gpu::Buffer upload_mesh(Gpu::Device *gpu, StandardMesh3d *mesh)
   return Gpu::create_vertex_buffer(gpu, mesh->vertices_size * sizeof(Vertex));
 }
 
-void model_viewer(Gpu::Device *gpu, Gpu::Pipeline pipeline, String filename)
+// Picks the coarsest lod whose error projects to at most max_pixel_error
+// pixels at this distance, for a perspective camera with vertical fov fov_y.
+u32 select_lod(MeshLodChain *chain, f32 distance, f32 fov_y,
+               f32 viewport_height, f32 max_pixel_error = 1.f)
+{
+  f32 pixels_per_unit =
+      viewport_height / (2.f * fmaxf(distance, .0001f) * tanf(fov_y / 2.f));
+
+  u32 lod = 0;
+  for (u32 i = 1; i < chain->lods_size; i++) {
+    if (chain->lods[i].error * pixels_per_unit > max_pixel_error) break;
+    lod = i;
+  }
+  return lod;
+}
+
+// viewport_height is in pixels, it decides how much of an lod's error shows.
+void model_viewer(Gpu::Device *gpu, Gpu::Pipeline pipeline, String filename,
+                  f32 viewport_height)
 {
   UploadedMesh *mesh = get_uploaded_mesh(filename);
   if (!mesh) {
@@ -41,12 +63,25 @@ void model_viewer(Gpu::Device *gpu, Gpu::Pipeline pipeline, String filename)
 
     um.vertex_buffer = Gpu::create_vertex_buffer(
         gpu, mesh_data.vertices_size * sizeof(Vertex));
+    // every lod shares the vertex buffer, their indexes go in one buffer.
+    um.lods = generate_lods(&mesh_data, &system_allocator);
+
+    Vec3f bounds_min = {}, bounds_max = {};
+    if (mesh_data.vertices_size > 0) {
+      bounds_min = bounds_max = mesh_data.vertices[0].position;
+    }
+    for (u32 i = 1; i < mesh_data.vertices_size; i++) {
+      bounds_min = min(bounds_min, mesh_data.vertices[i].position);
+      bounds_max = max(bounds_max, mesh_data.vertices[i].position);
+    }
+    um.bounds_center = (bounds_min + bounds_max) / 2.f;
+
     um.index_buffer =
-        Gpu::create_index_buffer(gpu, mesh_data.indexes_size * sizeof(u32));
+        Gpu::create_index_buffer(gpu, um.lods.indexes_size * sizeof(u32));
     Gpu::upload_buffer_staged(gpu, um.vertex_buffer, mesh_data.vertices,
                               mesh_data.vertices_size * sizeof(Vertex));
-    Gpu::upload_buffer_staged(gpu, um.index_buffer, mesh_data.indexes,
-                              mesh_data.indexes_size * sizeof(u32));
+    Gpu::upload_buffer_staged(gpu, um.index_buffer, um.lods.indexes,
+                              um.lods.indexes_size * sizeof(u32));
 
     Image image = read_image_file(
         "../fracas/set/models/pedestal/Pedestal_Albedo.png", &system_allocator);
@@ -72,12 +107,16 @@ void model_viewer(Gpu::Device *gpu, Gpu::Pipeline pipeline, String filename)
   f32 horizontal_angle = 0.f;
   Vec3f camera_pos     = {2 * cosf(t), 2 * sinf(t), 2 * sinf(t)};
 
-  Mat4f mvp = perspective(3.1415 / 2.f, 1, 0.001, 1000) *
+  f32 fov_y = 3.1415 / 2.f;
+  Mat4f mvp = perspective(fov_y, 1, 0.001, 1000) *
               look_at(camera_pos, {0, 0, 0}, normalize(Vec3f{0, 1, 0}));
 
   Gpu::push_constant(gpu, pipeline, &mvp, sizeof(mvp));
 
-  Gpu::draw_indexed(gpu, mesh->vertex_buffer, mesh->index_buffer, 0,
-                    mesh->index_buffer.size / sizeof(u32));
+  f32 distance = (mesh->bounds_center - camera_pos).len();
+  u32 lod_idx  = select_lod(&mesh->lods, distance, fov_y, viewport_height);
+  MeshLod lod = mesh->lods.lods[lod_idx];
+  Gpu::draw_indexed(gpu, mesh->vertex_buffer, mesh->index_buffer,
+                    lod.index_offset, lod.indexes_size);
 }
 }  // namespace Editor
\ No newline at end of file
@@ -21,20 +21,28 @@ int main()
 
   Dui::init_dui(device);
 
+  // a frame is only submitted when it looks different from the one on screen
+  // or there was input. Once nothing changed the loop sleeps until the next
+  // event instead of spinning.
+  b8 idle = false;
   while (!window.should_close()) {
-    Platform::fill_input(&window, &input);
+    Platform::fill_input(&window, &input, idle);
 
-    Gpu::start_frame(device);
-    
-    // Gpu::start_framebuffer(device, secondary_framebuffer);
-    // Gpu::end_framebuffer(device);
+    b8 changed = Editor::do_frame(device, &window, &input);
+    idle       = !changed && !has_input_events(&input);
+    if (!idle) {
+      Gpu::start_frame(device);
 
-    // Gpu::start_backbuffer(device);
-    Editor::do_frame(device, &window, &input);
-    // Gpu::end_backbuffer(device);
+      // Gpu::start_framebuffer(device, secondary_framebuffer);
+      // Gpu::end_framebuffer(device);
+
+      // Gpu::start_backbuffer(device);
+      Dui::render(device);
+      // Gpu::end_backbuffer(device);
+
+      Gpu::end_frame(device);
+    }
 
-    Gpu::end_frame(device);
-    
     tmp_allocator.reset();
   }
 
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <fstream>
 #include <iostream>
 
@@ -54,3 +58,41 @@ void write_file(NullTerminatedString path, String file, b8 overwrite = false)
   out_stream.close();
 }
 
+
+// A read only view of a whole file, paged in by the OS as it is touched.
+struct MappedFile {
+  String data;
+};
+
+// Returns an empty MappedFile if the file can't be opened. Doesn't use the
+// temp allocator, so it can be called from worker threads.
+MappedFile map_file(String path)
+{
+  Mem null_terminated_path = system_allocator.alloc(path.size + 1);
+  memcpy(null_terminated_path.data, path.data, path.size);
+  null_terminated_path.data[path.size] = '\0';
+
+  MappedFile file = {};
+  i32 fd          = open((char *)null_terminated_path.data, O_RDONLY);
+  system_allocator.free(null_terminated_path);
+  if (fd < 0) return file;
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+    void *data =
+        mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      file.data.data = (u8 *)data;
+      file.data.size = file_stat.st_size;
+    }
+  }
+  close(fd);
+
+  return file;
+}
+
+void unmap_file(MappedFile *file)
+{
+  if (file->data.data) munmap(file->data.data, file->data.size);
+  file->data = {};
+}
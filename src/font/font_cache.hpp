@@ -0,0 +1,200 @@
+#pragma once
+
+#include <stdio.h>
+#include <filesystem>
+
+#include "containers/dynamic_array.hpp"
+#include "file.hpp"
+#include "font/vector_font.hpp"
+#include "logging.hpp"
+#include "memory.hpp"
+#include "parallel.hpp"
+#include "types.hpp"
+
+// Extracted glyphs are saved next to the build, keyed by a hash of the font
+// file's contents. Later runs map the cache file and copy the glyphs out of
+// it, so a font whose cache is valid never touches FreeType unless it's asked
+// for a glyph that isn't in the cache.
+//
+// The file is the header followed by the arrays in the order of the counts,
+// in the native layout of the structs. Bump FONT_CACHE_VERSION whenever Glyph,
+// QuadCurve2, CurveBounds, GlyphBand, KerningPair or how they are built
+// changes.
+
+const u32 FONT_CACHE_MAGIC   = 0x544E4656;  // "VFNT"
+const u32 FONT_CACHE_VERSION = 2;
+const char *FONT_CACHE_DIR   = "build/font_cache";
+
+// Glyphs extracted up front when a cache is built, the ones UI text uses.
+const u32 FONT_CACHE_FIRST_CODEPOINT = 32;
+const u32 FONT_CACHE_LAST_CODEPOINT  = 126;
+
+struct FontCacheHeader {
+  u32 magic;
+  u32 version;
+  u64 content_hash;
+
+  f32 ascent;
+  u32 glyphs_count;  // codepoints and glyphs
+  u32 curves_count;  // curves and curve_bounds
+  u32 bands_count;
+  u32 band_curves_count;
+  u32 kerning_pairs_count;
+};
+
+void font_cache_path(u64 content_hash, char *path, u32 path_size)
+{
+  snprintf(path, path_size, "%s/%016llx.vfc", FONT_CACHE_DIR,
+           (unsigned long long)content_hash);
+}
+
+u64 font_cache_size(FontCacheHeader header)
+{
+  return sizeof(FontCacheHeader) + (u64)header.glyphs_count * sizeof(u32) +
+         (u64)header.glyphs_count * sizeof(Glyph) +
+         (u64)header.curves_count * sizeof(QuadCurve2) +
+         (u64)header.curves_count * sizeof(CurveBounds) +
+         (u64)header.bands_count * sizeof(GlyphBand) +
+         (u64)header.band_curves_count * sizeof(u16) +
+         (u64)header.kerning_pairs_count * sizeof(KerningPair);
+}
+
+// Returns false if there is no cache for this font or it is stale, the font is
+// left untouched then.
+b8 read_font_cache(VectorFont *font)
+{
+  char path[256];
+  font_cache_path(font->content_hash, path, sizeof(path));
+
+  MappedFile file = map_file(String((u8 *)path, strlen(path)));
+  if (!file.data.data) return false;
+
+  FontCacheHeader header;
+  b8 valid = file.data.size >= sizeof(header);
+  if (valid) {
+    memcpy(&header, file.data.data, sizeof(header));
+    valid = header.magic == FONT_CACHE_MAGIC &&
+            header.version == FONT_CACHE_VERSION &&
+            header.content_hash == font->content_hash &&
+            font_cache_size(header) == file.data.size;
+  }
+  if (!valid) {
+    unmap_file(&file);
+    return false;
+  }
+
+  // the arrays keep growing as new glyphs are extracted, so they are copied
+  // out instead of pointing into the mapping.
+  u8 *cursor      = file.data.data + sizeof(header);
+  auto read_array = [&](auto *array, u32 count) {
+    array->resize(count);
+    u64 size = (u64)count * sizeof(array->data[0]);
+    if (size) memcpy(array->data, cursor, size);
+    cursor += size;
+  };
+
+  DynamicArray<u32> codepoints;
+  read_array(&codepoints, header.glyphs_count);
+  read_array(&font->glyphs, header.glyphs_count);
+  read_array(&font->curves, header.curves_count);
+  read_array(&font->curve_bounds, header.curves_count);
+  read_array(&font->bands, header.bands_count);
+  read_array(&font->band_curves, header.band_curves_count);
+  read_array(&font->kerning_pairs, header.kerning_pairs_count);
+  unmap_file(&file);
+
+  for (u32 i = 0; i < codepoints.size; i++) {
+    font->glyph_idxs[codepoints[i]] = i;
+  }
+  codepoints.release();
+
+  font->ascent = header.ascent;
+  return true;
+}
+
+// The file only depends on the font: the buffer starts zeroed and structs
+// with padding (the header, CurveBounds) are written a field at a time, so
+// no uninitialized padding bytes end up in it.
+void write_font_cache(VectorFont *font)
+{
+  FontCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic               = FONT_CACHE_MAGIC;
+  header.version             = FONT_CACHE_VERSION;
+  header.content_hash        = font->content_hash;
+  header.ascent              = font->ascent;
+  header.glyphs_count        = font->glyphs.size;
+  header.curves_count        = font->curves.size;
+  header.bands_count         = font->bands.size;
+  header.band_curves_count   = font->band_curves.size;
+  header.kerning_pairs_count = font->kerning_pairs.size;
+
+  DynamicArray<u32> codepoints;
+  codepoints.resize(font->glyphs.size);
+  for (auto [codepoint, idx] : font->glyph_idxs) codepoints[idx] = codepoint;
+
+  Mem mem    = system_allocator.alloc(font_cache_size(header));
+  u8 *cursor = mem.data;
+  memset(mem.data, 0, font_cache_size(header));
+  auto write = [&](const void *data, u64 size) {
+    if (size) memcpy(cursor, data, size);
+    cursor += size;
+  };
+  write(&header, sizeof(header));
+  write(codepoints.data, (u64)codepoints.size * sizeof(u32));
+  write(font->glyphs.data, (u64)font->glyphs.size * sizeof(Glyph));
+  write(font->curves.data, (u64)font->curves.size * sizeof(QuadCurve2));
+  for (u32 i = 0; i < font->curve_bounds.size; i++) {
+    CurveBounds *bounds = (CurveBounds *)cursor;
+    bounds->min         = font->curve_bounds[i].min;
+    bounds->max         = font->curve_bounds[i].max;
+    bounds->is_line     = font->curve_bounds[i].is_line;
+    cursor += sizeof(CurveBounds);
+  }
+  write(font->bands.data, (u64)font->bands.size * sizeof(GlyphBand));
+  write(font->band_curves.data, (u64)font->band_curves.size * sizeof(u16));
+  write(font->kerning_pairs.data,
+        (u64)font->kerning_pairs.size * sizeof(KerningPair));
+  codepoints.release();
+
+  std::error_code err;
+  std::filesystem::create_directories(FONT_CACHE_DIR, err);
+
+  char path[256];
+  font_cache_path(font->content_hash, path, sizeof(path));
+  NullTerminatedString path_str;
+  path_str.data = (u8 *)path;
+  path_str.size = strlen(path) + 1;
+  write_file(path_str, String(mem.data, font_cache_size(header)), true);
+
+  system_allocator.free(mem);
+}
+
+// Loads a font from its cache, or from the font file through FreeType while
+// writing a new cache. worker picks the FreeType library, see font_libraries.
+VectorFont load_vector_font(String filename, u32 worker = 0)
+{
+  VectorFont font = map_font(filename);
+  if (read_font_cache(&font)) return font;
+
+  info("building font cache for ", filename);
+  load_font_metrics(&font, worker);
+  for (u32 c = FONT_CACHE_FIRST_CODEPOINT; c <= FONT_CACHE_LAST_CODEPOINT;
+       c++) {
+    font.get_glyph_idx(c);
+  }
+  write_font_cache(&font);
+
+  return font;
+}
+
+// Fonts are loaded in parallel, each worker with its own FreeType library and
+// each font into its own curve store, so startup costs about as much as the
+// slowest font instead of all of them. The draw list copies glyphs out of the
+// stores as they are first drawn, see upload_vector_glyph.
+void load_vector_fonts(String *filenames, VectorFont **fonts, u32 count)
+{
+  parallel_for_workers(count, [&](u32 i, u32 worker) {
+    *fonts[i] = load_vector_font(filenames[i], worker);
+  });
+}
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <cmath>
+#include <unordered_map>
+
+#include "containers/array.hpp"
+#include "containers/dynamic_array.hpp"
+#include "font/glyph_coverage.hpp"
+#include "font/vector_font.hpp"
+#include "image.hpp"
+#include "logging.hpp"
+#include "math/math.hpp"
+#include "memory.hpp"
+#include "types.hpp"
+
+// Coverage bitmaps of vector glyphs, rasterized once per (font, glyph, pixel
+// size) and reused until they go unused long enough to be evicted.
+//
+// The atlas is made of pages, the slices of one texture array. Each page is
+// packed with a skyline, the list of the heights of the packed glyphs from left
+// to right, and a glyph goes wherever its bottom edge ends up lowest. Pages are
+// only created when the existing ones are full, and once there are
+// GLYPH_ATLAS_MAX_PAGES the least recently used page is cleared and packed
+// again from scratch, so memory stays bounded and free space never fragments.
+//
+// Every page tracks the rect that changed since it was last uploaded, so new
+// glyphs only upload the pixels they touched.
+
+const u32 GLYPH_ATLAS_PAGE_SIZE    = 1024;
+const u32 GLYPH_ATLAS_MAX_PAGES    = 4;
+const u32 GLYPH_ATLAS_PADDING      = 1;
+const u32 GLYPH_ATLAS_MAX_GLYPH_PX = 128;  // bigger glyphs stay vector glyphs
+
+struct GlyphAtlasEntry {
+  u32 page;
+  Vec4f uv_bounds;
+  Vec2f size;
+};
+
+struct SkylineNode {
+  u32 x;
+  u32 y;  // top of the packed space below this node
+  u32 width;
+};
+
+struct GlyphAtlasPage {
+  Image image;
+  u64 last_used_frame = 0;
+
+  Array<SkylineNode, GLYPH_ATLAS_PAGE_SIZE> skyline;
+  DynamicArray<u64> keys;
+
+  b8 dirty = false;
+  u32 dirty_x0, dirty_y0, dirty_x1, dirty_y1;
+};
+
+struct GlyphAtlas {
+  Array<GlyphAtlasPage, GLYPH_ATLAS_MAX_PAGES> pages;
+  Allocator *allocator;
+
+  std::unordered_map<u64, GlyphAtlasEntry> entries;
+  u64 frame = 0;
+
+  u64 hits           = 0;
+  u64 misses         = 0;
+  u64 evictions      = 0;
+  u64 page_evictions = 0;
+};
+
+void init_glyph_atlas(GlyphAtlas *atlas, Allocator *allocator)
+{
+  atlas->allocator = allocator;
+}
+
+void glyph_atlas_start_frame(GlyphAtlas *atlas) { atlas->frame++; }
+
+// Sizes are quantized to whole pixels, so a font is cached at most once per
+// pixel size.
+u32 quantize_glyph_size(f32 size) { return (u32)fmaxf(roundf(size), 1.f); }
+
+u64 glyph_atlas_key(u32 font_id, u32 codepoint, u32 size_px)
+{
+  return ((u64)font_id << 48) | ((u64)(size_px & 0xFFFF) << 32) | codepoint;
+}
+
+void mark_glyph_atlas_dirty(GlyphAtlasPage *page, u32 x, u32 y, u32 width,
+                            u32 height)
+{
+  if (!page->dirty) {
+    page->dirty    = true;
+    page->dirty_x0 = x;
+    page->dirty_y0 = y;
+    page->dirty_x1 = x + width;
+    page->dirty_y1 = y + height;
+    return;
+  }
+  page->dirty_x0 = std::min(page->dirty_x0, x);
+  page->dirty_y0 = std::min(page->dirty_y0, y);
+  page->dirty_x1 = std::max(page->dirty_x1, x + width);
+  page->dirty_y1 = std::max(page->dirty_y1, y + height);
+}
+
+void reset_glyph_atlas_page(GlyphAtlasPage *page)
+{
+  page->skyline.clear();
+  page->skyline.push_back({0, 0, GLYPH_ATLAS_PAGE_SIZE});
+  memset(page->image.data(), 0, page->image.size);
+  mark_glyph_atlas_dirty(page, 0, 0, GLYPH_ATLAS_PAGE_SIZE,
+                         GLYPH_ATLAS_PAGE_SIZE);
+}
+
+void evict_glyph_atlas_page(GlyphAtlas *atlas, GlyphAtlasPage *page)
+{
+  for (u32 i = 0; i < page->keys.size; i++) {
+    atlas->entries.erase(page->keys[i]);
+  }
+  atlas->evictions += page->keys.size;
+  atlas->page_evictions++;
+  page->keys.clear();
+
+  reset_glyph_atlas_page(page);
+}
+
+// Returns the y a width wide rect would be placed at if its left edge sat on
+// node i, or -1 if it doesn't fit there.
+i32 skyline_fit(GlyphAtlasPage *page, u32 i, u32 width, u32 height)
+{
+  if (page->skyline[i].x + width > GLYPH_ATLAS_PAGE_SIZE) return -1;
+
+  u32 y         = 0;
+  i32 remaining = width;
+  for (u32 j = i; remaining > 0; j++) {
+    y = std::max(y, page->skyline[j].y);
+    if (y + height > GLYPH_ATLAS_PAGE_SIZE) return -1;
+    remaining -= page->skyline[j].width;
+  }
+  return y;
+}
+
+// Finds the lowest spot for a width x height rect and raises the skyline over
+// it. Returns false if the page has no room.
+b8 skyline_pack(GlyphAtlasPage *page, u32 width, u32 height, u32 *out_x,
+                u32 *out_y)
+{
+  auto &skyline = page->skyline;
+
+  i32 best_i      = -1;
+  u32 best_bottom = UINT32_MAX;
+  u32 best_y      = 0;
+  for (u32 i = 0; i < skyline.size; i++) {
+    i32 y = skyline_fit(page, i, width, height);
+    if (y >= 0 && y + height < best_bottom) {
+      best_i      = i;
+      best_bottom = y + height;
+      best_y      = y;
+    }
+  }
+  if (best_i < 0) return false;
+
+  SkylineNode placed = {skyline[best_i].x, best_y + height, width};
+  u32 end            = placed.x + width;
+
+  // nodes fully under the rect go away, the one sticking out past its right
+  // edge gets shortened.
+  u32 covered_end = best_i;
+  while (covered_end < skyline.size &&
+         skyline[covered_end].x + skyline[covered_end].width <= end) {
+    covered_end++;
+  }
+  if (covered_end < skyline.size && skyline[covered_end].x < end) {
+    skyline[covered_end].width -= end - skyline[covered_end].x;
+    skyline[covered_end].x = end;
+  }
+
+  u32 removed = covered_end - best_i;
+  if (removed == 0) {
+    skyline.push_back({});
+    for (u32 i = skyline.size - 1; i > (u32)best_i; i--) {
+      skyline[i] = skyline[i - 1];
+    }
+  } else {
+    for (u32 i = best_i + 1; i + removed - 1 < skyline.size; i++) {
+      skyline[i] = skyline[i + removed - 1];
+    }
+    skyline.size -= removed - 1;
+  }
+  skyline[best_i] = placed;
+
+  for (u32 i = 0; i + 1 < skyline.size;) {
+    if (skyline[i].y == skyline[i + 1].y) {
+      skyline[i].width += skyline[i + 1].width;
+      skyline.shift_delete(i + 1);
+    } else {
+      i++;
+    }
+  }
+
+  *out_x = placed.x;
+  *out_y = best_y;
+  return true;
+}
+
+// Finds room for a width x height bitmap, in an existing page if possible.
+// Returns nullptr when every page is full and was used this frame.
+GlyphAtlasPage *find_glyph_atlas_space(GlyphAtlas *atlas, u32 width, u32 height,
+                                       u32 *x, u32 *y)
+{
+  for (u32 i = 0; i < atlas->pages.size; i++) {
+    if (skyline_pack(&atlas->pages[i], width, height, x, y)) {
+      return &atlas->pages[i];
+    }
+  }
+
+  GlyphAtlasPage *page = nullptr;
+  if (atlas->pages.size < atlas->pages.MAX_SIZE) {
+    page        = &atlas->pages[atlas->pages.push_back({})];
+    page->image = Image(GLYPH_ATLAS_PAGE_SIZE, GLYPH_ATLAS_PAGE_SIZE,
+                        sizeof(u8), atlas->allocator);
+    page->image.format = PixelFormat::R8U;
+    reset_glyph_atlas_page(page);
+  } else {
+    for (u32 i = 0; i < atlas->pages.size; i++) {
+      GlyphAtlasPage *candidate = &atlas->pages[i];
+      if (candidate->last_used_frame == atlas->frame) continue;
+      if (!page || candidate->last_used_frame < page->last_used_frame) {
+        page = candidate;
+      }
+    }
+    if (!page) return nullptr;
+    evict_glyph_atlas_page(atlas, page);
+  }
+
+  if (!skyline_pack(page, width, height, x, y)) return nullptr;
+  return page;
+}
+
+// Returns the glyph's atlas entry, rasterizing it on a miss. Returns nullptr
+// when the glyph shouldn't or can't be cached, the caller then falls back to
+// drawing it as a vector glyph.
+GlyphAtlasEntry *get_atlas_glyph(GlyphAtlas *atlas, VectorFont *font,
+                                 u32 codepoint, Glyph glyph, f32 size)
+{
+  u32 size_px = quantize_glyph_size(size);
+  u64 key     = glyph_atlas_key(font->id, codepoint, size_px);
+
+  auto it = atlas->entries.find(key);
+  if (it != atlas->entries.end()) {
+    atlas->hits++;
+    atlas->pages[it->second.page].last_used_frame = atlas->frame;
+    return &it->second;
+  }
+
+  u32 width  = (u32)fmaxf(roundf(size_px * glyph.size.x), 1.f);
+  u32 height = (u32)fmaxf(roundf(size_px * glyph.size.y), 1.f);
+  if (width > GLYPH_ATLAS_MAX_GLYPH_PX || height > GLYPH_ATLAS_MAX_GLYPH_PX) {
+    return nullptr;
+  }
+
+  u32 x, y;
+  GlyphAtlasPage *page =
+      find_glyph_atlas_space(atlas, width + GLYPH_ATLAS_PADDING,
+                             height + GLYPH_ATLAS_PADDING, &x, &y);
+  if (!page) return nullptr;
+  atlas->misses++;
+
+  page->last_used_frame = atlas->frame;
+  page->keys.push_back(key);
+
+  u32 stride = page->image.width;
+  rasterize_glyph(font, glyph, width, height,
+                  page->image.data() + (u64)y * stride + x, stride);
+  mark_glyph_atlas_dirty(page, x, y, width, height);
+
+  f32 page_size = GLYPH_ATLAS_PAGE_SIZE;
+
+  GlyphAtlasEntry entry;
+  entry.page      = page - atlas->pages.data;
+  entry.uv_bounds = {x / page_size, y / page_size, (x + width) / page_size,
+                     (y + height) / page_size};
+  entry.size      = {(f32)width, (f32)height};
+  return &(atlas->entries[key] = entry);
+}
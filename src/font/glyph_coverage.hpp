@@ -0,0 +1,287 @@
+#pragma once
+
+#include <cmath>
+
+#include "font/vector_font.hpp"
+#include "logging.hpp"
+#include "math/math.hpp"
+#include "math/simd.hpp"
+#include "memory.hpp"
+#include "parallel.hpp"
+
+// CPU version of the coverage math in dui.metal, kept line for line so the
+// two can be compared.
+
+// Where a ray along +x at height 0 crosses a curve that straddles it. Curves
+// are monotonic (see CurveBounds), so there is exactly one crossing and it is
+// clamped onto the curve, which counts a ray through the point where two
+// pieces of a split curve meet exactly once. sign is +1 where the curve comes
+// down across the ray and -1 where it goes up.
+f32 monotonic_crossing(Vec2f p0, Vec2f p1, Vec2f p2, b8 is_line, f32 *sign)
+{
+  // Note: Simplified from abc formula by extracting a factor of (-2) from b.
+  Vec2f a = p0 - 2 * p1 + p2;
+  Vec2f b = p0 - p1;
+  Vec2f c = p0;
+
+  f32 t;
+  if (is_line || fabsf(a.y) < 1e-5) {
+    t = p0.y / (p0.y - p2.y);
+  } else {
+    f32 s  = sqrtf(fmaxf(b.y * b.y - a.y * c.y, 0.f));
+    f32 t0 = (b.y - s) / a.y;
+    f32 t1 = (b.y + s) / a.y;
+    t      = fabsf(t0 - .5f) < fabsf(t1 - .5f) ? t0 : t1;
+  }
+  t = fminf(fmaxf(t, 0.f), 1.f);
+
+  *sign = p0.y < p2.y ? -1.f : 1.f;
+  return (a.x * t - 2.f * b.x) * t + c.x;
+}
+
+// based on https://github.com/GreenLightning/gpu-font-rendering
+// direction is (cos, sin) of the ray angle, the ray starts at origin.
+f32 compute_coverage(QuadCurve2 curve, b8 is_line, Vec2f origin,
+                     Vec2f direction, f32 pixel_width)
+{
+  auto rotate = [&](Vec2f p) {
+    Vec2f p2;
+    p2.x = p.x * direction.x - p.y * direction.y;
+    p2.y = p.x * direction.y + p.y * direction.x;
+    return p2;
+  };
+
+  Vec2f p0 = rotate(curve.p0 - origin);
+  Vec2f p1 = rotate(curve.p1 - origin);
+  Vec2f p2 = rotate(curve.p2 - origin);
+
+  // the control point is between the end points on a monotonic curve.
+  if (p0.y >= 0 && p2.y >= 0) return 0.0;
+  if (p0.y < 0 && p2.y < 0) return 0.0;
+
+  f32 sign;
+  f32 x = monotonic_crossing(p0, p1, p2, is_line, &sign);
+  return sign * fminf(fmaxf(x * (1.f / pixel_width) + .5f, 0.f), 1.f);
+}
+
+u32 glyph_band_index(f32 v)
+{
+  i32 band = (i32)floorf(v * GLYPH_BANDS);
+  if (band < 0) return 0;
+  if (band >= (i32)GLYPH_BANDS) return GLYPH_BANDS - 1;
+  return band;
+}
+
+// uv is in glyph space ([0, 1] over the glyph box), pixel_size is the size of
+// one pixel in that space (fwidth(uv) in the shader). Averages a ray towards
+// +x through the pixel's horizontal band with a ray towards -y through its
+// vertical band.
+//
+// compute_coverage returns 0 unless the ray's height is in (min, max] of the
+// curve's control points, so curves outside that are skipped up front.
+f32 glyph_coverage(VectorFont *font, Glyph glyph, Vec2f uv, Vec2f pixel_size)
+{
+  QuadCurve2 *curves  = &font->curves.data[glyph.curve_start_idx];
+  CurveBounds *bounds = &font->curve_bounds.data[glyph.curve_start_idx];
+  Vec2f width         = pixel_size * 2.f;
+  f32 coverage        = 0.f;
+
+  GlyphBand hband =
+      font->bands.data[glyph.band_start_idx + glyph_band_index(uv.y)];
+  for (u32 i = 0; i < hband.count; i++) {
+    u32 curve_i   = font->band_curves.data[hband.start_idx + i];
+    CurveBounds b = bounds[curve_i];
+    if (b.max.x - uv.x < -.5f * width.x) break;
+    if (uv.y <= b.min.y || uv.y > b.max.y) continue;
+    coverage +=
+        compute_coverage(curves[curve_i], b.is_line, uv, {1, 0}, width.x);
+  }
+
+  GlyphBand vband = font->bands.data[glyph.band_start_idx + GLYPH_BANDS +
+                                     glyph_band_index(uv.x)];
+  for (u32 i = 0; i < vband.count; i++) {
+    u32 curve_i   = font->band_curves.data[vband.start_idx + i];
+    CurveBounds b = bounds[curve_i];
+    if (b.min.y - uv.y > .5f * width.y) break;
+    if (uv.x <= b.min.x || uv.x > b.max.x) continue;
+    coverage +=
+        compute_coverage(curves[curve_i], b.is_line, uv, {0, 1}, width.y);
+  }
+
+  return coverage / 2.f;
+}
+
+// Same result as glyph_coverage without the bands, every curve is tested.
+f32 glyph_coverage_reference(VectorFont *font, Glyph glyph, Vec2f uv,
+                             Vec2f pixel_size)
+{
+  Vec2f width  = pixel_size * 2.f;
+  f32 coverage = 0.f;
+  for (u32 i = 0; i < glyph.curve_count; i++) {
+    QuadCurve2 curve = font->curves.data[glyph.curve_start_idx + i];
+    CurveBounds b    = font->curve_bounds.data[glyph.curve_start_idx + i];
+    coverage += compute_coverage(curve, b.is_line, uv, {1, 0}, width.x);
+    coverage += compute_coverage(curve, b.is_line, uv, {0, 1}, width.y);
+  }
+  return coverage / 2.f;
+}
+
+// Samples the glyph on a size x size pixel grid, including the one pixel
+// margin the shader draws around the glyph, and checks the banded coverage
+// against the brute force one. Returns the number of mismatching pixels.
+u32 count_glyph_band_mismatches(VectorFont *font, Glyph glyph, u32 size,
+                                f32 *max_error)
+{
+  u32 mismatches   = 0;
+  Vec2f pixel_size = {1.f / size, 1.f / size};
+  for (i32 y = -1; y <= (i32)size; y++) {
+    for (i32 x = -1; x <= (i32)size; x++) {
+      Vec2f uv      = {(x + .5f) / size, (y + .5f) / size};
+      f32 banded    = glyph_coverage(font, glyph, uv, pixel_size);
+      f32 reference = glyph_coverage_reference(font, glyph, uv, pixel_size);
+      f32 error     = fabsf(banded - reference);
+      if (error > 1e-6f) mismatches++;
+      if (max_error) *max_error = fmaxf(*max_error, error);
+    }
+  }
+  return mismatches;
+}
+
+// count_glyph_band_mismatches over every glyph extracted so far.
+u32 validate_glyph_bands(VectorFont *font, u32 size = 32)
+{
+  u32 mismatches = 0;
+  f32 max_error  = 0.f;
+  for (u32 glyph_i = 0; glyph_i < font->glyphs.size; glyph_i++) {
+    mismatches += count_glyph_band_mismatches(font, font->glyphs[glyph_i],
+                                              size, &max_error);
+  }
+
+  info("glyph bands validated: ", font->glyphs.size, " glyphs, ", mismatches,
+       " mismatching pixels, max error ", max_error);
+  return mismatches;
+}
+
+// Adds the coverage of one ray's crossing to a line of pixels, 4 at a time.
+// origins are the pixel centers along the ray axis, size is a multiple of 4.
+void accumulate_crossing(f32 crossing, f32 sign, const f32 *origins,
+                         f32 *coverage, u32 size, f32 pixel_width)
+{
+  F32x4 crossing_4 = f32x4(crossing);
+  F32x4 sign_4     = f32x4(sign);
+  F32x4 inv_width  = f32x4(1.f / pixel_width);
+  F32x4 half       = f32x4(.5f);
+  F32x4 zero       = f32x4(0.f);
+  F32x4 one        = f32x4(1.f);
+  for (u32 i = 0; i < size; i += 4) {
+    F32x4 o     = load_f32x4(origins + i);
+    F32x4 alpha = clamp((crossing_4 - o) * inv_width + half, zero, one);
+    store(coverage + i, load_f32x4(coverage + i) + alpha * sign_4);
+  }
+}
+
+// Rasterizes a glyph into a width x height alpha bitmap, row 0 at the top. The
+// pixel grid covers the glyph box exactly and matches glyph_coverage at the
+// pixel centers.
+//
+// Along a row every pixel shares the horizontal ray's height, so each curve in
+// the row's band is solved once and only the clamp runs per pixel. Columns do
+// the same for the vertical rays.
+void rasterize_glyph(VectorFont *font, Glyph glyph, u32 width, u32 height,
+                     u8 *alpha, u32 stride)
+{
+  if (width == 0 || height == 0) return;
+
+  u32 padded_width  = (width + 3) & ~3u;
+  u32 padded_height = (height + 3) & ~3u;
+  u64 rows_size     = (u64)padded_width * height;
+  u64 columns_size  = (u64)padded_height * width;
+  Mem mem           = system_allocator.alloc(
+      (rows_size + columns_size + padded_width + padded_height) * sizeof(f32));
+  f32 *rows      = (f32 *)mem.data;
+  f32 *columns   = rows + rows_size;
+  f32 *x_origins = columns + columns_size;
+  f32 *y_origins = x_origins + padded_width;
+  memset(rows, 0, (rows_size + columns_size) * sizeof(f32));
+
+  // the vertical ray runs towards -y, flip y so both passes look like +u.
+  for (u32 x = 0; x < padded_width; x++) x_origins[x] = (x + .5f) / width;
+  for (u32 y = 0; y < padded_height; y++) {
+    y_origins[y] = -(1.f - (y + .5f) / height);
+  }
+
+  QuadCurve2 *curves  = &font->curves.data[glyph.curve_start_idx];
+  CurveBounds *bounds = &font->curve_bounds.data[glyph.curve_start_idx];
+  Vec2f pixel_width   = {2.f / width, 2.f / height};
+
+  for (u32 y = 0; y < height; y++) {
+    f32 v = -y_origins[y];
+    GlyphBand band =
+        font->bands.data[glyph.band_start_idx + glyph_band_index(v)];
+    for (u32 i = 0; i < band.count; i++) {
+      u32 curve_i   = font->band_curves.data[band.start_idx + i];
+      CurveBounds b = bounds[curve_i];
+      if (b.max.x - x_origins[0] < -.5f * pixel_width.x) break;
+      if (v <= b.min.y || v > b.max.y) continue;
+
+      QuadCurve2 c = curves[curve_i];
+      f32 sign;
+      f32 crossing =
+          monotonic_crossing({c.p0.x, c.p0.y - v}, {c.p1.x, c.p1.y - v},
+                             {c.p2.x, c.p2.y - v}, b.is_line, &sign);
+      accumulate_crossing(crossing, sign, x_origins,
+                          rows + (u64)y * padded_width, padded_width,
+                          pixel_width.x);
+    }
+  }
+
+  for (u32 x = 0; x < width; x++) {
+    f32 u = x_origins[x];
+    GlyphBand band = font->bands.data[glyph.band_start_idx + GLYPH_BANDS +
+                                      glyph_band_index(u)];
+    for (u32 i = 0; i < band.count; i++) {
+      u32 curve_i   = font->band_curves.data[band.start_idx + i];
+      CurveBounds b = bounds[curve_i];
+      if (b.min.y + y_origins[0] > .5f * pixel_width.y) break;
+      if (u <= b.min.x || u > b.max.x) continue;
+
+      QuadCurve2 c = curves[curve_i];
+      f32 sign;
+      f32 crossing =
+          monotonic_crossing({-c.p0.y, c.p0.x - u}, {-c.p1.y, c.p1.x - u},
+                             {-c.p2.y, c.p2.x - u}, b.is_line, &sign);
+      accumulate_crossing(crossing, sign, y_origins,
+                          columns + (u64)x * padded_height, padded_height,
+                          pixel_width.y);
+    }
+  }
+
+  for (u32 y = 0; y < height; y++) {
+    for (u32 x = 0; x < width; x++) {
+      f32 coverage = (rows[(u64)y * padded_width + x] +
+                      columns[(u64)x * padded_height + y]) /
+                     2.f;
+      coverage     = fminf(fmaxf(coverage, 0.f), 1.f);
+      alpha[(u64)y * stride + x] = (u8)(coverage * 255.f + .5f);
+    }
+  }
+
+  system_allocator.free(mem);
+}
+
+struct GlyphRasterJob {
+  Glyph glyph;
+  u32 width, height;
+  u8 *alpha;
+  u32 stride;
+};
+
+// Glyphs are independent, so each one goes to its own worker.
+void rasterize_glyphs(VectorFont *font, GlyphRasterJob *jobs, u32 jobs_size)
+{
+  parallel_for(jobs_size, [&](u32 i) {
+    GlyphRasterJob *job = &jobs[i];
+    rasterize_glyph(font, job->glyph, job->width, job->height, job->alpha,
+                    job->stride);
+  });
+}
@@ -1,73 +1,262 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <cfloat>
 #include <execution>
+#include <unordered_map>
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
+#include FT_TRUETYPE_TABLES_H
+#include FT_TRUETYPE_TAGS_H
 
+#include "containers/dynamic_array.hpp"
+#include "file.hpp"
 #include "input.hpp"
 #include "logging.hpp"
+#include "math/simd.hpp"
+#include "parallel.hpp"
+#include "string.hpp"
 
-FT_Library library;
+// An FT_Library isn't thread safe, so every worker that opens faces gets its
+// own and fonts load without locking. A face stays tied to the library that
+// opened it, so the libraries are never freed. Worker 0 is the main thread,
+// which opens the faces of fonts that came from the font cache.
+FT_Library font_libraries[MAX_WORKER_THREADS];
+
+FT_Library get_font_library(u32 worker)
+{
+  if (!font_libraries[worker]) {
+    if (FT_Init_FreeType(&font_libraries[worker])) {
+      fatal("failed to init freetype");
+    }
+  }
+  return font_libraries[worker];
+}
 
 struct QuadCurve2 {
   Vec2f p0, p1, p2;
 };
 
+// Curves are split at their x and y extrema when they are extracted, so every
+// curve is monotonic on both axes and a ray along either axis crosses it at
+// most once. A ray can then skip any curve whose bounds it misses without
+// solving for the crossing. Straight segments are stored as quadratics with
+// the control point in the middle and are tagged so they get the linear solve.
+struct CurveBounds {
+  Vec2f min, max;
+  b8 is_line;
+};
+
+// Each glyph's box is cut into GLYPH_BANDS horizontal and GLYPH_BANDS vertical
+// bands. A band lists the curves whose control points overlap it, so a pixel
+// only needs the curves of its own row (for the ray towards +x) and column
+// (for the ray towards -y). The outer bands reach out to infinity so pixels in
+// the margin around the glyph still find a band.
+const u32 GLYPH_BANDS = 8;
+
+// Curve indexes in band_curves are relative to the glyph's curve_start_idx.
+// Horizontal bands are sorted by decreasing max x, vertical bands by
+// increasing min y, so a ray can stop at the first curve behind the pixel.
+struct GlyphBand {
+  u32 start_idx;
+  u32 count;
+};
+
 struct Glyph {
   u32 curve_start_idx;
   u32 curve_count;
 
+  // GLYPH_BANDS horizontal bands (bottom to top) followed by GLYPH_BANDS
+  // vertical bands (left to right).
+  u32 band_start_idx;
+
   Vec2f size;
   f32 advance;
   Vec2f bearing;
+
+  u32 glyph_id;  // FreeType's glyph index, used for kerning
+};
+
+// One glyph of a laid out string, byte_offset is where the glyph's codepoint
+// starts in it.
+struct LayoutGlyph {
+  u32 codepoint;
+  u32 glyph_idx;
+  u32 byte_offset;
+};
+
+// carets[i] is the pen position of glyph i relative to the start of the
+// string, carets[glyphs.size] is the width. The carets are padded with zeros
+// to a multiple of 4 plus 4, so they can always be read 4 at a time.
+// ink_min and ink_max bound the outlines of the glyphs relative to where the
+// string is drawn, ink_min is past ink_max when nothing has an outline.
+// text keeps a copy of the string, so a hash collision is caught.
+struct TextLayout {
+  u64 hash;
+  DynamicArray<u8> text;
+  f32 size;
+
+  f32 width;
+  Vec2f ink_min;
+  Vec2f ink_max;
+  DynamicArray<LayoutGlyph> glyphs;
+  DynamicArray<f32> carets;
+
+  u64 last_used_frame;
+};
+
+// Layouts unused for this many frames are dropped, checked every
+// TEXT_LAYOUT_SWEEP_INTERVAL frames.
+const u64 TEXT_LAYOUT_MAX_AGE        = 120;
+const u64 TEXT_LAYOUT_SWEEP_INTERVAL = 60;
+
+// UI text is mostly the same strings at the same sizes every frame, so
+// layouts are cached by (string hash, size) and measuring or drawing
+// unchanged text is a single lookup.
+struct TextLayoutCache {
+  std::unordered_map<u64, TextLayout> layouts;
+  u64 frame = 0;
+
+  u64 hits   = 0;
+  u64 misses = 0;
+};
+
+// Horizontal kerning from the font's kern table, sorted by key for binary
+// search. key is left glyph id << 16 | right glyph id.
+struct KerningPair {
+  u32 key;
+  f32 value;
 };
 
+// Glyphs are extracted the first time a codepoint is asked for, so only the
+// glyphs that are actually drawn or measured cost anything. Not thread safe.
 struct VectorFont {
-  Array<QuadCurve2, 4096> curves;
-  Array<Glyph, 256> glyphs;
+  u32 id;
+
+  MappedFile ttf;  // FreeType reads the outlines straight out of this
+  u64 content_hash;
+
+  // Only opened once a glyph has to be extracted, fonts loaded from the font
+  // cache usually never need it.
+  FT_Face face = nullptr;
+
+  DynamicArray<QuadCurve2> curves;
+  DynamicArray<CurveBounds> curve_bounds;  // one per curve
+  DynamicArray<Glyph> glyphs;
+  DynamicArray<GlyphBand> bands;
+  DynamicArray<u16> band_curves;
+  std::unordered_map<u32, u32> glyph_idxs;  // codepoint -> glyphs index
+
+  DynamicArray<KerningPair> kerning_pairs;
+
+  TextLayoutCache layout_cache;
 
   f32 ascent;
 
-  i32 char_buffer_offset = 0;
+  u32 get_glyph_idx(u32 codepoint);
+  Glyph get_glyph(u32 codepoint) { return glyphs[get_glyph_idx(codepoint)]; }
+
+  f32 get_kerning(u32 left_glyph_id, u32 right_glyph_id);
+
+  TextLayout *layout_text(String text, f32 size);
 
   f32 get_text_width(String text, f32 scale = 1.f)
   {
-    f32 width = 0;
-    for (i32 i = 0; i < text.size; i++) {
-      Glyph g = glyphs[text[i]];
-      width += g.advance;
-    }
-
-    return width * scale;
+    return layout_text(text, scale)->width;
   }
 
+  // Returns the byte offset of the codepoint closest to pos.
   i32 char_index_at_pos(String text, Vec2f text_pos, Vec2f pos, f32 scale = 1.f)
   {
-    f32 cursor_x = text_pos.x;
-    for (i32 i = 0; i < text.size; i++) {
-      Glyph g = glyphs[text[i]];
-
-      if (cursor_x + (g.advance * scale / 2.f) > pos.x) return i;
-
-      cursor_x += g.advance * scale;
+    TextLayout *layout = layout_text(text, scale);
+    f32 *carets        = layout->carets.data;
+    F32x4 target       = f32x4(pos.x - text_pos.x);
+
+    // the caret goes before the first glyph whose center is past pos.
+    for (u32 i = 0; i < layout->glyphs.size; i += 4) {
+      F32x4 centers =
+          (load_f32x4(carets + i) + load_f32x4(carets + i + 1)) * f32x4(.5f);
+      i32 hits = move_mask(centers > target);
+      for (u32 lane = 0; lane < 4 && i + lane < layout->glyphs.size; lane++) {
+        if (hits & (1 << lane)) return layout->glyphs[i + lane].byte_offset;
+      }
     }
 
     return text.size;
   }
 };
 
-Glyph extract_glyph(VectorFont* font, FT_Face face, u32 character)
+void open_font_face(VectorFont *font, u32 worker = 0);
+
+// Pushes curve as one or more monotonic pieces, returns how many.
+u32 push_monotonic_curves(VectorFont *font, QuadCurve2 curve, b8 is_line)
 {
-  FT_Error err = FT_Set_Pixel_Sizes(face, 0, 32);
-  if (err) {
-    fatal("failed to set pixel size?");
+  struct Split {
+    f32 t;
+    u32 axis;
+  };
+  Split splits[2];
+  u32 splits_count = 0;
+
+  // the derivative is zero at t = b / a on each axis.
+  if (!is_line) {
+    Vec2f a = curve.p0 - 2 * curve.p1 + curve.p2;
+    Vec2f b = curve.p0 - curve.p1;
+    for (u32 axis = 0; axis < 2; axis++) {
+      f32 a_i = axis == 0 ? a.x : a.y;
+      f32 b_i = axis == 0 ? b.x : b.y;
+      if (fabsf(a_i) < 1e-7f) continue;
+
+      f32 t = b_i / a_i;
+      if (t > 1e-4f && t < 1.f - 1e-4f) splits[splits_count++] = {t, axis};
+    }
+    if (splits_count == 2 && splits[1].t < splits[0].t) {
+      std::swap(splits[0], splits[1]);
+    }
   }
 
+  auto push = [&](QuadCurve2 c) {
+    font->curves.push_back(c);
+    font->curve_bounds.push_back(
+        {min(min(c.p0, c.p1), c.p2), max(max(c.p0, c.p1), c.p2), is_line});
+  };
+
+  QuadCurve2 rest = curve;
+  f32 rest_start  = 0.f;
+  for (u32 i = 0; i < splits_count; i++) {
+    f32 t = (splits[i].t - rest_start) / (1.f - rest_start);
+    if (t <= 1e-4f || t >= 1.f - 1e-4f) continue;
+
+    Vec2f left_control  = rest.p0 + (rest.p1 - rest.p0) * t;
+    Vec2f right_control = rest.p1 + (rest.p2 - rest.p1) * t;
+    Vec2f mid           = left_control + (right_control - left_control) * t;
+
+    // the tangent is flat at the extremum, snap the controls onto it so
+    // rounding can't leave a piece slightly non monotonic.
+    if (splits[i].axis == 0) {
+      left_control.x  = mid.x;
+      right_control.x = mid.x;
+    } else {
+      left_control.y  = mid.y;
+      right_control.y = mid.y;
+    }
+
+    push({rest.p0, left_control, mid});
+    rest       = {mid, right_control, rest.p2};
+    rest_start = splits[i].t;
+  }
+  push(rest);
+
+  return splits_count + 1;
+}
+
+Glyph extract_glyph(VectorFont* font, FT_Face face, u32 character)
+{
   u32 glyph_index = FT_Get_Char_Index(face, character);
 
-  err = FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT);
+  FT_Error err = FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT);
   if (err) {
     fatal("failed to load glyph");
   }
@@ -83,6 +272,8 @@ Glyph extract_glyph(VectorFont* font, FT_Face face, u32 character)
       (f32)face->glyph->metrics.horiBearingY / face->size->metrics.height);
   glyph.advance = (f32)face->glyph->advance.x / face->size->metrics.height;
 
+  glyph.glyph_id = glyph_index;
+
   glyph.curve_start_idx = font->curves.size;
   glyph.curve_count     = 0;
 
@@ -120,8 +311,8 @@ Glyph extract_glyph(VectorFont* font, FT_Face face, u32 character)
       }
 
       if (FT_CURVE_TAG(b_tag) == FT_CURVE_TAG_ON) {
-        font->curves.push_back({a, (a + b) / Vec2f(2.f, 2.f), b});
-        glyph.curve_count++;
+        glyph.curve_count += push_monotonic_curves(
+            font, {a, (a + b) / Vec2f(2.f, 2.f), b}, true);
         point_i++;
       } else if (FT_CURVE_TAG(b_tag) == FT_CURVE_TAG_CONIC) {
         if (on_ghost_point) {
@@ -149,8 +340,7 @@ Glyph extract_glyph(VectorFont* font, FT_Face face, u32 character)
           fatal("dumb");
         }
 
-        font->curves.push_back({a, b, c});
-        glyph.curve_count++;
+        glyph.curve_count += push_monotonic_curves(font, {a, b, c}, false);
 
         point_i++;
       }
@@ -160,32 +350,313 @@ Glyph extract_glyph(VectorFont* font, FT_Face face, u32 character)
   return glyph;
 }
 
-VectorFont create_font(String filename)
+void build_glyph_bands(VectorFont *font, Glyph *glyph)
 {
-  FT_Error err = FT_Init_FreeType(&library);
-  if (err) {
-    fatal("failed to init freetype");
+  glyph->band_start_idx = font->bands.size;
+
+  struct BandCurve {
+    u16 idx;
+    f32 min, max;
+    f32 sort_key;
+  };
+  DynamicArray<BandCurve> candidates;
+
+  for (u32 axis = 0; axis < 2; axis++) {
+    for (u32 band_i = 0; band_i < GLYPH_BANDS; band_i++) {
+      // the ray runs across the band, so overlap is tested on the other axis.
+      f32 band_min = band_i == 0 ? -INFINITY : (f32)band_i / GLYPH_BANDS;
+      f32 band_max =
+          band_i == GLYPH_BANDS - 1 ? INFINITY : (f32)(band_i + 1) / GLYPH_BANDS;
+
+      candidates.clear();
+      for (u32 i = 0; i < glyph->curve_count; i++) {
+        CurveBounds bounds = font->curve_bounds[glyph->curve_start_idx + i];
+        Vec2f min_p        = bounds.min;
+        Vec2f max_p        = bounds.max;
+
+        BandCurve bc;
+        bc.idx      = i;
+        bc.min      = axis == 0 ? min_p.y : min_p.x;
+        bc.max      = axis == 0 ? max_p.y : max_p.x;
+        bc.sort_key = axis == 0 ? -max_p.x : min_p.y;
+        if (bc.max < band_min || bc.min >= band_max) continue;
+        candidates.push_back(bc);
+      }
+      std::sort(candidates.data, candidates.data + candidates.size,
+                [](const BandCurve &a, const BandCurve &b) {
+                  return a.sort_key < b.sort_key;
+                });
+
+      GlyphBand band = {font->band_curves.size, candidates.size};
+      for (u32 i = 0; i < candidates.size; i++) {
+        font->band_curves.push_back(candidates[i].idx);
+      }
+      font->bands.push_back(band);
+    }
+  }
+  candidates.release();
+}
+
+u32 VectorFont::get_glyph_idx(u32 codepoint)
+{
+  auto it = glyph_idxs.find(codepoint);
+  if (it != glyph_idxs.end()) return it->second;
+
+  if (!face) open_font_face(this);
+  Glyph glyph = extract_glyph(this, face, codepoint);
+  build_glyph_bands(this, &glyph);
+  u32 idx               = glyphs.push_back(glyph);
+  glyph_idxs[codepoint] = idx;
+  return idx;
+}
+
+f32 VectorFont::get_kerning(u32 left_glyph_id, u32 right_glyph_id)
+{
+  u32 key = (left_glyph_id << 16) | (right_glyph_id & 0xFFFF);
+  i32 lo = 0, hi = (i32)kerning_pairs.size - 1;
+  while (lo <= hi) {
+    i32 mid = (lo + hi) / 2;
+    u32 mid_key = kerning_pairs.data[mid].key;
+    if (mid_key == key) return kerning_pairs.data[mid].value;
+    if (mid_key < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return 0.f;
+}
+
+// Reads the format 0 subtables of the TrueType kern table. GPOS kerning needs
+// a shaper and isn't read, fonts with only GPOS get no kerning.
+void load_kerning_pairs(VectorFont *font)
+{
+  FT_Face face = font->face;
+  FT_ULong length = 0;
+  if (FT_Load_Sfnt_Table(face, TTAG_kern, 0, nullptr, &length) || length < 4) {
+    return;
+  }
+
+  // not the temp allocator, fonts load on worker threads.
+  Mem table_mem = system_allocator.alloc(length);
+  u8 *table     = table_mem.data;
+  FT_Load_Sfnt_Table(face, TTAG_kern, 0, table, &length);
+
+  auto read_u16 = [&](u64 offset) -> u16 {
+    if (offset + 2 > length) return 0;
+    return (table[offset] << 8) | table[offset + 1];
+  };
+
+  // version 0 is the Microsoft layout, Apple's version 1 tables are skipped.
+  u32 tables_count = read_u16(0) == 0 ? read_u16(2) : 0;
+  u64 offset       = 4;
+  for (u32 table_i = 0; table_i < tables_count && offset + 6 <= length;
+       table_i++) {
+    u32 subtable_length = read_u16(offset + 2);
+    u32 coverage        = read_u16(offset + 4);
+
+    // horizontal, format 0, not minimum values or cross stream.
+    b8 usable = (coverage & 0x1) && !(coverage & 0x6) && (coverage >> 8) == 0;
+    if (usable) {
+      u32 pairs_count = read_u16(offset + 6);
+      u64 pair_offset = offset + 14;
+      for (u32 i = 0; i < pairs_count && pair_offset + 6 <= length; i++) {
+        u32 left  = read_u16(pair_offset);
+        u32 right = read_u16(pair_offset + 2);
+        i16 value = (i16)read_u16(pair_offset + 4);
+        pair_offset += 6;
+
+        f32 normalized = (f32)FT_MulFix(value, face->size->metrics.x_scale) /
+                         face->size->metrics.height;
+        font->kerning_pairs.push_back({(left << 16) | right, normalized});
+      }
+    }
+    if (subtable_length == 0) break;
+    offset += subtable_length;
   }
 
-  Temp temp;
-  File file = read_file(filename, &temp);
+  system_allocator.free(table_mem);
 
-  FT_Face face;
-  err = FT_New_Memory_Face(library, file.data.data, file.data.size, 0, &face);
+  std::sort(font->kerning_pairs.data,
+            font->kerning_pairs.data + font->kerning_pairs.size,
+            [](const KerningPair &a, const KerningPair &b) {
+              return a.key < b.key;
+            });
+}
+
+// FNV-1a
+u64 hash_text(String text)
+{
+  u64 hash = 14695981039346656037ull;
+  for (u32 i = 0; i < text.size; i++) {
+    hash = (hash ^ text.data[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+TextLayout *VectorFont::layout_text(String text, f32 size)
+{
+  u64 hash = hash_text(text);
+  u32 size_bits;
+  memcpy(&size_bits, &size, sizeof(size_bits));
+  u64 key = hash ^ ((u64)size_bits * 0x9E3779B97F4A7C15ull);
+
+  TextLayout *layout = &layout_cache.layouts[key];
+  if (layout->glyphs.data && layout->hash == hash && layout->size == size &&
+      String(layout->text.data, layout->text.size) == text) {
+    layout_cache.hits++;
+    layout->last_used_frame = layout_cache.frame;
+    return layout;
+  }
+  layout_cache.misses++;
+
+  // either new or a key collision, lay it out again in place.
+  layout->hash            = hash;
+  layout->size            = size;
+  layout->last_used_frame = layout_cache.frame;
+  layout->text.resize(text.size);
+  if (text.size > 0) memcpy(layout->text.data, text.data, text.size);
+  layout->glyphs.clear();
+  layout->glyphs.reserve(text.size > 0 ? text.size : 1);
+
+  // carets start as the step from the previous glyph, advance plus kerning,
+  // and become positions after a prefix sum.
+  u32 padded_size = ((text.size + 1 + 3) & ~3u) + 4;
+  layout->carets.resize(padded_size);
+  memset(layout->carets.data, 0, padded_size * sizeof(f32));
+
+  u32 prev_glyph_id = 0;
+  for (u32 i = 0; i < text.size;) {
+    LayoutGlyph g;
+    g.byte_offset = i;
+    g.codepoint   = next_codepoint(text, &i);
+    g.glyph_idx   = get_glyph_idx(g.codepoint);
+
+    Glyph glyph = glyphs[g.glyph_idx];
+    u32 n       = layout->glyphs.push_back(g);
+    if (n > 0) {
+      layout->carets[n] += get_kerning(prev_glyph_id, glyph.glyph_id) * size;
+    }
+    layout->carets[n + 1] = glyph.advance * size;
+    prev_glyph_id         = glyph.glyph_id;
+  }
 
+  F32x4 carry = f32x4(0.f);
+  for (u32 i = 0; i + 4 <= padded_size; i += 4) {
+    F32x4 positions = prefix_sum(load_f32x4(&layout->carets[i])) + carry;
+    store(&layout->carets[i], positions);
+    carry = broadcast_last(positions);
+  }
+  layout->width = layout->carets[layout->glyphs.size];
+
+  layout->ink_min = {FLT_MAX, FLT_MAX};
+  layout->ink_max = {-FLT_MAX, -FLT_MAX};
+  for (u32 i = 0; i < layout->glyphs.size; i++) {
+    Glyph glyph = glyphs[layout->glyphs[i].glyph_idx];
+    if (glyph.curve_count == 0) continue;
+
+    Vec2f min = {layout->carets[i] + size * glyph.bearing.x,
+                 size * ascent - size * glyph.bearing.y};
+    Vec2f max = min + size * glyph.size;
+
+    layout->ink_min = {fminf(layout->ink_min.x, min.x),
+                       fminf(layout->ink_min.y, min.y)};
+    layout->ink_max = {fmaxf(layout->ink_max.x, max.x),
+                       fmaxf(layout->ink_max.y, max.y)};
+  }
+
+  return layout;
+}
+
+void text_layout_start_frame(VectorFont *font)
+{
+  TextLayoutCache *cache = &font->layout_cache;
+  cache->frame++;
+  if (cache->frame % TEXT_LAYOUT_SWEEP_INTERVAL != 0) return;
+
+  for (auto it = cache->layouts.begin(); it != cache->layouts.end();) {
+    if (cache->frame - it->second.last_used_frame > TEXT_LAYOUT_MAX_AGE) {
+      it->second.text.release();
+      it->second.glyphs.release();
+      it->second.carets.release();
+      it = cache->layouts.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+// worker picks the FreeType library, see font_libraries.
+void open_font_face(VectorFont *font, u32 worker)
+{
+  FT_Error err =
+      FT_New_Memory_Face(get_font_library(worker), font->ttf.data.data,
+                         font->ttf.data.size, 0, &font->face);
   if (err) {
     fatal("failed to load font");
   }
 
+  // glyph metrics are normalized by the line height, which only depends on
+  // this, so it is set once for the whole face.
+  err = FT_Set_Pixel_Sizes(font->face, 0, 32);
+  if (err) {
+    fatal("failed to set pixel size?");
+  }
+}
+
+// Maps the font file without touching FreeType. The caller either fills the
+// font from the font cache or calls load_font_metrics().
+VectorFont map_font(String filename)
+{
+  static std::atomic<u32> next_font_id = 0;
+
   VectorFont font;
-  font.ascent = (f32)face->ascender / face->height;
-  for (i32 i = 0; i < 128; i++) {
-    font.glyphs.push_back(extract_glyph(&font, face, i));
+  font.id  = next_font_id++;
+  font.ttf = map_file(filename);
+  if (!font.ttf.data.data) {
+    fatal("failed to open font ", filename);
   }
+  font.content_hash = hash_text(font.ttf.data);
 
   return font;
 }
 
+void load_font_metrics(VectorFont *font, u32 worker = 0)
+{
+  if (!font->face) open_font_face(font, worker);
+  font->ascent = (f32)font->face->ascender / font->face->height;
+  load_kerning_pairs(font);
+}
+
+VectorFont create_font(String filename)
+{
+  VectorFont font = map_font(filename);
+  load_font_metrics(&font);
+  return font;
+}
+
+void destroy_font(VectorFont *font)
+{
+  if (font->face) FT_Done_Face(font->face);
+  font->face = nullptr;
+  unmap_file(&font->ttf);
+
+  font->curves.release();
+  font->curve_bounds.release();
+  font->glyphs.release();
+  font->bands.release();
+  font->band_curves.release();
+  font->glyph_idxs.clear();
+  font->kerning_pairs.release();
+
+  for (auto &[key, layout] : font->layout_cache.layouts) {
+    layout.text.release();
+    layout.glyphs.release();
+    layout.carets.release();
+  }
+  font->layout_cache.layouts.clear();
+}
+
 // struct ConicCurve {
 //   Vec2f p0, p1, control;
 // };
@@ -855,4 +1326,4 @@ VectorFont create_font(String filename)
 //   // }
 
 //   return (f32)face->glyph->metrics.width / face->glyph->metrics.height;
-// }
\ No newline at end of file
+// }
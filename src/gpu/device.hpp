@@ -12,4 +12,7 @@ Device *init(Platform::GlfwWindow *glfwWindow);
 void start_frame(Device *device);
 void end_frame(Device *device);
 
+b8 backbuffer_preserved(Device *device);
+Vec2i backbuffer_size(Device *device);
+
 }
\ No newline at end of file
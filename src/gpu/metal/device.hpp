@@ -50,6 +50,12 @@ struct Device {
     MTL::Library *shader_library;
     MTL::CommandQueue *metal_command_queue;
 
+    // the frame is rendered here and copied to the drawable, drawables don't
+    // keep their contents between frames but this does, so a frame can redraw
+    // just the parts that changed.
+    MTL::Texture *backbuffer = nullptr;
+    b8 backbuffer_preserved  = false;
+
     // per frame
     CA::MetalDrawable *metal_drawable;
     MTL::CommandBuffer *metal_command_buffer;
@@ -70,6 +76,7 @@ Device *init(Platform::GlfwWindow *glfwWindow) {
     device->metal_layer = CA::MetalLayer::layer();
     device->metal_layer->setDevice(device->metal_device);
     device->metal_layer->setPixelFormat(MTL::PixelFormatBGRA8Unorm);
+    device->metal_layer->setFramebufferOnly(false);
     GLFWBridge::AddLayerToWindow(glfwWindow->ref, device->metal_layer);
 
     NS::String* mystring = NS::String::string("build/resources/shaders/metal/dui/dui.metallib", NS::StringEncoding::UTF8StringEncoding);
@@ -130,10 +137,28 @@ Device *init(Platform::GlfwWindow *glfwWindow) {
 void start_frame(Device *device) {  
     device->metal_drawable = device->metal_layer->nextDrawable();
 
+    MTL::Texture *drawable_texture = device->metal_drawable->texture();
+    if (!device->backbuffer ||
+        device->backbuffer->width() != drawable_texture->width() ||
+        device->backbuffer->height() != drawable_texture->height()) {
+        if (device->backbuffer) device->backbuffer->release();
+
+        MTL::TextureDescriptor *texture_descriptor = MTL::TextureDescriptor::alloc()->init();
+        texture_descriptor->setPixelFormat(drawable_texture->pixelFormat());
+        texture_descriptor->setWidth(drawable_texture->width());
+        texture_descriptor->setHeight(drawable_texture->height());
+        texture_descriptor->setUsage(MTL::TextureUsageRenderTarget);
+        texture_descriptor->setStorageMode(MTL::StorageModePrivate);
+        device->backbuffer = device->metal_device->newTexture(texture_descriptor);
+        texture_descriptor->release();
+
+        device->backbuffer_preserved = false;
+    }
+
     MTL::RenderPassDescriptor* render_pass_descriptor = MTL::RenderPassDescriptor::alloc()->init();
     MTL::RenderPassColorAttachmentDescriptor* cd = render_pass_descriptor->colorAttachments()->object(0);
-    cd->setTexture(device->metal_drawable->texture());
-    cd->setLoadAction(MTL::LoadActionClear);
+    cd->setTexture(device->backbuffer);
+    cd->setLoadAction(device->backbuffer_preserved ? MTL::LoadActionLoad : MTL::LoadActionClear);
     cd->setClearColor(MTL::ClearColor(41.0f/255.0f, 42.0f/255.0f, 48.0f/255.0f, 1.0));
     cd->setStoreAction(MTL::StoreActionStore);
 
@@ -144,12 +169,29 @@ void start_frame(Device *device) {
 }
 
 void end_frame(Device *device) {device->render_command_encoder->endEncoding();
+    MTL::BlitCommandEncoder *blit_encoder = device->metal_command_buffer->blitCommandEncoder();
+    blit_encoder->copyFromTexture(device->backbuffer, device->metal_drawable->texture());
+    blit_encoder->endEncoding();
+
     device->metal_command_buffer->presentDrawable(device->metal_drawable);
     device->metal_command_buffer->commit();
     device->metal_command_buffer->waitUntilCompleted();
+    device->backbuffer_preserved = true;
 
     device->auto_release_pool->release();
     device->auto_release_pool = NS::AutoreleasePool::alloc()->init();
 }
 
+// Whether the backbuffer still holds the last frame, it doesn't before the
+// first one and after the window was resized.
+b8 backbuffer_preserved(Device *device)
+{
+    return device->backbuffer_preserved;
+}
+
+Vec2i backbuffer_size(Device *device)
+{
+    return {(i32)device->backbuffer->width(), (i32)device->backbuffer->height()};
+}
+
 }
\ No newline at end of file
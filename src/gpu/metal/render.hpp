@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+
 #include "gpu/metal/buffer.hpp"
 #include "gpu/shader_args.hpp"
 #include "metal_headers.hpp"
@@ -17,4 +19,31 @@ void draw_indexed(Device *device,
         1, 0, 0);
 }
 
+// Draws instance_count instances of a vertex_count vertex triangle strip,
+// starting at first_instance. The instance records are bound as vertex buffer
+// 1, the vertex shader reads them by [[instance_id]], which counts from
+// first_instance.
+void draw_instanced(Device *device, Buffer instance_buffer, i32 vertex_count,
+                    i32 instance_count, i32 first_instance)
+{
+    device->render_command_encoder->setVertexBuffer(instance_buffer.mtl_buffer, 0, 1);
+    device->render_command_encoder->drawPrimitives(
+        MTL::PrimitiveTypeTriangleStrip, NS::UInteger(0), vertex_count,
+        instance_count, first_instance);
+}
+
+// Only pixels inside the rect are drawn to, it is clamped to the backbuffer.
+void set_scissor(Device *device, i32 x, i32 y, i32 width, i32 height)
+{
+    Vec2i size = backbuffer_size(device);
+    i32 x0     = std::clamp(x, 0, size.x);
+    i32 y0     = std::clamp(y, 0, size.y);
+    i32 x1     = std::clamp(x + width, x0, size.x);
+    i32 y1     = std::clamp(y + height, y0, size.y);
+
+    MTL::ScissorRect rect = {(NS::UInteger)x0, (NS::UInteger)y0,
+                             (NS::UInteger)(x1 - x0), (NS::UInteger)(y1 - y0)};
+    device->render_command_encoder->setScissorRect(rect);
+}
+
 }
\ No newline at end of file
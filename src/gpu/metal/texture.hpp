@@ -29,6 +29,83 @@ Texture create_texture(Device *device, Image image)
     return texture;
 }
 
+MTL::PixelFormat to_mtl_pixel_format(PixelFormat format)
+{
+    switch (format) {
+        case PixelFormat::R8U: return MTL::PixelFormatR8Unorm;
+        case PixelFormat::RGBA8U: return MTL::PixelFormatRGBA8Unorm;
+        case PixelFormat::RG32F: return MTL::PixelFormatRG32Float;
+        case PixelFormat::RGBA32F: return MTL::PixelFormatRGBA32Float;
+        default: fatal("unsupported texture format");
+    }
+    return MTL::PixelFormatInvalid;
+}
+
+u32 pixel_size(PixelFormat format)
+{
+    switch (format) {
+        case PixelFormat::R8U: return 1;
+        case PixelFormat::RGBA8U: return 4;
+        case PixelFormat::RG32F: return 8;
+        case PixelFormat::RGB32F: return 12;
+        case PixelFormat::RGBA32F: return 16;
+    }
+    return 0;
+}
+
+Texture create_texture(Device *device, u32 width, u32 height, PixelFormat format)
+{
+    Texture texture;
+
+    MTL::TextureDescriptor* texture_descriptor = MTL::TextureDescriptor::alloc()->init();
+    texture_descriptor->setPixelFormat(to_mtl_pixel_format(format));
+    texture_descriptor->setWidth(width);
+    texture_descriptor->setHeight(height);
+
+    texture.mtl_texture = device->metal_device->newTexture(texture_descriptor);
+
+    texture_descriptor->release();
+
+    return texture;
+}
+
+void upload_texture(Device *device, Texture texture, Image image)
+{
+    MTL::Region region = MTL::Region(0, 0, 0, image.width, image.height, 1);
+    NS::UInteger bytes_per_row = pixel_size(image.format) * image.width;
+    texture.mtl_texture->replaceRegion(region, 0, image.data(), bytes_per_row);
+}
+
+Texture create_texture_array(Device *device, u32 width, u32 height,
+                             u32 layers, PixelFormat format)
+{
+    Texture texture;
+
+    MTL::TextureDescriptor* texture_descriptor = MTL::TextureDescriptor::alloc()->init();
+    texture_descriptor->setTextureType(MTL::TextureType2DArray);
+    texture_descriptor->setPixelFormat(to_mtl_pixel_format(format));
+    texture_descriptor->setWidth(width);
+    texture_descriptor->setHeight(height);
+    texture_descriptor->setArrayLength(layers);
+
+    texture.mtl_texture = device->metal_device->newTexture(texture_descriptor);
+
+    texture_descriptor->release();
+
+    return texture;
+}
+
+// Uploads the width x height rect at (x, y) of image into the same rect of one
+// layer of texture.
+void upload_texture_region(Device *device, Texture texture, u32 layer,
+                           Image image, u32 x, u32 y, u32 width, u32 height)
+{
+    MTL::Region region = MTL::Region(x, y, 0, width, height, 1);
+    NS::UInteger bytes_per_row = pixel_size(image.format) * image.width;
+    u8 *data = image.data() + (u64)y * bytes_per_row + x * pixel_size(image.format);
+    texture.mtl_texture->replaceRegion(region, 0, layer, data, bytes_per_row, 0);
+}
+
 void bind_sampler(Device *device, ShaderArgs shader_args, u32 binding,
                   u32 index = 0) {
 
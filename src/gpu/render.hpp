@@ -7,5 +7,7 @@
 namespace Gpu {
 
 void draw_indexed(Device *device, Buffer index_buffer, i32 offset, i32 index_count);
+void draw_instanced(Device *device, Buffer instance_buffer, i32 vertex_count, i32 instance_count, i32 first_instance);
+void set_scissor(Device *device, i32 x, i32 y, i32 width, i32 height);
 
 }
\ No newline at end of file
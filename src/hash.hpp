@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstring>
+
+#include "types.hpp"
+
+// Hashes memory 8 bytes at a time, for telling whether a large block changed
+// rather than for hash tables. Pass the previous result as hash to hash
+// several blocks as one.
+u64 hash_memory(const void *data, u64 size,
+                u64 hash = 14695981039346656037ull)
+{
+  const u64 k0 = 0x9E3779B97F4A7C15ull;
+  const u64 k1 = 0xC2B2AE3D27D4EB4Full;
+  auto mix     = [&](u64 word) {
+    hash ^= word * k0;
+    hash = ((hash << 31) | (hash >> 33)) * k1;
+  };
+
+  const u8 *bytes = (const u8 *)data;
+  u64 words       = size / 8;
+  for (u64 i = 0; i < words; i++) {
+    u64 word;
+    memcpy(&word, bytes + i * 8, 8);
+    mix(word);
+  }
+  if (size % 8) {
+    u64 word = 0;
+    memcpy(&word, bytes + words * 8, size % 8);
+    mix(word);
+  }
+  mix(size);
+
+  return hash ^ (hash >> 29);
+}
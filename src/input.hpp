@@ -96,3 +96,20 @@ struct Input {
   Vec2f mouse_pos_delta = {};
 };
 
+// whether anything happened since the last fill_input. Keys and buttons that
+// are only being held don't count.
+b8 has_input_events(Input *input)
+{
+  for (int i = 0; i < (int)Keys::COUNT; i++) {
+    if (input->key_down_events[i] || input->key_up_events[i]) return true;
+  }
+  for (int i = 0; i < (int)MouseButton::COUNT; i++) {
+    if (input->mouse_button_down_events[i] ||
+        input->mouse_button_up_events[i]) {
+      return true;
+    }
+  }
+  return input->text_input.size > 0 || input->key_input.size > 0 ||
+         input->scrollwheel_count != 0 || input->mouse_pos_delta.x != 0 ||
+         input->mouse_pos_delta.y != 0;
+}
@@ -22,6 +22,12 @@ u32 color_to_int(Color c)
   return (r << 24) | (g << 16) | (b << 8) | (a);
 }
 
+Color int_to_color(u32 i)
+{
+  return {((i >> 24) & 0xFF) / 255.f, ((i >> 16) & 0xFF) / 255.f,
+          ((i >> 8) & 0xFF) / 255.f, (i & 0xFF) / 255.f};
+}
+
 // http://marcocorvi.altervista.org/games/imgpr/rgb-hsl.htm
 Color rgb_to_hsl(Color in)
 {
@@ -0,0 +1,365 @@
+#pragma once
+
+#include <cmath>
+#include <cstring>
+
+#include "types.hpp"
+
+// Thin 4-wide wrapper so kernels can be written once and compile to SSE on
+// x86, NEON on arm64 (M1 macs) and plain loops everywhere else. Comparisons
+// return masks with all bits set per true lane, like the intrinsics do.
+
+#if defined(__SSE2__) && !defined(SIMD_FORCE_SCALAR)
+#define SIMD_SSE
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__) && !defined(SIMD_FORCE_SCALAR)
+#define SIMD_NEON
+#include <arm_neon.h>
+#else
+#define SIMD_SCALAR
+#endif
+
+#if defined(SIMD_SSE)
+
+struct F32x4 {
+  __m128 v;
+};
+struct I32x4 {
+  __m128i v;
+};
+
+inline F32x4 f32x4(f32 x) { return {_mm_set1_ps(x)}; }
+inline F32x4 f32x4(f32 a, f32 b, f32 c, f32 d)
+{
+  return {_mm_setr_ps(a, b, c, d)};
+}
+inline F32x4 load_f32x4(const f32 *p) { return {_mm_loadu_ps(p)}; }
+inline void store(f32 *p, F32x4 a) { _mm_storeu_ps(p, a.v); }
+
+inline F32x4 operator+(F32x4 a, F32x4 b) { return {_mm_add_ps(a.v, b.v)}; }
+inline F32x4 operator-(F32x4 a, F32x4 b) { return {_mm_sub_ps(a.v, b.v)}; }
+inline F32x4 operator*(F32x4 a, F32x4 b) { return {_mm_mul_ps(a.v, b.v)}; }
+inline F32x4 operator/(F32x4 a, F32x4 b) { return {_mm_div_ps(a.v, b.v)}; }
+inline F32x4 min(F32x4 a, F32x4 b) { return {_mm_min_ps(a.v, b.v)}; }
+inline F32x4 max(F32x4 a, F32x4 b) { return {_mm_max_ps(a.v, b.v)}; }
+inline F32x4 sqrt(F32x4 a) { return {_mm_sqrt_ps(a.v)}; }
+inline F32x4 abs(F32x4 a)
+{
+  return {_mm_andnot_ps(_mm_set1_ps(-0.f), a.v)};
+}
+
+inline F32x4 operator<(F32x4 a, F32x4 b) { return {_mm_cmplt_ps(a.v, b.v)}; }
+inline F32x4 operator<=(F32x4 a, F32x4 b) { return {_mm_cmple_ps(a.v, b.v)}; }
+inline F32x4 operator>(F32x4 a, F32x4 b) { return {_mm_cmpgt_ps(a.v, b.v)}; }
+inline F32x4 operator>=(F32x4 a, F32x4 b) { return {_mm_cmpge_ps(a.v, b.v)}; }
+inline F32x4 operator&(F32x4 a, F32x4 b) { return {_mm_and_ps(a.v, b.v)}; }
+inline F32x4 operator|(F32x4 a, F32x4 b) { return {_mm_or_ps(a.v, b.v)}; }
+
+// mask ? a : b
+inline F32x4 select(F32x4 mask, F32x4 a, F32x4 b)
+{
+  return {_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v))};
+}
+// one bit per lane, lane 0 in bit 0
+inline i32 move_mask(F32x4 mask) { return _mm_movemask_ps(mask.v); }
+
+// inclusive, lane i gets a0 + ... + ai
+inline F32x4 prefix_sum(F32x4 a)
+{
+  __m128i bits = _mm_castps_si128(a.v);
+  a.v          = _mm_add_ps(a.v, _mm_castsi128_ps(_mm_slli_si128(bits, 4)));
+  bits         = _mm_castps_si128(a.v);
+  a.v          = _mm_add_ps(a.v, _mm_castsi128_ps(_mm_slli_si128(bits, 8)));
+  return a;
+}
+inline F32x4 broadcast_last(F32x4 a)
+{
+  return {_mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(3, 3, 3, 3))};
+}
+
+inline I32x4 i32x4(i32 x) { return {_mm_set1_epi32(x)}; }
+inline I32x4 round_to_i32(F32x4 a) { return {_mm_cvtps_epi32(a.v)}; }
+inline I32x4 truncate_to_i32(F32x4 a) { return {_mm_cvttps_epi32(a.v)}; }
+inline F32x4 to_f32(I32x4 a) { return {_mm_cvtepi32_ps(a.v)}; }
+inline void store(i32 *p, I32x4 a) { _mm_storeu_si128((__m128i *)p, a.v); }
+inline I32x4 operator+(I32x4 a, I32x4 b) { return {_mm_add_epi32(a.v, b.v)}; }
+inline I32x4 operator-(I32x4 a, I32x4 b) { return {_mm_sub_epi32(a.v, b.v)}; }
+
+#elif defined(SIMD_NEON)
+
+struct F32x4 {
+  float32x4_t v;
+};
+struct I32x4 {
+  int32x4_t v;
+};
+
+inline F32x4 f32x4(f32 x) { return {vdupq_n_f32(x)}; }
+inline F32x4 f32x4(f32 a, f32 b, f32 c, f32 d)
+{
+  f32 values[4] = {a, b, c, d};
+  return {vld1q_f32(values)};
+}
+inline F32x4 load_f32x4(const f32 *p) { return {vld1q_f32(p)}; }
+inline void store(f32 *p, F32x4 a) { vst1q_f32(p, a.v); }
+
+inline F32x4 operator+(F32x4 a, F32x4 b) { return {vaddq_f32(a.v, b.v)}; }
+inline F32x4 operator-(F32x4 a, F32x4 b) { return {vsubq_f32(a.v, b.v)}; }
+inline F32x4 operator*(F32x4 a, F32x4 b) { return {vmulq_f32(a.v, b.v)}; }
+inline F32x4 operator/(F32x4 a, F32x4 b) { return {vdivq_f32(a.v, b.v)}; }
+inline F32x4 min(F32x4 a, F32x4 b) { return {vminq_f32(a.v, b.v)}; }
+inline F32x4 max(F32x4 a, F32x4 b) { return {vmaxq_f32(a.v, b.v)}; }
+inline F32x4 sqrt(F32x4 a) { return {vsqrtq_f32(a.v)}; }
+inline F32x4 abs(F32x4 a) { return {vabsq_f32(a.v)}; }
+
+inline F32x4 from_mask(uint32x4_t m) { return {vreinterpretq_f32_u32(m)}; }
+inline uint32x4_t to_mask(F32x4 a) { return vreinterpretq_u32_f32(a.v); }
+
+inline F32x4 operator<(F32x4 a, F32x4 b)
+{
+  return from_mask(vcltq_f32(a.v, b.v));
+}
+inline F32x4 operator<=(F32x4 a, F32x4 b)
+{
+  return from_mask(vcleq_f32(a.v, b.v));
+}
+inline F32x4 operator>(F32x4 a, F32x4 b)
+{
+  return from_mask(vcgtq_f32(a.v, b.v));
+}
+inline F32x4 operator>=(F32x4 a, F32x4 b)
+{
+  return from_mask(vcgeq_f32(a.v, b.v));
+}
+inline F32x4 operator&(F32x4 a, F32x4 b)
+{
+  return from_mask(vandq_u32(to_mask(a), to_mask(b)));
+}
+inline F32x4 operator|(F32x4 a, F32x4 b)
+{
+  return from_mask(vorrq_u32(to_mask(a), to_mask(b)));
+}
+
+inline F32x4 select(F32x4 mask, F32x4 a, F32x4 b)
+{
+  return {vbslq_f32(to_mask(mask), a.v, b.v)};
+}
+inline i32 move_mask(F32x4 mask)
+{
+  static const i32 shifts[4] = {0, 1, 2, 3};
+  uint32x4_t bits = vshrq_n_u32(to_mask(mask), 31);
+  return vaddvq_u32(vshlq_u32(bits, vld1q_s32(shifts)));
+}
+
+inline F32x4 prefix_sum(F32x4 a)
+{
+  float32x4_t zero = vdupq_n_f32(0.f);
+  a.v              = vaddq_f32(a.v, vextq_f32(zero, a.v, 3));
+  a.v              = vaddq_f32(a.v, vextq_f32(zero, a.v, 2));
+  return a;
+}
+inline F32x4 broadcast_last(F32x4 a) { return {vdupq_laneq_f32(a.v, 3)}; }
+
+inline I32x4 i32x4(i32 x) { return {vdupq_n_s32(x)}; }
+inline I32x4 round_to_i32(F32x4 a) { return {vcvtnq_s32_f32(a.v)}; }
+inline I32x4 truncate_to_i32(F32x4 a) { return {vcvtq_s32_f32(a.v)}; }
+inline F32x4 to_f32(I32x4 a) { return {vcvtq_f32_s32(a.v)}; }
+inline void store(i32 *p, I32x4 a) { vst1q_s32(p, a.v); }
+inline I32x4 operator+(I32x4 a, I32x4 b) { return {vaddq_s32(a.v, b.v)}; }
+inline I32x4 operator-(I32x4 a, I32x4 b) { return {vsubq_s32(a.v, b.v)}; }
+
+#else
+
+struct F32x4 {
+  f32 v[4];
+};
+struct I32x4 {
+  i32 v[4];
+};
+
+#define SIMD_SCALAR_OP(expr)                 \
+  F32x4 r;                                   \
+  for (i32 i = 0; i < 4; i++) r.v[i] = expr; \
+  return r;
+
+inline f32 mask_lane(b8 b)
+{
+  u32 bits = b ? 0xFFFFFFFF : 0;
+  f32 f;
+  memcpy(&f, &bits, 4);
+  return f;
+}
+inline u32 lane_bits(f32 f)
+{
+  u32 bits;
+  memcpy(&bits, &f, 4);
+  return bits;
+}
+
+inline F32x4 f32x4(f32 x) { return {{x, x, x, x}}; }
+inline F32x4 f32x4(f32 a, f32 b, f32 c, f32 d) { return {{a, b, c, d}}; }
+inline F32x4 load_f32x4(const f32 *p) { return {{p[0], p[1], p[2], p[3]}}; }
+inline void store(f32 *p, F32x4 a) { memcpy(p, a.v, sizeof(a.v)); }
+
+inline F32x4 operator+(F32x4 a, F32x4 b) { SIMD_SCALAR_OP(a.v[i] + b.v[i]) }
+inline F32x4 operator-(F32x4 a, F32x4 b) { SIMD_SCALAR_OP(a.v[i] - b.v[i]) }
+inline F32x4 operator*(F32x4 a, F32x4 b) { SIMD_SCALAR_OP(a.v[i] * b.v[i]) }
+inline F32x4 operator/(F32x4 a, F32x4 b) { SIMD_SCALAR_OP(a.v[i] / b.v[i]) }
+inline F32x4 min(F32x4 a, F32x4 b) { SIMD_SCALAR_OP(fminf(a.v[i], b.v[i])) }
+inline F32x4 max(F32x4 a, F32x4 b) { SIMD_SCALAR_OP(fmaxf(a.v[i], b.v[i])) }
+inline F32x4 sqrt(F32x4 a) { SIMD_SCALAR_OP(sqrtf(a.v[i])) }
+inline F32x4 abs(F32x4 a) { SIMD_SCALAR_OP(fabsf(a.v[i])) }
+
+inline F32x4 operator<(F32x4 a, F32x4 b)
+{
+  SIMD_SCALAR_OP(mask_lane(a.v[i] < b.v[i]))
+}
+inline F32x4 operator<=(F32x4 a, F32x4 b)
+{
+  SIMD_SCALAR_OP(mask_lane(a.v[i] <= b.v[i]))
+}
+inline F32x4 operator>(F32x4 a, F32x4 b)
+{
+  SIMD_SCALAR_OP(mask_lane(a.v[i] > b.v[i]))
+}
+inline F32x4 operator>=(F32x4 a, F32x4 b)
+{
+  SIMD_SCALAR_OP(mask_lane(a.v[i] >= b.v[i]))
+}
+inline F32x4 operator&(F32x4 a, F32x4 b)
+{
+  SIMD_SCALAR_OP(mask_lane(lane_bits(a.v[i]) & lane_bits(b.v[i])))
+}
+inline F32x4 operator|(F32x4 a, F32x4 b)
+{
+  SIMD_SCALAR_OP(mask_lane(lane_bits(a.v[i]) | lane_bits(b.v[i])))
+}
+
+inline F32x4 select(F32x4 mask, F32x4 a, F32x4 b)
+{
+  SIMD_SCALAR_OP(lane_bits(mask.v[i]) ? a.v[i] : b.v[i])
+}
+inline i32 move_mask(F32x4 mask)
+{
+  i32 bits = 0;
+  for (i32 i = 0; i < 4; i++) bits |= (lane_bits(mask.v[i]) >> 31) << i;
+  return bits;
+}
+
+inline F32x4 prefix_sum(F32x4 a)
+{
+  for (i32 i = 1; i < 4; i++) a.v[i] += a.v[i - 1];
+  return a;
+}
+inline F32x4 broadcast_last(F32x4 a) { return f32x4(a.v[3]); }
+
+inline I32x4 i32x4(i32 x) { return {{x, x, x, x}}; }
+inline I32x4 round_to_i32(F32x4 a)
+{
+  I32x4 r;
+  for (i32 i = 0; i < 4; i++) r.v[i] = (i32)nearbyintf(a.v[i]);
+  return r;
+}
+inline I32x4 truncate_to_i32(F32x4 a)
+{
+  I32x4 r;
+  for (i32 i = 0; i < 4; i++) r.v[i] = (i32)a.v[i];
+  return r;
+}
+inline F32x4 to_f32(I32x4 a) { SIMD_SCALAR_OP((f32)a.v[i]) }
+inline void store(i32 *p, I32x4 a) { memcpy(p, a.v, sizeof(a.v)); }
+inline I32x4 operator+(I32x4 a, I32x4 b)
+{
+  return {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}};
+}
+inline I32x4 operator-(I32x4 a, I32x4 b)
+{
+  return {{a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]}};
+}
+
+#undef SIMD_SCALAR_OP
+
+#endif
+
+inline F32x4 clamp(F32x4 a, F32x4 lo, F32x4 hi) { return min(max(a, lo), hi); }
+inline F32x4 smoothstep(F32x4 edge0, F32x4 edge1, F32x4 x)
+{
+  F32x4 t = clamp((x - edge0) / (edge1 - edge0), f32x4(0.f), f32x4(1.f));
+  return t * t * (f32x4(3.f) - f32x4(2.f) * t);
+}
+
+// IEEE half conversion, round to nearest even. only used for the tails of
+// arrays and for error checking, the bulk goes through f32x4_to_f16.
+u16 f32_to_f16(f32 value)
+{
+  u32 bits;
+  memcpy(&bits, &value, 4);
+
+  u32 sign     = (bits >> 16) & 0x8000;
+  i32 exponent = ((bits >> 23) & 0xFF) - 127 + 15;
+  u32 mantissa = bits & 0x7FFFFF;
+
+  if (((bits >> 23) & 0xFF) == 0xFF) {  // inf/nan
+    return sign | 0x7C00 | (mantissa ? 0x200 : 0);
+  }
+  if (exponent >= 31) return sign | 0x7C00;
+  if (exponent <= 0) {
+    if (exponent < -10) return sign;
+    mantissa |= 0x800000;
+    u32 shift   = 14 - exponent;
+    u32 half    = mantissa >> shift;
+    u32 rest    = mantissa & ((1 << shift) - 1);
+    u32 halfway = 1 << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1))) half++;
+    return sign | half;
+  }
+
+  u32 half = sign | (exponent << 10) | (mantissa >> 13);
+  u32 rest = mantissa & 0x1FFF;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+  return half;
+}
+
+f32 f16_to_f32(u16 half)
+{
+  u32 sign     = (half & 0x8000) << 16;
+  u32 exponent = (half >> 10) & 0x1F;
+  u32 mantissa = half & 0x3FF;
+
+  u32 bits;
+  if (exponent == 0) {
+    if (mantissa == 0) {
+      bits = sign;
+    } else {
+      // subnormal, renormalize
+      exponent = 127 - 15 + 1;
+      while (!(mantissa & 0x400)) {
+        mantissa <<= 1;
+        exponent--;
+      }
+      bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+    }
+  } else if (exponent == 31) {
+    bits = sign | 0x7F800000 | (mantissa << 13);
+  } else {
+    bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+  }
+
+  f32 value;
+  memcpy(&value, &bits, 4);
+  return value;
+}
+
+inline void f32x4_to_f16(F32x4 a, u16 out[4])
+{
+#if defined(SIMD_SSE) && defined(__F16C__)
+  __m128i half = _mm_cvtps_ph(a.v, _MM_FROUND_TO_NEAREST_INT);
+  _mm_storel_epi64((__m128i *)out, half);
+#elif defined(SIMD_NEON)
+  vst1_u16(out, vreinterpret_u16_f16(vcvt_f16_f32(a.v)));
+#else
+  f32 lanes[4];
+  store(lanes, a);
+  for (i32 i = 0; i < 4; i++) out[i] = f32_to_f16(lanes[i]);
+#endif
+}
@@ -2,6 +2,7 @@
 
 #include <stdlib.h>
 #include <cassert>
+#include <cstddef>
 
 #include "types.hpp"
 
@@ -0,0 +1,630 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+#include "logging.hpp"
+#include "math/math.hpp"
+#include "math/simd.hpp"
+#include "memory.hpp"
+#include "mesh/mesh.hpp"
+#include "parallel.hpp"
+#include "types.hpp"
+
+// Bounding volume hierarchy over the triangles of a StandardMesh3d, for ray
+// casts and picking. Built top down with the surface area heuristic evaluated
+// over a fixed number of bins per axis ("On fast Construction of SAH-based
+// Bounding Volume Hierarchies", Wald 2007).
+//
+// Children of a node are always allocated as a pair, so a node only needs the
+// index of its first child. The nodes are 64 byte aligned and node 1 is left
+// unused, so every pair sits in one cache line.
+
+struct BvhNode {
+  Vec3f min;
+  u32 first;  // first child if count is 0, otherwise first triangle
+  Vec3f max;
+  u32 count;  // triangles in the leaf, 0 for interior nodes
+};
+static_assert(sizeof(BvhNode) == 32);
+
+// triangles are copied out in leaf order, in the form the intersection kernel
+// wants them.
+struct BvhTriangle {
+  Vec3f v0;
+  Vec3f e1;
+  Vec3f e2;
+};
+
+struct Bvh {
+  BvhNode *nodes = nullptr;
+  u32 nodes_size = 0;
+
+  BvhTriangle *triangles = nullptr;
+  u32 *triangle_ids      = nullptr;  // index of the triangle in the mesh
+  u32 triangles_size     = 0;
+
+  Mem nodes_mem     = {};
+  Mem triangles_mem = {};
+};
+
+struct Ray {
+  Vec3f origin;
+  Vec3f direction;
+  f32 t_max = INFINITY;
+};
+
+const u32 BVH_NO_HIT = 0xFFFFFFFF;
+
+struct RayHit {
+  f32 t        = INFINITY;
+  u32 triangle = BVH_NO_HIT;  // index into the mesh's triangles, i.e. indexes/3
+  f32 u        = 0;           // barycentrics of v1 and v2
+  f32 v        = 0;
+};
+
+const u32 BVH_BINS           = 16;
+const u32 BVH_MAX_LEAF_SIZE  = 8;
+const u32 BVH_MAX_DEPTH      = 64;
+const f32 BVH_TRAVERSAL_COST = 1.f;
+const f32 BVH_TRIANGLE_COST  = 1.f;
+
+struct Aabb {
+  Vec3f min = {INFINITY, INFINITY, INFINITY};
+  Vec3f max = {-INFINITY, -INFINITY, -INFINITY};
+};
+
+void grow(Aabb *box, Vec3f p)
+{
+  box->min = {fminf(box->min.x, p.x), fminf(box->min.y, p.y),
+              fminf(box->min.z, p.z)};
+  box->max = {fmaxf(box->max.x, p.x), fmaxf(box->max.y, p.y),
+              fmaxf(box->max.z, p.z)};
+}
+
+void grow(Aabb *box, Aabb other)
+{
+  box->min = {fminf(box->min.x, other.min.x), fminf(box->min.y, other.min.y),
+              fminf(box->min.z, other.min.z)};
+  box->max = {fmaxf(box->max.x, other.max.x), fmaxf(box->max.y, other.max.y),
+              fmaxf(box->max.z, other.max.z)};
+}
+
+f32 surface_area(Aabb box)
+{
+  Vec3f e = box.max - box.min;
+  if (e.x < 0) return 0;
+  return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+struct PendingBvhNode {
+  u32 node;
+  u32 depth;
+};
+
+struct BvhBuilder {
+  Bvh *bvh;
+  Aabb *bounds;
+  Vec3f *centroids;
+  std::atomic<u32> next_node;
+
+  // subtrees left for the parallel phase
+  PendingBvhNode *pending;
+  u32 pending_size;
+  u32 parallel_threshold;
+};
+
+void update_node_bounds(BvhBuilder *b, BvhNode *node, u32 first, u32 count)
+{
+  Aabb box;
+  for (u32 i = 0; i < count; i++) {
+    grow(&box, b->bounds[b->bvh->triangle_ids[first + i]]);
+  }
+  node->min = box.min;
+  node->max = box.max;
+}
+
+void build_bvh_node(BvhBuilder *b, u32 node_idx, u32 depth, b8 serial_phase)
+{
+  BvhNode *node = &b->bvh->nodes[node_idx];
+  u32 first     = node->first;
+  u32 count     = node->count;
+  u32 *ids      = b->bvh->triangle_ids;
+
+  if (serial_phase && count <= b->parallel_threshold) {
+    b->pending[b->pending_size++] = {node_idx, depth};
+    return;
+  }
+  if (count <= 2 || depth >= BVH_MAX_DEPTH) return;
+
+  Aabb centroid_box;
+  for (u32 i = 0; i < count; i++) {
+    grow(&centroid_box, b->centroids[ids[first + i]]);
+  }
+
+  // bin along all three axes in one pass over the triangles.
+  Vec3f lo    = centroid_box.min;
+  Vec3f scale = {};
+  for (i32 axis = 0; axis < 3; axis++) {
+    f32 extent         = centroid_box.max.values[axis] - lo.values[axis];
+    scale.values[axis] = extent > 0.f ? BVH_BINS / extent : 0.f;
+  }
+
+  Aabb bin_bounds[3][BVH_BINS];
+  u32 bin_counts[3][BVH_BINS] = {};
+  for (u32 i = 0; i < count; i++) {
+    u32 tri  = ids[first + i];
+    Aabb box = b->bounds[tri];
+    for (i32 axis = 0; axis < 3; axis++) {
+      u32 bin = (u32)((b->centroids[tri].values[axis] - lo.values[axis]) *
+                      scale.values[axis]);
+      if (bin >= BVH_BINS) bin = BVH_BINS - 1;
+      bin_counts[axis][bin]++;
+      grow(&bin_bounds[axis][bin], box);
+    }
+  }
+
+  f32 best_cost  = INFINITY;
+  i32 best_axis  = -1;
+  u32 best_split = 0;
+  Aabb best_left, best_right;
+  for (i32 axis = 0; axis < 3; axis++) {
+    if (scale.values[axis] == 0.f) continue;
+
+    // sweep from the right to get the bounds of everything right of each
+    // split, then from the left to evaluate them.
+    Aabb right_boxes[BVH_BINS];
+    u32 right_count[BVH_BINS];
+    Aabb right_box;
+    u32 right_sum = 0;
+    for (u32 i = BVH_BINS - 1; i > 0; i--) {
+      grow(&right_box, bin_bounds[axis][i]);
+      right_sum += bin_counts[axis][i];
+      right_boxes[i] = right_box;
+      right_count[i] = right_sum;
+    }
+
+    Aabb left_box;
+    u32 left_sum = 0;
+    for (u32 split = 1; split < BVH_BINS; split++) {
+      grow(&left_box, bin_bounds[axis][split - 1]);
+      left_sum += bin_counts[axis][split - 1];
+      if (left_sum == 0 || right_count[split] == 0) continue;
+
+      f32 cost = left_sum * surface_area(left_box) +
+                 right_count[split] * surface_area(right_boxes[split]);
+      if (cost < best_cost) {
+        best_cost  = cost;
+        best_axis  = axis;
+        best_split = split;
+        best_left  = left_box;
+        best_right = right_boxes[split];
+      }
+    }
+  }
+
+  Aabb node_box = {node->min, node->max};
+  f32 leaf_cost = count * BVH_TRIANGLE_COST;
+  f32 split_cost =
+      BVH_TRAVERSAL_COST +
+      BVH_TRIANGLE_COST * best_cost / fmaxf(surface_area(node_box), 1e-20f);
+  if (best_axis < 0) return;
+  if (split_cost >= leaf_cost && count <= BVH_MAX_LEAF_SIZE) return;
+
+  u32 i = first;
+  u32 j = first + count;
+  while (i < j) {
+    f32 c   = b->centroids[ids[i]].values[best_axis];
+    u32 bin = (u32)((c - lo.values[best_axis]) * scale.values[best_axis]);
+    if (bin >= BVH_BINS) bin = BVH_BINS - 1;
+    if (bin < best_split) {
+      i++;
+    } else {
+      u32 tmp = ids[i];
+      ids[i]  = ids[--j];
+      ids[j]  = tmp;
+    }
+  }
+  u32 left_count = i - first;
+
+  u32 left_idx   = b->next_node.fetch_add(2);
+  BvhNode *left  = &b->bvh->nodes[left_idx];
+  BvhNode *right = &b->bvh->nodes[left_idx + 1];
+  left->first    = first;
+  left->count    = left_count;
+  left->min      = best_left.min;
+  left->max      = best_left.max;
+  right->first   = first + left_count;
+  right->count   = count - left_count;
+  right->min     = best_right.min;
+  right->max     = best_right.max;
+
+  node->first = left_idx;
+  node->count = 0;
+
+  build_bvh_node(b, left_idx, depth + 1, serial_phase);
+  build_bvh_node(b, left_idx + 1, depth + 1, serial_phase);
+}
+
+// The top of the tree is split on the calling thread until there are enough
+// independent subtrees to keep every core busy, those are then finished in
+// parallel.
+Bvh build_bvh(StandardMesh3d *mesh)
+{
+  Bvh bvh;
+  bvh.triangles_size = mesh->indexes_size / 3;
+  if (bvh.triangles_size == 0) return bvh;
+
+  u32 tri_count = bvh.triangles_size;
+  // 63 extra bytes so the nodes can start on a cache line.
+  bvh.nodes_mem = system_allocator.alloc(tri_count * 2 * sizeof(BvhNode) + 63);
+  bvh.triangles_mem =
+      system_allocator.alloc(tri_count * (sizeof(BvhTriangle) + sizeof(u32)));
+  bvh.nodes        = (BvhNode *)(((u64)bvh.nodes_mem.data + 63) & ~(u64)63);
+  bvh.triangles    = (BvhTriangle *)bvh.triangles_mem.data;
+  bvh.triangle_ids = (u32 *)(bvh.triangles + tri_count);
+
+  Mem bounds_mem    = system_allocator.alloc(tri_count * sizeof(Aabb));
+  Mem centroids_mem = system_allocator.alloc(tri_count * sizeof(Vec3f));
+  Mem pending_mem = system_allocator.alloc(tri_count * sizeof(PendingBvhNode));
+
+  BvhBuilder builder;
+  builder.bvh          = &bvh;
+  builder.bounds       = (Aabb *)bounds_mem.data;
+  builder.centroids    = (Vec3f *)centroids_mem.data;
+  builder.next_node    = 2;
+  builder.pending      = (PendingBvhNode *)pending_mem.data;
+  builder.pending_size = 0;
+  builder.parallel_threshold =
+      tri_count / (worker_thread_count() * 8) + BVH_MAX_LEAF_SIZE;
+
+  parallel_for((tri_count + 4095) / 4096, [&](u32 chunk) {
+    u32 end = (chunk + 1) * 4096 < tri_count ? (chunk + 1) * 4096 : tri_count;
+    for (u32 t = chunk * 4096; t < end; t++) {
+      Aabb box;
+      grow(&box, mesh->vertices[mesh->indexes[t * 3 + 0]].position);
+      grow(&box, mesh->vertices[mesh->indexes[t * 3 + 1]].position);
+      grow(&box, mesh->vertices[mesh->indexes[t * 3 + 2]].position);
+      builder.bounds[t]    = box;
+      builder.centroids[t] = (box.min + box.max) * .5f;
+      bvh.triangle_ids[t]  = t;
+    }
+  });
+
+  BvhNode *root = &bvh.nodes[0];
+  root->first   = 0;
+  root->count   = tri_count;
+  update_node_bounds(&builder, root, 0, tri_count);
+
+  build_bvh_node(&builder, 0, 0, true);
+  parallel_for(builder.pending_size, [&](u32 i) {
+    PendingBvhNode pending = builder.pending[i];
+    build_bvh_node(&builder, pending.node, pending.depth, false);
+  });
+  bvh.nodes_size = builder.next_node;
+
+  parallel_for((tri_count + 4095) / 4096, [&](u32 chunk) {
+    u32 end = (chunk + 1) * 4096 < tri_count ? (chunk + 1) * 4096 : tri_count;
+    for (u32 t = chunk * 4096; t < end; t++) {
+      u32 *tri = &mesh->indexes[bvh.triangle_ids[t] * 3];
+      Vec3f v0 = mesh->vertices[tri[0]].position;
+      bvh.triangles[t] = {v0, mesh->vertices[tri[1]].position - v0,
+                          mesh->vertices[tri[2]].position - v0};
+    }
+  });
+
+  system_allocator.free(bounds_mem);
+  system_allocator.free(centroids_mem);
+  system_allocator.free(pending_mem);
+
+  return bvh;
+}
+
+void free_bvh(Bvh *bvh)
+{
+  if (bvh->nodes_mem.data) system_allocator.free(bvh->nodes_mem);
+  if (bvh->triangles_mem.data) system_allocator.free(bvh->triangles_mem);
+  *bvh = {};
+}
+
+// Moller-Trumbore, with every input already spread across lanes. Works for
+// four triangles against one ray as well as one triangle against four rays.
+// Returns the mask of lanes that hit closer than t_best.
+F32x4 intersect_triangles_x4(F32x4 ox, F32x4 oy, F32x4 oz, F32x4 dx, F32x4 dy,
+                             F32x4 dz, F32x4 v0x, F32x4 v0y, F32x4 v0z,
+                             F32x4 e1x, F32x4 e1y, F32x4 e1z, F32x4 e2x,
+                             F32x4 e2y, F32x4 e2z, F32x4 t_best, F32x4 *t_out,
+                             F32x4 *u_out, F32x4 *v_out)
+{
+  F32x4 px  = dy * e2z - dz * e2y;
+  F32x4 py  = dz * e2x - dx * e2z;
+  F32x4 pz  = dx * e2y - dy * e2x;
+  F32x4 det = e1x * px + e1y * py + e1z * pz;
+
+  F32x4 inv_det = f32x4(1.f) / det;
+  F32x4 tx      = ox - v0x;
+  F32x4 ty      = oy - v0y;
+  F32x4 tz      = oz - v0z;
+  F32x4 u       = (tx * px + ty * py + tz * pz) * inv_det;
+
+  F32x4 qx = ty * e1z - tz * e1y;
+  F32x4 qy = tz * e1x - tx * e1z;
+  F32x4 qz = tx * e1y - ty * e1x;
+  F32x4 v  = (dx * qx + dy * qy + dz * qz) * inv_det;
+  F32x4 t  = (e2x * qx + e2y * qy + e2z * qz) * inv_det;
+
+  F32x4 zero = f32x4(0.f);
+  F32x4 hit  = (abs(det) > f32x4(1e-12f)) & (u >= zero) & (v >= zero) &
+              (u + v <= f32x4(1.f)) & (t > zero) & (t < t_best);
+  *t_out = t;
+  *u_out = u;
+  *v_out = v;
+  return hit;
+}
+
+// slab test, returns the entry distance or INFINITY on a miss.
+f32 intersect_node(BvhNode *node, Vec3f origin, Vec3f inv_dir, f32 t_max)
+{
+  f32 tx1 = (node->min.x - origin.x) * inv_dir.x;
+  f32 tx2 = (node->max.x - origin.x) * inv_dir.x;
+  f32 ty1 = (node->min.y - origin.y) * inv_dir.y;
+  f32 ty2 = (node->max.y - origin.y) * inv_dir.y;
+  f32 tz1 = (node->min.z - origin.z) * inv_dir.z;
+  f32 tz2 = (node->max.z - origin.z) * inv_dir.z;
+
+  f32 t_near = fmaxf(fmaxf(fminf(tx1, tx2), fminf(ty1, ty2)),
+                     fmaxf(fminf(tz1, tz2), 0.f));
+  f32 t_far  = fminf(fminf(fmaxf(tx1, tx2), fmaxf(ty1, ty2)),
+                     fminf(fmaxf(tz1, tz2), t_max));
+  return t_near <= t_far ? t_near : INFINITY;
+}
+
+// slab test of both children of an interior node at once. The lanes hold the
+// near planes of the two children and then their far planes, which inv_dir
+// negates so one max finds the entry and the exit. Writes each child's entry
+// distance, or INFINITY on a miss.
+void intersect_node_pair(BvhNode *pair, F32x4 origin[3], F32x4 inv_dir[3],
+                         b8 flip[3], f32 t_max, f32 t_out[2])
+{
+  F32x4 t = f32x4(0.f, 0.f, -t_max, -t_max);
+  for (i32 axis = 0; axis < 3; axis++) {
+    Vec3f near_a = flip[axis] ? pair[0].max : pair[0].min;
+    Vec3f near_b = flip[axis] ? pair[1].max : pair[1].min;
+    Vec3f far_a  = flip[axis] ? pair[0].min : pair[0].max;
+    Vec3f far_b  = flip[axis] ? pair[1].min : pair[1].max;
+    F32x4 planes = f32x4(near_a[axis], near_b[axis], far_a[axis], far_b[axis]);
+    // a NaN from a ray running along the plane leaves t as it was
+    t = max((planes - origin[axis]) * inv_dir[axis], t);
+  }
+
+  f32 lanes[4];
+  store(lanes, t);
+  t_out[0] = lanes[0] <= -lanes[2] ? lanes[0] : INFINITY;
+  t_out[1] = lanes[1] <= -lanes[3] ? lanes[1] : INFINITY;
+}
+
+// Closest hit along the ray. Leaves are tested four triangles at a time.
+b8 intersect_bvh(Bvh *bvh, Ray ray, RayHit *hit)
+{
+  *hit = {};
+  if (bvh->nodes_size == 0) return false;
+
+  Vec3f inv_dir = {1.f / ray.direction.x, 1.f / ray.direction.y,
+                   1.f / ray.direction.z};
+  F32x4 ox      = f32x4(ray.origin.x);
+  F32x4 oy      = f32x4(ray.origin.y);
+  F32x4 oz      = f32x4(ray.origin.z);
+  F32x4 dx      = f32x4(ray.direction.x);
+  F32x4 dy      = f32x4(ray.direction.y);
+  F32x4 dz      = f32x4(ray.direction.z);
+
+  F32x4 slab_origin[3] = {ox, oy, oz};
+  F32x4 slab_inv_dir[3];
+  b8 flip[3];
+  for (i32 axis = 0; axis < 3; axis++) {
+    f32 inv            = inv_dir[axis];
+    slab_inv_dir[axis] = f32x4(inv, inv, -inv, -inv);
+    flip[axis]         = inv < 0;
+  }
+
+  f32 t_best = ray.t_max;
+  u32 stack[BVH_MAX_DEPTH + 1];
+  u32 stack_size = 0;
+  BvhNode *node  = &bvh->nodes[0];
+  if (intersect_node(node, ray.origin, inv_dir, t_best) == INFINITY) {
+    return false;
+  }
+
+  while (true) {
+    if (node->count > 0) {
+      for (u32 i = 0; i < node->count; i += 4) {
+        BvhTriangle tris[4];
+        u32 lanes = node->count - i < 4 ? node->count - i : 4;
+        for (u32 l = 0; l < 4; l++) {
+          // pad with a degenerate triangle, det = 0 never hits
+          tris[l] = l < lanes ? bvh->triangles[node->first + i + l]
+                              : BvhTriangle{};
+        }
+
+        F32x4 t, u, v;
+        F32x4 mask = intersect_triangles_x4(
+            ox, oy, oz, dx, dy, dz,
+            f32x4(tris[0].v0.x, tris[1].v0.x, tris[2].v0.x, tris[3].v0.x),
+            f32x4(tris[0].v0.y, tris[1].v0.y, tris[2].v0.y, tris[3].v0.y),
+            f32x4(tris[0].v0.z, tris[1].v0.z, tris[2].v0.z, tris[3].v0.z),
+            f32x4(tris[0].e1.x, tris[1].e1.x, tris[2].e1.x, tris[3].e1.x),
+            f32x4(tris[0].e1.y, tris[1].e1.y, tris[2].e1.y, tris[3].e1.y),
+            f32x4(tris[0].e1.z, tris[1].e1.z, tris[2].e1.z, tris[3].e1.z),
+            f32x4(tris[0].e2.x, tris[1].e2.x, tris[2].e2.x, tris[3].e2.x),
+            f32x4(tris[0].e2.y, tris[1].e2.y, tris[2].e2.y, tris[3].e2.y),
+            f32x4(tris[0].e2.z, tris[1].e2.z, tris[2].e2.z, tris[3].e2.z),
+            f32x4(t_best), &t, &u, &v);
+
+        i32 bits = move_mask(mask);
+        if (bits) {
+          f32 ts[4], us[4], vs[4];
+          store(ts, t);
+          store(us, u);
+          store(vs, v);
+          for (u32 l = 0; l < lanes; l++) {
+            if ((bits & (1 << l)) && ts[l] < t_best) {
+              t_best        = ts[l];
+              hit->t        = ts[l];
+              hit->u        = us[l];
+              hit->v        = vs[l];
+              hit->triangle = bvh->triangle_ids[node->first + i + l];
+            }
+          }
+        }
+      }
+
+      if (stack_size == 0) break;
+      node = &bvh->nodes[stack[--stack_size]];
+      continue;
+    }
+
+    f32 t_children[2];
+    intersect_node_pair(&bvh->nodes[node->first], slab_origin, slab_inv_dir,
+                        flip, t_best, t_children);
+    BvhNode *near = &bvh->nodes[node->first];
+    BvhNode *far  = &bvh->nodes[node->first + 1];
+    f32 t_near    = t_children[0];
+    f32 t_far     = t_children[1];
+    if (t_far < t_near) {
+      BvhNode *tmp_node = near;
+      near              = far;
+      far               = tmp_node;
+      f32 tmp_t         = t_near;
+      t_near            = t_far;
+      t_far             = tmp_t;
+    }
+
+    if (t_near == INFINITY) {
+      if (stack_size == 0) break;
+      node = &bvh->nodes[stack[--stack_size]];
+    } else {
+      node = near;
+      if (t_far != INFINITY) stack[stack_size++] = far - bvh->nodes;
+    }
+  }
+
+  return hit->triangle != BVH_NO_HIT;
+}
+
+// Four rays traced together, one per lane. Works best for coherent rays
+// (neighbouring pixels, a pick with some jitter), a node is entered as long
+// as any ray still wants it.
+void intersect_bvh_packet(Bvh *bvh, Ray rays[4], RayHit hits[4])
+{
+  for (u32 i = 0; i < 4; i++) hits[i] = {};
+  if (bvh->nodes_size == 0) return;
+
+  F32x4 ox = f32x4(rays[0].origin.x, rays[1].origin.x, rays[2].origin.x,
+                   rays[3].origin.x);
+  F32x4 oy = f32x4(rays[0].origin.y, rays[1].origin.y, rays[2].origin.y,
+                   rays[3].origin.y);
+  F32x4 oz = f32x4(rays[0].origin.z, rays[1].origin.z, rays[2].origin.z,
+                   rays[3].origin.z);
+  F32x4 dx = f32x4(rays[0].direction.x, rays[1].direction.x,
+                   rays[2].direction.x, rays[3].direction.x);
+  F32x4 dy = f32x4(rays[0].direction.y, rays[1].direction.y,
+                   rays[2].direction.y, rays[3].direction.y);
+  F32x4 dz = f32x4(rays[0].direction.z, rays[1].direction.z,
+                   rays[2].direction.z, rays[3].direction.z);
+  F32x4 one    = f32x4(1.f);
+  F32x4 inv_dx = one / dx;
+  F32x4 inv_dy = one / dy;
+  F32x4 inv_dz = one / dz;
+  F32x4 t_best =
+      f32x4(rays[0].t_max, rays[1].t_max, rays[2].t_max, rays[3].t_max);
+
+  F32x4 best_u   = f32x4(0.f);
+  F32x4 best_v   = f32x4(0.f);
+  u32 best_id[4] = {BVH_NO_HIT, BVH_NO_HIT, BVH_NO_HIT, BVH_NO_HIT};
+
+  // returns the entry distance per lane, INFINITY where the ray misses
+  auto intersect_node_x4 = [&](BvhNode *node) {
+    F32x4 tx1    = (f32x4(node->min.x) - ox) * inv_dx;
+    F32x4 tx2    = (f32x4(node->max.x) - ox) * inv_dx;
+    F32x4 ty1    = (f32x4(node->min.y) - oy) * inv_dy;
+    F32x4 ty2    = (f32x4(node->max.y) - oy) * inv_dy;
+    F32x4 tz1    = (f32x4(node->min.z) - oz) * inv_dz;
+    F32x4 tz2    = (f32x4(node->max.z) - oz) * inv_dz;
+    F32x4 t_near = max(max(min(tx1, tx2), min(ty1, ty2)),
+                       max(min(tz1, tz2), f32x4(0.f)));
+    F32x4 t_far  = min(min(max(tx1, tx2), max(ty1, ty2)),
+                       min(max(tz1, tz2), t_best));
+    return select(t_near <= t_far, t_near, f32x4(INFINITY));
+  };
+  auto closest = [](F32x4 t) {
+    f32 lanes[4];
+    store(lanes, t);
+    return fminf(fminf(lanes[0], lanes[1]), fminf(lanes[2], lanes[3]));
+  };
+
+  u32 stack[BVH_MAX_DEPTH + 1];
+  u32 stack_size = 0;
+  BvhNode *node  = &bvh->nodes[0];
+  if (closest(intersect_node_x4(node)) == INFINITY) return;
+
+  while (true) {
+    if (node->count > 0) {
+      for (u32 i = 0; i < node->count; i++) {
+        BvhTriangle tri = bvh->triangles[node->first + i];
+        F32x4 t, u, v;
+        F32x4 mask = intersect_triangles_x4(
+            ox, oy, oz, dx, dy, dz, f32x4(tri.v0.x), f32x4(tri.v0.y),
+            f32x4(tri.v0.z), f32x4(tri.e1.x), f32x4(tri.e1.y),
+            f32x4(tri.e1.z), f32x4(tri.e2.x), f32x4(tri.e2.y),
+            f32x4(tri.e2.z), t_best, &t, &u, &v);
+
+        i32 bits = move_mask(mask);
+        if (bits) {
+          t_best = select(mask, t, t_best);
+          best_u = select(mask, u, best_u);
+          best_v = select(mask, v, best_v);
+          for (u32 l = 0; l < 4; l++) {
+            if (bits & (1 << l)) {
+              best_id[l] = bvh->triangle_ids[node->first + i];
+            }
+          }
+        }
+      }
+
+      if (stack_size == 0) break;
+      node = &bvh->nodes[stack[--stack_size]];
+      continue;
+    }
+
+    BvhNode *near = &bvh->nodes[node->first];
+    BvhNode *far  = &bvh->nodes[node->first + 1];
+    f32 t_near    = closest(intersect_node_x4(near));
+    f32 t_far     = closest(intersect_node_x4(far));
+    if (t_far < t_near) {
+      BvhNode *tmp_node = near;
+      near              = far;
+      far               = tmp_node;
+      f32 tmp_t         = t_near;
+      t_near            = t_far;
+      t_far             = tmp_t;
+    }
+
+    if (t_near == INFINITY) {
+      if (stack_size == 0) break;
+      node = &bvh->nodes[stack[--stack_size]];
+    } else {
+      node = near;
+      if (t_far != INFINITY) stack[stack_size++] = far - bvh->nodes;
+    }
+  }
+
+  f32 ts[4], us[4], vs[4];
+  store(ts, t_best);
+  store(us, best_u);
+  store(vs, best_v);
+  for (u32 l = 0; l < 4; l++) {
+    if (best_id[l] == BVH_NO_HIT) continue;
+    hits[l] = {ts[l], best_id[l], us[l], vs[l]};
+  }
+}
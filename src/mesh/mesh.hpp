@@ -0,0 +1,17 @@
+#pragma once
+
+#include "math/math.hpp"
+#include "types.hpp"
+
+struct Vertex {
+  Vec3f position;
+  Vec3f normal;
+  Vec2f uv;
+};
+
+struct StandardMesh3d {
+  Vertex *vertices  = nullptr;
+  u32 vertices_size = 0;
+  u32 *indexes      = nullptr;
+  u32 indexes_size  = 0;
+};
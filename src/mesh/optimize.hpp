@@ -0,0 +1,474 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "logging.hpp"
+#include "math/math.hpp"
+#include "memory.hpp"
+#include "mesh/mesh.hpp"
+#include "types.hpp"
+
+// Offline (import time) reordering of StandardMesh3d so the GPU does less work
+// for the same image. None of these change what gets drawn, only the order
+// vertices and triangles are stored in.
+
+const u32 INVALID_VERTEX = 0xFFFFFFFF;
+
+// post-transform cache size used when measuring, matches what most desktop
+// GPUs behave like.
+const u32 ANALYZE_CACHE_SIZE = 16;
+
+struct VertexCacheStats {
+  f32 acmr;  // average cache miss ratio, transformed vertices per triangle
+  f32 atvr;  // average transform to vertex ratio, 1.0 is optimal
+};
+
+// simulates a FIFO post-transform cache over the index buffer.
+VertexCacheStats analyze_vertex_cache(u32 *indexes, u32 indexes_size,
+                                      u32 vertices_size,
+                                      u32 cache_size = ANALYZE_CACHE_SIZE)
+{
+  VertexCacheStats stats = {0, 0};
+  if (indexes_size == 0 || vertices_size == 0) return stats;
+
+  Mem timestamps_mem = system_allocator.alloc(vertices_size * sizeof(u32));
+  u32 *timestamps    = (u32 *)timestamps_mem.data;
+  memset(timestamps, 0, vertices_size * sizeof(u32));
+
+  // a vertex is in the cache if it was inserted less than cache_size misses ago
+  u32 time   = cache_size + 1;
+  u32 misses = 0;
+  for (u32 i = 0; i < indexes_size; i++) {
+    u32 v = indexes[i];
+    if (time - timestamps[v] > cache_size) {
+      timestamps[v] = time++;
+      misses++;
+    }
+  }
+
+  system_allocator.free(timestamps_mem);
+
+  stats.acmr = (f32)misses / (indexes_size / 3);
+  stats.atvr = (f32)misses / vertices_size;
+  return stats;
+}
+
+u32 hash_vertex(const Vertex &v)
+{
+  // FNV-1a over the raw bytes, welding only merges bit-identical vertices.
+  const u8 *bytes = (const u8 *)&v;
+  u32 hash        = 2166136261;
+  for (u32 i = 0; i < sizeof(Vertex); i++) {
+    hash ^= bytes[i];
+    hash *= 16777619;
+  }
+  return hash;
+}
+
+// merges bit-identical vertices in place. assimp emits one vertex per face
+// corner for most formats, so this is usually a big win on its own.
+void weld_vertices(StandardMesh3d *mesh)
+{
+  if (mesh->vertices_size == 0) return;
+
+  u32 table_size = 1;
+  while (table_size < mesh->vertices_size * 2) table_size <<= 1;
+
+  Mem table_mem = system_allocator.alloc(table_size * sizeof(u32));
+  Mem remap_mem = system_allocator.alloc(mesh->vertices_size * sizeof(u32));
+  u32 *table    = (u32 *)table_mem.data;
+  u32 *remap    = (u32 *)remap_mem.data;
+  memset(table, 0xFF, table_size * sizeof(u32));
+
+  u32 unique_count = 0;
+  for (u32 i = 0; i < mesh->vertices_size; i++) {
+    Vertex v   = mesh->vertices[i];
+    u32 bucket = hash_vertex(v) & (table_size - 1);
+
+    while (table[bucket] != INVALID_VERTEX &&
+           memcmp(&mesh->vertices[table[bucket]], &v, sizeof(Vertex)) != 0) {
+      bucket = (bucket + 1) & (table_size - 1);
+    }
+
+    if (table[bucket] == INVALID_VERTEX) {
+      // unique_count <= i, so compacting in place never clobbers unread data
+      mesh->vertices[unique_count] = v;
+      table[bucket]                = unique_count++;
+    }
+    remap[i] = table[bucket];
+  }
+
+  for (u32 i = 0; i < mesh->indexes_size; i++) {
+    mesh->indexes[i] = remap[mesh->indexes[i]];
+  }
+  mesh->vertices_size = unique_count;
+
+  system_allocator.free(table_mem);
+  system_allocator.free(remap_mem);
+}
+
+// Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+// https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+const i32 FORSYTH_CACHE_SIZE = 32;
+
+f32 forsyth_vertex_score(i32 cache_position, u32 live_triangles)
+{
+  if (live_triangles == 0) return -1.f;
+
+  f32 score = 0.f;
+  if (cache_position >= 0) {
+    if (cache_position < 3) {
+      // the last triangle's vertices get a fixed score so we don't just
+      // keep reusing the same edge.
+      score = .75f;
+    } else {
+      f32 scaler = 1.f / (FORSYTH_CACHE_SIZE - 3);
+      score      = powf(1.f - (cache_position - 3) * scaler, 1.5f);
+    }
+  }
+
+  // bonus for vertices with few triangles left, so we finish them off
+  // instead of leaving lone triangles behind.
+  score += 2.f * powf((f32)live_triangles, -.5f);
+  return score;
+}
+
+void optimize_vertex_cache(StandardMesh3d *mesh)
+{
+  u32 triangle_count = mesh->indexes_size / 3;
+  u32 vertex_count   = mesh->vertices_size;
+  if (triangle_count == 0) return;
+
+  Mem live_mem      = system_allocator.alloc(vertex_count * sizeof(u32));
+  Mem offsets_mem   = system_allocator.alloc(vertex_count * sizeof(u32));
+  Mem adjacency_mem = system_allocator.alloc(mesh->indexes_size * sizeof(u32));
+  Mem cache_pos_mem = system_allocator.alloc(vertex_count * sizeof(i32));
+  Mem v_score_mem   = system_allocator.alloc(vertex_count * sizeof(f32));
+  Mem emitted_mem   = system_allocator.alloc(triangle_count * sizeof(b8));
+  Mem output_mem    = system_allocator.alloc(mesh->indexes_size * sizeof(u32));
+
+  u32 *live_triangles = (u32 *)live_mem.data;
+  u32 *offsets        = (u32 *)offsets_mem.data;
+  u32 *adjacency      = (u32 *)adjacency_mem.data;
+  i32 *cache_position = (i32 *)cache_pos_mem.data;
+  f32 *vertex_score   = (f32 *)v_score_mem.data;
+  b8 *emitted         = (b8 *)emitted_mem.data;
+  u32 *output         = (u32 *)output_mem.data;
+
+  // vertex -> triangle adjacency, packed into one array
+  memset(live_triangles, 0, vertex_count * sizeof(u32));
+  for (u32 i = 0; i < mesh->indexes_size; i++) {
+    live_triangles[mesh->indexes[i]]++;
+  }
+  u32 offset = 0;
+  for (u32 v = 0; v < vertex_count; v++) {
+    offsets[v] = offset;
+    offset += live_triangles[v];
+    live_triangles[v] = 0;
+  }
+  for (u32 t = 0; t < triangle_count; t++) {
+    for (u32 k = 0; k < 3; k++) {
+      u32 v = mesh->indexes[t * 3 + k];
+      adjacency[offsets[v] + live_triangles[v]++] = t;
+    }
+  }
+
+  for (u32 v = 0; v < vertex_count; v++) {
+    cache_position[v] = -1;
+    vertex_score[v]   = forsyth_vertex_score(-1, live_triangles[v]);
+  }
+  for (u32 t = 0; t < triangle_count; t++) {
+    emitted[t] = false;
+  }
+
+  u32 cache[FORSYTH_CACHE_SIZE + 3];
+  u32 cache_size = 0;
+
+  u32 output_count  = 0;
+  u32 input_cursor  = 0;
+  i64 best_triangle = -1;
+
+  while (output_count < mesh->indexes_size) {
+    if (best_triangle == -1) {
+      // nothing in the cache is connected to anything left, start a new
+      // strip from the next unemitted triangle.
+      while (emitted[input_cursor]) input_cursor++;
+      best_triangle = input_cursor;
+    }
+
+    u32 t          = best_triangle;
+    u32 *tri_verts = &mesh->indexes[t * 3];
+    emitted[t]     = true;
+
+    u32 new_cache[FORSYTH_CACHE_SIZE + 3];
+    u32 new_cache_size = 0;
+    for (u32 k = 0; k < 3; k++) {
+      u32 v                       = tri_verts[k];
+      output[output_count++]      = v;
+      new_cache[new_cache_size++] = v;
+
+      // remove this triangle from the vertex's live list
+      u32 *list = &adjacency[offsets[v]];
+      for (u32 i = 0; i < live_triangles[v]; i++) {
+        if (list[i] == t) {
+          list[i] = list[live_triangles[v] - 1];
+          break;
+        }
+      }
+      live_triangles[v]--;
+    }
+
+    for (u32 i = 0; i < cache_size; i++) {
+      u32 v = cache[i];
+      if (v != tri_verts[0] && v != tri_verts[1] && v != tri_verts[2]) {
+        new_cache[new_cache_size++] = v;
+      }
+    }
+
+    cache_size = std::min(new_cache_size, (u32)FORSYTH_CACHE_SIZE);
+    for (u32 i = 0; i < new_cache_size; i++) {
+      u32 v             = new_cache[i];
+      cache_position[v] = i < cache_size ? (i32)i : -1;
+      vertex_score[v] =
+          forsyth_vertex_score(cache_position[v], live_triangles[v]);
+      if (i < cache_size) cache[i] = v;
+    }
+
+    // only triangles touching the cache changed score
+    best_triangle  = -1;
+    f32 best_score = -1.f;
+    for (u32 i = 0; i < new_cache_size; i++) {
+      u32 v     = new_cache[i];
+      u32 *list = &adjacency[offsets[v]];
+      for (u32 j = 0; j < live_triangles[v]; j++) {
+        u32 adjacent   = list[j];
+        u32 *adj_verts = &mesh->indexes[adjacent * 3];
+        f32 score      = vertex_score[adj_verts[0]] +
+                    vertex_score[adj_verts[1]] + vertex_score[adj_verts[2]];
+
+        if (score > best_score) {
+          best_score    = score;
+          best_triangle = adjacent;
+        }
+      }
+    }
+  }
+
+  memcpy(mesh->indexes, output, mesh->indexes_size * sizeof(u32));
+
+  system_allocator.free(live_mem);
+  system_allocator.free(offsets_mem);
+  system_allocator.free(adjacency_mem);
+  system_allocator.free(cache_pos_mem);
+  system_allocator.free(v_score_mem);
+  system_allocator.free(emitted_mem);
+  system_allocator.free(output_mem);
+}
+
+// Splits the (already cache optimized) triangle order into clusters and sorts
+// them so outward facing clusters are drawn first, roughly following Sander et
+// al. "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw".
+// threshold is how much worse the ACMR is allowed to get, 1.05 = 5%.
+void optimize_overdraw(StandardMesh3d *mesh, f32 threshold = 1.05f)
+{
+  u32 triangle_count = mesh->indexes_size / 3;
+  if (triangle_count == 0) return;
+
+  Mem timestamps_mem =
+      system_allocator.alloc(mesh->vertices_size * sizeof(u32));
+  Mem clusters_mem =
+      system_allocator.alloc((triangle_count + 1) * sizeof(u32));
+  u32 *timestamps     = (u32 *)timestamps_mem.data;
+  u32 *cluster_starts = (u32 *)clusters_mem.data;
+  u32 cluster_count   = 0;
+
+  // hard boundaries: triangles where every vertex misses the cache, so
+  // starting a cluster there costs nothing extra.
+  auto simulate = [&](u32 from, u32 to, auto on_triangle) {
+    memset(timestamps, 0, mesh->vertices_size * sizeof(u32));
+    u32 time = ANALYZE_CACHE_SIZE + 1;
+    for (u32 t = from; t < to; t++) {
+      u32 misses = 0;
+      for (u32 k = 0; k < 3; k++) {
+        u32 v = mesh->indexes[t * 3 + k];
+        if (time - timestamps[v] > ANALYZE_CACHE_SIZE) {
+          timestamps[v] = time++;
+          misses++;
+        }
+      }
+      on_triangle(t, misses);
+    }
+  };
+
+  Mem hard_mem   = system_allocator.alloc((triangle_count + 1) * sizeof(u32));
+  u32 *hard      = (u32 *)hard_mem.data;
+  u32 hard_count = 0;
+  simulate(0, triangle_count, [&](u32 t, u32 misses) {
+    if (t == 0 || misses == 3) hard[hard_count++] = t;
+  });
+  hard[hard_count] = triangle_count;
+
+  // soft boundaries: split hard clusters further as long as the prefix
+  // doesn't make the ACMR worse than threshold allows.
+  for (u32 h = 0; h < hard_count; h++) {
+    u32 start = hard[h];
+    u32 end   = hard[h + 1];
+
+    u32 cluster_misses = 0;
+    simulate(start, end, [&](u32, u32 misses) { cluster_misses += misses; });
+    f32 cluster_acmr = (f32)cluster_misses / (end - start);
+
+    u32 sub_start  = start;
+    u32 sub_misses = 0;
+    cluster_starts[cluster_count++] = start;
+    simulate(start, end, [&](u32 t, u32 misses) {
+      sub_misses += misses;
+      f32 acmr = (f32)sub_misses / (t - sub_start + 1);
+      if (t + 1 < end && acmr <= cluster_acmr * threshold) {
+        sub_start  = t + 1;
+        sub_misses = 0;
+        cluster_starts[cluster_count++] = t + 1;
+        // the next sub cluster starts with a cold cache
+        memset(timestamps, 0, mesh->vertices_size * sizeof(u32));
+      }
+    });
+  }
+  cluster_starts[cluster_count] = triangle_count;
+
+  Vec3f mesh_centroid = {0, 0, 0};
+  for (u32 i = 0; i < mesh->vertices_size; i++) {
+    mesh_centroid = mesh_centroid + mesh->vertices[i].position;
+  }
+  mesh_centroid = mesh_centroid / (f32)std::max(mesh->vertices_size, 1u);
+
+  struct ClusterSort {
+    u32 cluster;
+    f32 key;
+  };
+  Mem sort_mem = system_allocator.alloc(cluster_count * sizeof(ClusterSort));
+  ClusterSort *sorts = (ClusterSort *)sort_mem.data;
+
+  for (u32 c = 0; c < cluster_count; c++) {
+    Vec3f centroid = {0, 0, 0};
+    Vec3f normal   = {0, 0, 0};
+    f32 total_area = 0.f;
+    for (u32 t = cluster_starts[c]; t < cluster_starts[c + 1]; t++) {
+      Vec3f a = mesh->vertices[mesh->indexes[t * 3 + 0]].position;
+      Vec3f b = mesh->vertices[mesh->indexes[t * 3 + 1]].position;
+      Vec3f p = mesh->vertices[mesh->indexes[t * 3 + 2]].position;
+
+      Vec3f n  = cross(b - a, p - a);
+      f32 area = n.len();
+
+      centroid = centroid + (a + b + p) * (area / 3.f);
+      normal   = normal + n;
+      total_area += area;
+    }
+
+    f32 key = 0.f;
+    if (total_area > 0.f && normal.len() > 0.f) {
+      centroid = centroid / total_area;
+      key      = dot(centroid - mesh_centroid, normalize(normal));
+    }
+    sorts[c] = {c, key};
+  }
+
+  // most outward facing first, these are the likeliest occluders
+  std::stable_sort(sorts, sorts + cluster_count,
+                   [](const ClusterSort &a, const ClusterSort &b) {
+                     return a.key > b.key;
+                   });
+
+  Mem output_mem = system_allocator.alloc(mesh->indexes_size * sizeof(u32));
+  u32 *output    = (u32 *)output_mem.data;
+  u32 out_count  = 0;
+  for (u32 i = 0; i < cluster_count; i++) {
+    u32 c     = sorts[i].cluster;
+    u32 count = (cluster_starts[c + 1] - cluster_starts[c]) * 3;
+    memcpy(output + out_count, mesh->indexes + cluster_starts[c] * 3,
+           count * sizeof(u32));
+    out_count += count;
+  }
+  memcpy(mesh->indexes, output, mesh->indexes_size * sizeof(u32));
+
+  system_allocator.free(output_mem);
+  system_allocator.free(sort_mem);
+  system_allocator.free(hard_mem);
+  system_allocator.free(clusters_mem);
+  system_allocator.free(timestamps_mem);
+}
+
+// reorders vertices into the order the index buffer first references them so
+// vertex fetch walks memory linearly. unreferenced vertices are dropped.
+void optimize_vertex_fetch(StandardMesh3d *mesh)
+{
+  if (mesh->vertices_size == 0) return;
+
+  Mem remap_mem = system_allocator.alloc(mesh->vertices_size * sizeof(u32));
+  Mem vertices_mem =
+      system_allocator.alloc(mesh->vertices_size * sizeof(Vertex));
+  u32 *remap       = (u32 *)remap_mem.data;
+  Vertex *original = (Vertex *)vertices_mem.data;
+  memset(remap, 0xFF, mesh->vertices_size * sizeof(u32));
+  memcpy(original, mesh->vertices, mesh->vertices_size * sizeof(Vertex));
+
+  u32 next_vertex = 0;
+  for (u32 i = 0; i < mesh->indexes_size; i++) {
+    u32 v = mesh->indexes[i];
+    if (remap[v] == INVALID_VERTEX) {
+      remap[v]                    = next_vertex;
+      mesh->vertices[next_vertex] = original[v];
+      next_vertex++;
+    }
+    mesh->indexes[i] = remap[v];
+  }
+  mesh->vertices_size = next_vertex;
+
+  system_allocator.free(remap_mem);
+  system_allocator.free(vertices_mem);
+}
+
+struct MeshOptimizationStats {
+  u32 triangles_size;
+  u32 vertices_before;
+  u32 vertices_after;
+  VertexCacheStats before;
+  VertexCacheStats after;
+};
+
+void report_mesh_optimization(MeshOptimizationStats stats)
+{
+  info("mesh optimized: ", stats.triangles_size, " triangles, vertices ",
+       stats.vertices_before, " -> ", stats.vertices_after, ", ACMR ",
+       stats.before.acmr, " -> ", stats.after.acmr, ", ATVR ",
+       stats.before.atvr, " -> ", stats.after.atvr);
+}
+
+// the whole import-time pipeline. order matters: overdraw works on the
+// clusters the cache pass leaves behind, and fetch has to go last since it
+// follows the final index order.
+//
+// nothing is logged, so it can run on worker threads. pass the stats to
+// report_mesh_optimization.
+MeshOptimizationStats optimize_mesh(StandardMesh3d *mesh)
+{
+  MeshOptimizationStats stats;
+  stats.vertices_before = mesh->vertices_size;
+  stats.before          = analyze_vertex_cache(mesh->indexes,
+                                               mesh->indexes_size,
+                                               mesh->vertices_size);
+
+  weld_vertices(mesh);
+  optimize_vertex_cache(mesh);
+  optimize_overdraw(mesh);
+  optimize_vertex_fetch(mesh);
+
+  stats.triangles_size = mesh->indexes_size / 3;
+  stats.vertices_after = mesh->vertices_size;
+  stats.after          = analyze_vertex_cache(mesh->indexes,
+                                              mesh->indexes_size,
+                                              mesh->vertices_size);
+  return stats;
+}
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <cmath>
+
+#include "logging.hpp"
+#include "math/math.hpp"
+#include "math/simd.hpp"
+#include "memory.hpp"
+#include "mesh/mesh.hpp"
+#include "types.hpp"
+
+// Compact 16 byte vertex, half the size of Vertex.
+//   position: unorm16 relative to the mesh AABB, w is padding so the
+//             attribute stays 8 byte aligned (ushort4 / R16G16B16A16_UNORM)
+//   normal:   octahedral encoding in snorm16 (short2 / R16G16_SNORM)
+//   uv:       half floats (half2 / R16G16_SFLOAT)
+// Positions decode as aabb_min + unorm * aabb_extent, which is usually folded
+// into the model matrix.
+struct PackedVertex {
+  u16 position[4];
+  i16 normal[2];
+  u16 uv[2];
+};
+static_assert(sizeof(PackedVertex) == 16);
+
+struct PackedMesh3d {
+  PackedVertex *vertices = nullptr;
+  u32 vertices_size      = 0;
+  u32 *indexes           = nullptr;
+  u32 indexes_size       = 0;
+
+  Vec3f aabb_min    = {};
+  Vec3f aabb_extent = {};
+};
+
+struct QuantizationErrorStats {
+  f32 max_position_error  = 0;  // in mesh units
+  f32 mean_position_error = 0;
+  f32 max_normal_error    = 0;  // in degrees
+  f32 max_uv_error        = 0;
+};
+
+// Encodes 4 vertices at once. Everything is transposed into lanes first, so
+// the kernels are the same for SSE, NEON and scalar.
+void pack_vertices_x4(const Vertex *in, PackedVertex *out, Vec3f aabb_min,
+                      Vec3f inv_extent)
+{
+  F32x4 px = f32x4(in[0].position.x, in[1].position.x, in[2].position.x,
+                   in[3].position.x);
+  F32x4 py = f32x4(in[0].position.y, in[1].position.y, in[2].position.y,
+                   in[3].position.y);
+  F32x4 pz = f32x4(in[0].position.z, in[1].position.z, in[2].position.z,
+                   in[3].position.z);
+  F32x4 nx = f32x4(in[0].normal.x, in[1].normal.x, in[2].normal.x,
+                   in[3].normal.x);
+  F32x4 ny = f32x4(in[0].normal.y, in[1].normal.y, in[2].normal.y,
+                   in[3].normal.y);
+  F32x4 nz = f32x4(in[0].normal.z, in[1].normal.z, in[2].normal.z,
+                   in[3].normal.z);
+  F32x4 u  = f32x4(in[0].uv.x, in[1].uv.x, in[2].uv.x, in[3].uv.x);
+  F32x4 v  = f32x4(in[0].uv.y, in[1].uv.y, in[2].uv.y, in[3].uv.y);
+
+  F32x4 zero = f32x4(0.f);
+  F32x4 one  = f32x4(1.f);
+
+  F32x4 unorm_scale = f32x4(65535.f);
+  I32x4 qx          = round_to_i32(
+      clamp((px - f32x4(aabb_min.x)) * f32x4(inv_extent.x), zero, one) *
+      unorm_scale);
+  I32x4 qy = round_to_i32(
+      clamp((py - f32x4(aabb_min.y)) * f32x4(inv_extent.y), zero, one) *
+      unorm_scale);
+  I32x4 qz = round_to_i32(
+      clamp((pz - f32x4(aabb_min.z)) * f32x4(inv_extent.z), zero, one) *
+      unorm_scale);
+
+  // octahedral: project onto |x|+|y|+|z| = 1, then fold the lower hemisphere
+  // over the diagonals.
+  F32x4 l1 = max(abs(nx) + abs(ny) + abs(nz), f32x4(1e-20f));
+  F32x4 ox = nx / l1;
+  F32x4 oy = ny / l1;
+
+  F32x4 sign_x      = select(ox >= zero, one, f32x4(-1.f));
+  F32x4 sign_y      = select(oy >= zero, one, f32x4(-1.f));
+  F32x4 folded_x    = (one - abs(oy)) * sign_x;
+  F32x4 folded_y    = (one - abs(ox)) * sign_y;
+  F32x4 lower       = nz < zero;
+  ox                = select(lower, folded_x, ox);
+  oy                = select(lower, folded_y, oy);
+  F32x4 snorm_scale = f32x4(32767.f);
+  I32x4 qnx = round_to_i32(clamp(ox, f32x4(-1.f), one) * snorm_scale);
+  I32x4 qny = round_to_i32(clamp(oy, f32x4(-1.f), one) * snorm_scale);
+
+  i32 lanes[5][4];
+  store(lanes[0], qx);
+  store(lanes[1], qy);
+  store(lanes[2], qz);
+  store(lanes[3], qnx);
+  store(lanes[4], qny);
+  u16 hu[4], hv[4];
+  f32x4_to_f16(u, hu);
+  f32x4_to_f16(v, hv);
+
+  for (i32 i = 0; i < 4; i++) {
+    out[i].position[0] = lanes[0][i];
+    out[i].position[1] = lanes[1][i];
+    out[i].position[2] = lanes[2][i];
+    out[i].position[3] = 0;
+    out[i].normal[0]   = lanes[3][i];
+    out[i].normal[1]   = lanes[4][i];
+    out[i].uv[0]       = hu[i];
+    out[i].uv[1]       = hv[i];
+  }
+}
+
+Vec3f decode_octahedral(i16 x, i16 y)
+{
+  Vec3f n = {fmaxf(x / 32767.f, -1.f), fmaxf(y / 32767.f, -1.f), 0};
+  n.z     = 1.f - fabsf(n.x) - fabsf(n.y);
+  if (n.z < 0) {
+    f32 fx = (1.f - fabsf(n.y)) * (n.x >= 0 ? 1.f : -1.f);
+    f32 fy = (1.f - fabsf(n.x)) * (n.y >= 0 ? 1.f : -1.f);
+    n.x    = fx;
+    n.y    = fy;
+  }
+  return normalize(n);
+}
+
+Vertex unpack_vertex(PackedMesh3d *mesh, PackedVertex packed)
+{
+  Vertex v;
+  v.position.x =
+      mesh->aabb_min.x + packed.position[0] / 65535.f * mesh->aabb_extent.x;
+  v.position.y =
+      mesh->aabb_min.y + packed.position[1] / 65535.f * mesh->aabb_extent.y;
+  v.position.z =
+      mesh->aabb_min.z + packed.position[2] / 65535.f * mesh->aabb_extent.z;
+  v.normal = decode_octahedral(packed.normal[0], packed.normal[1]);
+  v.uv     = {f16_to_f32(packed.uv[0]), f16_to_f32(packed.uv[1])};
+  return v;
+}
+
+QuantizationErrorStats measure_quantization_error(StandardMesh3d *original,
+                                                  PackedMesh3d *packed)
+{
+  QuantizationErrorStats stats;
+  if (original->vertices_size == 0) return stats;
+
+  f64 position_error_sum = 0;
+  f32 min_normal_cos     = 1.f;
+  for (u32 i = 0; i < original->vertices_size; i++) {
+    Vertex a = original->vertices[i];
+    Vertex b = unpack_vertex(packed, packed->vertices[i]);
+
+    f32 position_error = (a.position - b.position).len();
+    position_error_sum += position_error;
+    stats.max_position_error = fmaxf(stats.max_position_error, position_error);
+
+    // zero length normals can't round trip, don't count them.
+    if (a.normal.len() > 0.f) {
+      f32 cos_angle  = dot(normalize(a.normal), b.normal);
+      min_normal_cos = fminf(min_normal_cos, cos_angle);
+    }
+
+    stats.max_uv_error = fmaxf(stats.max_uv_error, fabsf(a.uv.x - b.uv.x));
+    stats.max_uv_error = fmaxf(stats.max_uv_error, fabsf(a.uv.y - b.uv.y));
+  }
+  stats.mean_position_error = position_error_sum / original->vertices_size;
+  stats.max_normal_error =
+      acosf(fminf(fmaxf(min_normal_cos, -1.f), 1.f)) * 180.f / 3.14159265f;
+
+  return stats;
+}
+
+// Packs into vertices, which holds mesh->vertices_size of them. Indexes are
+// shared with the source mesh.
+PackedMesh3d pack_mesh(StandardMesh3d *mesh, PackedVertex *vertices)
+{
+  PackedMesh3d packed;
+  packed.vertices      = vertices;
+  packed.indexes       = mesh->indexes;
+  packed.indexes_size  = mesh->indexes_size;
+  packed.vertices_size = mesh->vertices_size;
+  if (mesh->vertices_size == 0) return packed;
+
+  Vec3f aabb_min = mesh->vertices[0].position;
+  Vec3f aabb_max = mesh->vertices[0].position;
+  for (u32 i = 1; i < mesh->vertices_size; i++) {
+    aabb_min = min(aabb_min, mesh->vertices[i].position);
+    aabb_max = max(aabb_max, mesh->vertices[i].position);
+  }
+  packed.aabb_min    = aabb_min;
+  packed.aabb_extent = aabb_max - aabb_min;
+
+  // flat axes would divide by zero, everything on them quantizes to 0.
+  Vec3f inv_extent = {
+      packed.aabb_extent.x > 0.f ? 1.f / packed.aabb_extent.x : 0.f,
+      packed.aabb_extent.y > 0.f ? 1.f / packed.aabb_extent.y : 0.f,
+      packed.aabb_extent.z > 0.f ? 1.f / packed.aabb_extent.z : 0.f,
+  };
+
+  u32 i = 0;
+  for (; i + 4 <= mesh->vertices_size; i += 4) {
+    pack_vertices_x4(&mesh->vertices[i], &packed.vertices[i], aabb_min,
+                     inv_extent);
+  }
+  if (i < mesh->vertices_size) {
+    // pad the tail by repeating the last vertex and only keep what we need.
+    Vertex tail_in[4];
+    PackedVertex tail_out[4];
+    for (u32 j = 0; j < 4; j++) {
+      u32 last   = mesh->vertices_size - 1;
+      tail_in[j] = mesh->vertices[i + j < last ? i + j : last];
+    }
+    pack_vertices_x4(tail_in, tail_out, aabb_min, inv_extent);
+    for (u32 j = 0; i + j < mesh->vertices_size; j++) {
+      packed.vertices[i + j] = tail_out[j];
+    }
+  }
+
+  return packed;
+}
+
+// Indexes are shared with the source mesh, only the vertices are allocated.
+PackedMesh3d pack_mesh(StandardMesh3d *mesh, Allocator *allocator)
+{
+  PackedVertex *vertices =
+      (PackedVertex *)allocator
+          ->alloc(mesh->vertices_size * sizeof(PackedVertex))
+          .data;
+  PackedMesh3d packed = pack_mesh(mesh, vertices);
+
+  QuantizationErrorStats stats = measure_quantization_error(mesh, &packed);
+  info("mesh packed: ", packed.vertices_size, " vertices, ",
+       mesh->vertices_size * sizeof(Vertex), " -> ",
+       packed.vertices_size * sizeof(PackedVertex),
+       " bytes, position error max ", stats.max_position_error, " mean ",
+       stats.mean_position_error, ", normal error max ",
+       stats.max_normal_error, " deg, uv error max ", stats.max_uv_error);
+
+  return packed;
+}
@@ -0,0 +1,469 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "logging.hpp"
+#include "math/math.hpp"
+#include "memory.hpp"
+#include "mesh/mesh.hpp"
+#include "mesh/optimize.hpp"
+#include "types.hpp"
+
+// Edge collapse simplification driven by quadric error metrics (Garland and
+// Heckbert, "Surface Simplification Using Quadric Error Metrics").
+//
+// Vertices are never moved or created, a collapse just redirects one vertex
+// onto a neighbor. That means every LOD can share the original vertex buffer
+// and only needs its own range of indexes.
+//
+// Vertices are classified by position, not by index:
+//   manifold: interior vertex, can collapse onto any neighbor
+//   border:   on an open edge, can only slide along its border
+//   locked:   UV/normal seams (several vertices at one position) and border
+//             corners, never collapse so seams and outlines stay intact
+
+// sum of squared distances to a set of planes, as x^T A x + 2 b.x + c with A
+// symmetric.
+struct Quadric {
+  f64 a00, a11, a22, a01, a02, a12;
+  f64 b0, b1, b2;
+  f64 c;
+  f64 weight;
+};
+
+// border edges get an extra plane perpendicular to the surface, weighted well
+// above the surface planes so outlines stay put.
+const f32 BORDER_QUADRIC_WEIGHT = 10.f;
+
+// a collapse may not turn a triangle by more than ~75 degrees, anything more
+// is close enough to a fold over to show up as a crease.
+const f32 MAX_COLLAPSE_ROTATION_COS = .25f;
+
+Quadric plane_quadric(Vec3f n, f32 d, f32 weight)
+{
+  Quadric q;
+  q.a00    = weight * n.x * n.x;
+  q.a11    = weight * n.y * n.y;
+  q.a22    = weight * n.z * n.z;
+  q.a01    = weight * n.x * n.y;
+  q.a02    = weight * n.x * n.z;
+  q.a12    = weight * n.y * n.z;
+  q.b0     = weight * n.x * d;
+  q.b1     = weight * n.y * d;
+  q.b2     = weight * n.z * d;
+  q.c      = weight * d * d;
+  q.weight = weight;
+  return q;
+}
+
+void add_quadric(Quadric *a, Quadric b)
+{
+  a->a00 += b.a00;
+  a->a11 += b.a11;
+  a->a22 += b.a22;
+  a->a01 += b.a01;
+  a->a02 += b.a02;
+  a->a12 += b.a12;
+  a->b0 += b.b0;
+  a->b1 += b.b1;
+  a->b2 += b.b2;
+  a->c += b.c;
+  a->weight += b.weight;
+}
+
+// weighted mean squared distance from p to the planes
+f64 quadric_error(Quadric q, Vec3f p)
+{
+  f64 x = p.x, y = p.y, z = p.z;
+  f64 error = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z +
+              2 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z) +
+              2 * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+  if (error < 0 || q.weight <= 0) return 0;
+  return error / q.weight;
+}
+
+enum struct VertexKind : u8 {
+  MANIFOLD,
+  BORDER,
+  LOCKED,
+};
+
+struct CollapseCandidate {
+  u32 from;
+  u32 to;
+  f32 error;
+};
+
+u32 hash_position(Vec3f p)
+{
+  const u8 *bytes = (const u8 *)&p;
+  u32 hash        = 2166136261;
+  for (u32 i = 0; i < sizeof(Vec3f); i++) {
+    hash ^= bytes[i];
+    hash *= 16777619;
+  }
+  return hash;
+}
+
+b8 contains(u32 *list, u32 size, u32 value)
+{
+  for (u32 i = 0; i < size; i++) {
+    if (list[i] == value) return true;
+  }
+  return false;
+}
+
+// Simplifies towards target_indexes_size, writing to out_indexes which needs
+// room for indexes_size. Returns the new index count, which can stay above the
+// target if everything left is locked or would flip. out_error gets the
+// largest collapse error as a distance in mesh units.
+u32 simplify_mesh(u32 *indexes, u32 indexes_size, Vertex *vertices,
+                  u32 vertices_size, u32 target_indexes_size,
+                  u32 *out_indexes, f32 *out_error)
+{
+  memcpy(out_indexes, indexes, indexes_size * sizeof(u32));
+  *out_error = 0;
+  if (indexes_size <= target_indexes_size || vertices_size == 0) {
+    return indexes_size;
+  }
+
+  u64 per_vertex = vertices_size * sizeof(u32);
+  Mem position_id_mem = system_allocator.alloc(per_vertex);
+  Mem wedges_mem      = system_allocator.alloc(per_vertex);
+  Mem border_next_mem = system_allocator.alloc(per_vertex);
+  Mem border_prev_mem = system_allocator.alloc(per_vertex);
+  Mem border_in_mem   = system_allocator.alloc(per_vertex);
+  Mem border_out_mem  = system_allocator.alloc(per_vertex);
+  Mem collapse_mem    = system_allocator.alloc(per_vertex);
+  Mem offsets_mem     = system_allocator.alloc(per_vertex + sizeof(u32));
+  Mem adjacency_mem   = system_allocator.alloc(indexes_size * sizeof(u32));
+  Mem kind_mem = system_allocator.alloc(vertices_size * sizeof(VertexKind));
+  Mem quadric_mem = system_allocator.alloc(vertices_size * sizeof(Quadric));
+  Mem touched_mem = system_allocator.alloc(vertices_size * sizeof(b8));
+  Mem candidates_mem =
+      system_allocator.alloc(indexes_size * 2 * sizeof(CollapseCandidate));
+
+  u32 *position_id              = (u32 *)position_id_mem.data;
+  u32 *wedges                   = (u32 *)wedges_mem.data;
+  u32 *border_next              = (u32 *)border_next_mem.data;
+  u32 *border_prev              = (u32 *)border_prev_mem.data;
+  u32 *border_in                = (u32 *)border_in_mem.data;
+  u32 *border_out               = (u32 *)border_out_mem.data;
+  u32 *collapse                 = (u32 *)collapse_mem.data;
+  u32 *offsets                  = (u32 *)offsets_mem.data;
+  u32 *adjacency                = (u32 *)adjacency_mem.data;
+  VertexKind *kind              = (VertexKind *)kind_mem.data;
+  Quadric *quadrics             = (Quadric *)quadric_mem.data;
+  b8 *touched                   = (b8 *)touched_mem.data;
+  CollapseCandidate *candidates = (CollapseCandidate *)candidates_mem.data;
+
+  // position_id maps every vertex to the first vertex sharing its position.
+  {
+    u32 table_size = 1;
+    while (table_size < vertices_size * 2) table_size <<= 1;
+    Mem table_mem = system_allocator.alloc(table_size * sizeof(u32));
+    u32 *table    = (u32 *)table_mem.data;
+    memset(table, 0xFF, table_size * sizeof(u32));
+
+    for (u32 i = 0; i < vertices_size; i++) {
+      Vec3f p    = vertices[i].position;
+      u32 bucket = hash_position(p) & (table_size - 1);
+      while (table[bucket] != INVALID_VERTEX &&
+             memcmp(&vertices[table[bucket]].position, &p, sizeof(Vec3f))) {
+        bucket = (bucket + 1) & (table_size - 1);
+      }
+      if (table[bucket] == INVALID_VERTEX) table[bucket] = i;
+      position_id[i] = table[bucket];
+    }
+
+    system_allocator.free(table_mem);
+  }
+
+  memset(wedges, 0, vertices_size * sizeof(u32));
+  for (u32 i = 0; i < vertices_size; i++) wedges[position_id[i]]++;
+
+  // outgoing edges per position, an edge a->b is on the border if no triangle
+  // has b->a.
+  memset(offsets, 0, (vertices_size + 1) * sizeof(u32));
+  for (u32 i = 0; i < indexes_size; i++) offsets[position_id[indexes[i]]]++;
+  for (u32 i = 0, sum = 0; i <= vertices_size; i++) {
+    u32 count  = i < vertices_size ? offsets[i] : 0;
+    offsets[i] = sum;
+    sum += count;
+  }
+  for (u32 i = 0; i < indexes_size; i++) {
+    u32 a                   = position_id[indexes[i]];
+    u32 b                   = position_id[indexes[i - i % 3 + (i + 1) % 3]];
+    adjacency[offsets[a]++] = b;
+  }
+  for (u32 i = vertices_size; i > 0; i--) offsets[i] = offsets[i - 1];
+  offsets[0] = 0;
+
+  memset(border_in, 0, vertices_size * sizeof(u32));
+  memset(border_out, 0, vertices_size * sizeof(u32));
+  memset(quadrics, 0, vertices_size * sizeof(Quadric));
+  for (u32 t = 0; t < indexes_size; t += 3) {
+    u32 p[3]  = {position_id[indexes[t + 0]], position_id[indexes[t + 1]],
+                 position_id[indexes[t + 2]]};
+    Vec3f v0  = vertices[p[0]].position;
+    Vec3f v1  = vertices[p[1]].position;
+    Vec3f v2  = vertices[p[2]].position;
+    Vec3f n   = cross(v1 - v0, v2 - v0);
+    f32 n_len = n.len();
+    if (n_len == 0.f) continue;
+    n = n / n_len;
+
+    Quadric q = plane_quadric(n, -dot(n, v0), n_len * .5f);
+    for (u32 k = 0; k < 3; k++) add_quadric(&quadrics[p[k]], q);
+
+    for (u32 k = 0; k < 3; k++) {
+      u32 a = p[k];
+      u32 b = p[(k + 1) % 3];
+      if (contains(&adjacency[offsets[b]], offsets[b + 1] - offsets[b], a)) {
+        continue;
+      }
+
+      border_out[a]++;
+      border_in[b]++;
+      border_next[a] = b;
+      border_prev[b] = a;
+
+      Vec3f pa     = vertices[a].position;
+      Vec3f edge   = vertices[b].position - pa;
+      f32 edge_len = edge.len();
+      if (edge_len == 0.f) continue;
+      Vec3f m          = normalize(cross(edge, n));
+      f32 weight       = edge_len * edge_len * BORDER_QUADRIC_WEIGHT;
+      Quadric border_q = plane_quadric(m, -dot(m, pa), weight);
+      add_quadric(&quadrics[a], border_q);
+      add_quadric(&quadrics[b], border_q);
+    }
+  }
+
+  for (u32 i = 0; i < vertices_size; i++) {
+    u32 p = position_id[i];
+    if (wedges[p] > 1) {
+      kind[i] = VertexKind::LOCKED;
+    } else if (border_in[p] == 0 && border_out[p] == 0) {
+      kind[i] = VertexKind::MANIFOLD;
+    } else if (border_in[p] == 1 && border_out[p] == 1) {
+      kind[i] = VertexKind::BORDER;
+    } else {
+      kind[i] = VertexKind::LOCKED;
+    }
+  }
+
+  u32 index_count  = indexes_size;
+  f64 result_error = 0;
+  while (index_count > target_indexes_size) {
+    // triangles around each vertex on the current index buffer. vertices that
+    // can collapse only have one wedge, so actual indexes are enough.
+    memset(offsets, 0, (vertices_size + 1) * sizeof(u32));
+    for (u32 i = 0; i < index_count; i++) offsets[out_indexes[i]]++;
+    for (u32 i = 0, sum = 0; i <= vertices_size; i++) {
+      u32 count  = i < vertices_size ? offsets[i] : 0;
+      offsets[i] = sum;
+      sum += count;
+    }
+    for (u32 i = 0; i < index_count; i++) {
+      adjacency[offsets[out_indexes[i]]++] = i / 3;
+    }
+    for (u32 i = vertices_size; i > 0; i--) offsets[i] = offsets[i - 1];
+    offsets[0] = 0;
+
+    u32 candidates_size = 0;
+    for (u32 i = 0; i < index_count; i++) {
+      u32 a = out_indexes[i];
+      u32 b = out_indexes[i - i % 3 + (i + 1) % 3];
+      for (u32 dir = 0; dir < 2; dir++) {
+        u32 from = dir ? b : a;
+        u32 to   = dir ? a : b;
+        if (kind[from] == VertexKind::LOCKED) continue;
+        if (kind[from] == VertexKind::BORDER &&
+            position_id[to] != border_next[from] &&
+            position_id[to] != border_prev[from]) {
+          continue;
+        }
+
+        Quadric q = quadrics[from];
+        add_quadric(&q, quadrics[position_id[to]]);
+        candidates[candidates_size++] = {
+            from, to, (f32)quadric_error(q, vertices[to].position)};
+      }
+    }
+    std::sort(candidates, candidates + candidates_size,
+              [](const CollapseCandidate &a, const CollapseCandidate &b) {
+                return a.error < b.error;
+              });
+
+    for (u32 i = 0; i < vertices_size; i++) collapse[i] = i;
+    memset(touched, 0, vertices_size * sizeof(b8));
+
+    u32 triangles_goal    = (index_count - target_indexes_size) / 3;
+    u32 triangles_removed = 0;
+    u32 collapses         = 0;
+    for (u32 c = 0; c < candidates_size; c++) {
+      CollapseCandidate candidate = candidates[c];
+      u32 from                    = candidate.from;
+      u32 to                      = candidate.to;
+      if (touched[position_id[from]] || touched[position_id[to]]) continue;
+
+      // reject collapses that flip, or nearly flip, any remaining triangle
+      // around from.
+      Vec3f target = vertices[to].position;
+      b8 flips     = false;
+      for (u32 j = offsets[from]; j < offsets[from + 1] && !flips; j++) {
+        u32 *tri = &out_indexes[adjacency[j] * 3];
+        if (position_id[tri[0]] == position_id[to] ||
+            position_id[tri[1]] == position_id[to] ||
+            position_id[tri[2]] == position_id[to]) {
+          continue;
+        }
+
+        Vec3f p[3];
+        Vec3f moved[3];
+        for (u32 k = 0; k < 3; k++) {
+          p[k]     = vertices[tri[k]].position;
+          moved[k] = tri[k] == from ? target : p[k];
+        }
+        Vec3f before = cross(p[1] - p[0], p[2] - p[0]);
+        Vec3f after  = cross(moved[1] - moved[0], moved[2] - moved[0]);
+        flips        = dot(before, after) <=
+                MAX_COLLAPSE_ROTATION_COS * before.len() * after.len();
+      }
+      if (flips) continue;
+
+      // lock the whole one-ring so no other collapse this pass changes the
+      // triangles we just checked.
+      for (u32 j = offsets[from]; j < offsets[from + 1]; j++) {
+        u32 *tri                     = &out_indexes[adjacency[j] * 3];
+        touched[position_id[tri[0]]] = true;
+        touched[position_id[tri[1]]] = true;
+        touched[position_id[tri[2]]] = true;
+      }
+      touched[position_id[to]] = true;
+
+      collapse[from] = to;
+      add_quadric(&quadrics[position_id[to]], quadrics[from]);
+      if (candidate.error > result_error) result_error = candidate.error;
+
+      if (kind[from] == VertexKind::BORDER) {
+        u32 to_p = position_id[to];
+        if (to_p == border_next[from]) {
+          border_next[border_prev[from]] = to_p;
+          border_prev[to_p]              = border_prev[from];
+        } else {
+          border_prev[border_next[from]] = to_p;
+          border_next[to_p]              = border_next[from];
+        }
+        triangles_removed += 1;
+      } else {
+        triangles_removed += 2;
+      }
+
+      collapses++;
+      if (triangles_removed >= triangles_goal) break;
+    }
+    if (collapses == 0) break;
+
+    u32 write = 0;
+    for (u32 t = 0; t < index_count; t += 3) {
+      u32 a = collapse[out_indexes[t + 0]];
+      u32 b = collapse[out_indexes[t + 1]];
+      u32 c = collapse[out_indexes[t + 2]];
+      if (position_id[a] == position_id[b] ||
+          position_id[b] == position_id[c] ||
+          position_id[c] == position_id[a]) {
+        continue;
+      }
+      out_indexes[write++] = a;
+      out_indexes[write++] = b;
+      out_indexes[write++] = c;
+    }
+    index_count = write;
+  }
+
+  system_allocator.free(position_id_mem);
+  system_allocator.free(wedges_mem);
+  system_allocator.free(kind_mem);
+  system_allocator.free(quadric_mem);
+  system_allocator.free(border_next_mem);
+  system_allocator.free(border_prev_mem);
+  system_allocator.free(border_in_mem);
+  system_allocator.free(border_out_mem);
+  system_allocator.free(offsets_mem);
+  system_allocator.free(adjacency_mem);
+  system_allocator.free(collapse_mem);
+  system_allocator.free(touched_mem);
+  system_allocator.free(candidates_mem);
+
+  *out_error = sqrtf(result_error);
+  return index_count;
+}
+
+const u32 MAX_LODS = 8;
+
+struct MeshLod {
+  u32 index_offset;
+  u32 indexes_size;
+  f32 error;  // max distance from the full mesh, in mesh units
+};
+
+// All lods index into the source mesh's vertex buffer, their indexes are
+// packed back to back in one buffer so they can be uploaded together.
+struct MeshLodChain {
+  u32 *indexes     = nullptr;
+  u32 indexes_size = 0;
+
+  MeshLod lods[MAX_LODS];
+  u32 lods_size = 0;
+};
+
+// lod 0 is the mesh itself, lod i targets ratio^i of its triangles and is
+// simplified from lod i - 1. The chain ends early once a step stops paying
+// off, usually because what's left is locked by seams.
+MeshLodChain generate_lods(StandardMesh3d *mesh, Allocator *allocator,
+                           f32 ratio = .5f, u32 max_lods = MAX_LODS)
+{
+  MeshLodChain chain;
+  if (max_lods > MAX_LODS) max_lods = MAX_LODS;
+
+  Mem scratch_mem =
+      system_allocator.alloc(mesh->indexes_size * max_lods * sizeof(u32));
+  u32 *scratch = (u32 *)scratch_mem.data;
+
+  memcpy(scratch, mesh->indexes, mesh->indexes_size * sizeof(u32));
+  chain.lods[chain.lods_size++] = {0, mesh->indexes_size, 0.f};
+  u32 used                      = mesh->indexes_size;
+
+  while (chain.lods_size < max_lods) {
+    MeshLod prev    = chain.lods[chain.lods_size - 1];
+    f32 target_tris = (mesh->indexes_size / 3) * powf(ratio, chain.lods_size);
+    u32 target      = (u32)target_tris * 3;
+    if (target < 3) break;
+
+    f32 error;
+    u32 size = simplify_mesh(&scratch[prev.index_offset], prev.indexes_size,
+                             mesh->vertices, mesh->vertices_size, target,
+                             &scratch[used], &error);
+    if (size == 0 || size > prev.indexes_size * .9f) break;
+
+    // errors are measured against the previous lod, so they add up.
+    chain.lods[chain.lods_size++] = {used, size, prev.error + error};
+    used += size;
+  }
+
+  chain.indexes_size = used;
+  chain.indexes = (u32 *)allocator->alloc(used * sizeof(u32)).data;
+  memcpy(chain.indexes, scratch, used * sizeof(u32));
+  system_allocator.free(scratch_mem);
+
+  for (u32 i = 0; i < chain.lods_size; i++) {
+    info("lod ", i, ": ", chain.lods[i].indexes_size / 3, " triangles, error ",
+         chain.lods[i].error);
+  }
+
+  return chain;
+}
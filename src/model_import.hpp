@@ -10,22 +10,186 @@
 #include "logging.hpp"
 #include "math/math.hpp"
 #include "memory.hpp"
+#include "mesh/mesh.hpp"
+#include "mesh/optimize.hpp"
+#include "mesh/quantize.hpp"
+#include "parallel.hpp"
 #include "string.hpp"
 
-struct Vertex {
-  Vec3f position;
-  Vec3f normal;
-  Vec2f uv;
+// One aiMesh worth of data inside the scene's shared buffers. Indexes are
+// relative to vertex_offset, so draw with it as the base vertex.
+struct SceneMesh {
+  u32 vertex_offset = 0;
+  u32 vertices_size = 0;
+  u32 index_offset  = 0;
+  u32 indexes_size  = 0;
+
+  // what the mesh's packed positions are relative to, see PackedVertex.
+  Vec3f aabb_min    = {};
+  Vec3f aabb_extent = {};
+};
+
+// A node in the flattened hierarchy referencing a mesh. The same mesh can be
+// instanced by several nodes.
+struct MeshInstance {
+  u32 mesh_idx;
+  Mat4f transform;
 };
 
-struct StandardMesh3d {
+struct ImportSettings {
+  // also encode the vertices as PackedVertex into Scene3d::packed_vertices.
+  b8 pack_vertices = false;
+};
+
+struct Scene3d {
   Vertex *vertices  = nullptr;
   u32 vertices_size = 0;
   u32 *indexes      = nullptr;
   u32 indexes_size  = 0;
+
+  // vertices_size of them, only with ImportSettings::pack_vertices.
+  PackedVertex *packed_vertices = nullptr;
+
+  SceneMesh *meshes = nullptr;
+  u32 meshes_size   = 0;
+
+  MeshInstance *instances = nullptr;
+  u32 instances_size      = 0;
+
+  Mem arena = {};
 };
 
-StandardMesh3d load_mesh(String filename, StackAllocator *allocator)
+void free_scene(Scene3d *scene)
+{
+  if (scene->arena.data) scene->arena.allocator->free(scene->arena);
+  *scene = {};
+}
+
+Mat4f to_mat4f(aiMatrix4x4 m)
+{
+  // assimp is row major, ours is indexed [column][row]
+  Mat4f out;
+  for (i32 row = 0; row < 4; row++) {
+    for (i32 col = 0; col < 4; col++) {
+      out[col][row] = m[row][col];
+    }
+  }
+  return out;
+}
+
+u32 count_mesh_instances(aiNode *node)
+{
+  u32 count = node->mNumMeshes;
+  for (u32 i = 0; i < node->mNumChildren; i++) {
+    count += count_mesh_instances(node->mChildren[i]);
+  }
+  return count;
+}
+
+void flatten_nodes(aiNode *node, aiMatrix4x4 parent_transform,
+                   MeshInstance *instances, u32 *instances_size)
+{
+  aiMatrix4x4 transform = parent_transform * node->mTransformation;
+  for (u32 i = 0; i < node->mNumMeshes; i++) {
+    instances[(*instances_size)++] = {node->mMeshes[i], to_mat4f(transform)};
+  }
+  for (u32 i = 0; i < node->mNumChildren; i++) {
+    flatten_nodes(node->mChildren[i], transform, instances, instances_size);
+  }
+}
+
+u32 count_triangles(aiMesh *assimp_mesh)
+{
+  // points and lines survive aiProcess_Triangulate, skip them
+  u32 count = 0;
+  for (u32 i = 0; i < assimp_mesh->mNumFaces; i++) {
+    if (assimp_mesh->mFaces[i].mNumIndices == 3) count++;
+  }
+  return count;
+}
+
+void convert_mesh(aiMesh *assimp_mesh, StandardMesh3d *mesh)
+{
+  for (u32 i = 0; i < mesh->vertices_size; i++) {
+    mesh->vertices[i].position.x = assimp_mesh->mVertices[i].x;
+    mesh->vertices[i].position.y = assimp_mesh->mVertices[i].y;
+    mesh->vertices[i].position.z = assimp_mesh->mVertices[i].z;
+  }
+  for (u32 i = 0; i < mesh->vertices_size; i++) {
+    if (assimp_mesh->mNormals) {
+      mesh->vertices[i].normal.x = assimp_mesh->mNormals[i].x;
+      mesh->vertices[i].normal.y = assimp_mesh->mNormals[i].y;
+      mesh->vertices[i].normal.z = assimp_mesh->mNormals[i].z;
+    } else {
+      mesh->vertices[i].normal = {};
+    }
+  }
+  for (u32 i = 0; i < mesh->vertices_size; i++) {
+    if (assimp_mesh->mTextureCoords[0]) {
+      mesh->vertices[i].uv.x = assimp_mesh->mTextureCoords[0][i].x;
+      mesh->vertices[i].uv.y = assimp_mesh->mTextureCoords[0][i].y;
+    } else {
+      mesh->vertices[i].uv = {0, 0};
+    }
+  }
+
+  u32 next_index = 0;
+  for (u32 i = 0; i < assimp_mesh->mNumFaces; i++) {
+    aiFace face = assimp_mesh->mFaces[i];
+    if (face.mNumIndices != 3) continue;
+    mesh->indexes[next_index++] = face.mIndices[0];
+    mesh->indexes[next_index++] = face.mIndices[1];
+    mesh->indexes[next_index++] = face.mIndices[2];
+  }
+}
+
+// Packs each mesh relative to its own AABB, once the vertices are final.
+void pack_scene(Scene3d *scene)
+{
+  Mem stats_mem = system_allocator.alloc(scene->meshes_size *
+                                         sizeof(QuantizationErrorStats));
+  QuantizationErrorStats *stats = (QuantizationErrorStats *)stats_mem.data;
+  parallel_for(scene->meshes_size, [&](u32 i) {
+    SceneMesh *scene_mesh = &scene->meshes[i];
+
+    StandardMesh3d mesh;
+    mesh.vertices      = scene->vertices + scene_mesh->vertex_offset;
+    mesh.vertices_size = scene_mesh->vertices_size;
+    mesh.indexes       = scene->indexes + scene_mesh->index_offset;
+    mesh.indexes_size  = scene_mesh->indexes_size;
+    PackedMesh3d packed =
+        pack_mesh(&mesh, scene->packed_vertices + scene_mesh->vertex_offset);
+
+    scene_mesh->aabb_min    = packed.aabb_min;
+    scene_mesh->aabb_extent = packed.aabb_extent;
+    stats[i]                = measure_quantization_error(&mesh, &packed);
+  });
+
+  // position errors are in each mesh's own units, the max is still a useful
+  // sanity check.
+  QuantizationErrorStats total;
+  for (u32 i = 0; i < scene->meshes_size; i++) {
+    total.max_position_error =
+        fmaxf(total.max_position_error, stats[i].max_position_error);
+    total.max_normal_error =
+        fmaxf(total.max_normal_error, stats[i].max_normal_error);
+    total.max_uv_error = fmaxf(total.max_uv_error, stats[i].max_uv_error);
+  }
+  system_allocator.free(stats_mem);
+
+  info("scene packed: ", scene->vertices_size, " vertices, ",
+       scene->vertices_size * sizeof(Vertex), " -> ",
+       scene->vertices_size * sizeof(PackedVertex),
+       " bytes, position error max ", total.max_position_error,
+       ", normal error max ", total.max_normal_error, " deg, uv error max ",
+       total.max_uv_error);
+}
+
+// Loads every mesh in the file into one vertex and one index buffer, so the
+// whole thing can be uploaded in one go. Meshes are converted and optimized
+// in parallel, each into its own slice of the buffers.
+Scene3d load_scene(String filename, Allocator *allocator,
+                   ImportSettings settings = {})
 {
   File file = read_file(filename, &tmp_allocator);
 
@@ -34,44 +198,158 @@ StandardMesh3d load_mesh(String filename, StackAllocator *allocator)
   if (!assimp_scene || assimp_scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
       !assimp_scene->mRootNode) {
     error("Assimp error loading file: ", filename);
-    return {nullptr, 0};
+    return {};
   }
 
-  aiNode *node = assimp_scene->mRootNode;
-  while (node->mNumMeshes == 0) {
-    node = node->mChildren[0];
+  Scene3d scene;
+  scene.meshes_size = assimp_scene->mNumMeshes;
+  u32 instances_cap = count_mesh_instances(assimp_scene->mRootNode);
+
+  for (u32 i = 0; i < scene.meshes_size; i++) {
+    scene.vertices_size += assimp_scene->mMeshes[i]->mNumVertices;
+    scene.indexes_size += count_triangles(assimp_scene->mMeshes[i]) * 3;
   }
 
-  i32 assimp_mesh_idx = node->mMeshes[0];
-  aiMesh *assimp_mesh = assimp_scene->mMeshes[assimp_mesh_idx];
+  // everything lives in one allocation, carved up in this order.
+  u64 vertices_bytes = scene.vertices_size * sizeof(Vertex);
+  u64 packed_bytes =
+      settings.pack_vertices ? scene.vertices_size * sizeof(PackedVertex) : 0;
+  u64 indexes_bytes   = scene.indexes_size * sizeof(u32);
+  u64 meshes_bytes    = scene.meshes_size * sizeof(SceneMesh);
+  u64 instances_bytes = instances_cap * sizeof(MeshInstance);
+  scene.arena =
+      allocator->alloc(vertices_bytes + packed_bytes + indexes_bytes +
+                       meshes_bytes + instances_bytes);
+  u8 *next       = scene.arena.data;
+  scene.vertices = (Vertex *)next;
+  next += vertices_bytes;
+  if (settings.pack_vertices) scene.packed_vertices = (PackedVertex *)next;
+  next += packed_bytes;
+  scene.indexes = (u32 *)next;
+  next += indexes_bytes;
+  scene.meshes = (SceneMesh *)next;
+  next += meshes_bytes;
+  scene.instances = (MeshInstance *)next;
 
-  StandardMesh3d mesh;
-  mesh.vertices_size = assimp_mesh->mNumVertices;
-  mesh.vertices =
-      (Vertex *)allocator->alloc(mesh.vertices_size * sizeof(Vertex)).data;
-
-  for (u32 i = 0; i < mesh.vertices_size; i++) {
-    mesh.vertices[i].position.x = assimp_mesh->mVertices[i].x;
-    mesh.vertices[i].position.y = assimp_mesh->mVertices[i].y;
-    mesh.vertices[i].position.z = assimp_mesh->mVertices[i].z;
+  u32 vertex_offset = 0;
+  u32 index_offset  = 0;
+  for (u32 i = 0; i < scene.meshes_size; i++) {
+    SceneMesh *mesh     = &scene.meshes[i];
+    mesh->vertex_offset = vertex_offset;
+    mesh->vertices_size = assimp_scene->mMeshes[i]->mNumVertices;
+    mesh->index_offset  = index_offset;
+    mesh->indexes_size  = count_triangles(assimp_scene->mMeshes[i]) * 3;
+    vertex_offset += mesh->vertices_size;
+    index_offset += mesh->indexes_size;
   }
-  for (u32 i = 0; i < mesh.vertices_size; i++) {
-    mesh.vertices[i].normal.x = assimp_mesh->mNormals[i].x;
-    mesh.vertices[i].normal.y = assimp_mesh->mNormals[i].y;
-    mesh.vertices[i].normal.z = assimp_mesh->mNormals[i].z;
+
+  // workers keep their stats, they are logged in order once all are done.
+  Mem stats_mem = system_allocator.alloc(scene.meshes_size *
+                                         sizeof(MeshOptimizationStats));
+  MeshOptimizationStats *stats = (MeshOptimizationStats *)stats_mem.data;
+  parallel_for(scene.meshes_size, [&](u32 i) {
+    SceneMesh *scene_mesh = &scene.meshes[i];
+
+    StandardMesh3d mesh;
+    mesh.vertices      = scene.vertices + scene_mesh->vertex_offset;
+    mesh.vertices_size = scene_mesh->vertices_size;
+    mesh.indexes       = scene.indexes + scene_mesh->index_offset;
+    mesh.indexes_size  = scene_mesh->indexes_size;
+    convert_mesh(assimp_scene->mMeshes[i], &mesh);
+    stats[i] = optimize_mesh(&mesh);
+
+    scene_mesh->vertices_size = mesh.vertices_size;
+  });
+  for (u32 i = 0; i < scene.meshes_size; i++) {
+    report_mesh_optimization(stats[i]);
   }
-  for (u32 i = 0; i < mesh.vertices_size; i++) {
-    mesh.vertices[i].uv.x = assimp_mesh->mTextureCoords[0][i].x;
-    mesh.vertices[i].uv.y = assimp_mesh->mTextureCoords[0][i].y;
+  system_allocator.free(stats_mem);
+
+  // welding only ever shrinks a mesh, close the gaps it left behind.
+  u32 vertices_before = scene.vertices_size;
+  scene.vertices_size = 0;
+  for (u32 i = 0; i < scene.meshes_size; i++) {
+    SceneMesh *mesh = &scene.meshes[i];
+    memmove(scene.vertices + scene.vertices_size,
+            scene.vertices + mesh->vertex_offset,
+            mesh->vertices_size * sizeof(Vertex));
+    mesh->vertex_offset = scene.vertices_size;
+    scene.vertices_size += mesh->vertices_size;
   }
 
-  mesh.indexes_size = assimp_mesh->mNumFaces * 3;
+  if (settings.pack_vertices) pack_scene(&scene);
+
+  flatten_nodes(assimp_scene->mRootNode, aiMatrix4x4(), scene.instances,
+                &scene.instances_size);
+
+  info("scene loaded: ", filename, ", ", scene.meshes_size, " meshes, ",
+       scene.instances_size, " instances, ", scene.indexes_size / 3,
+       " triangles, vertices ", vertices_before, " -> ", scene.vertices_size);
+
+  aiReleaseImport(assimp_scene);
+  return scene;
+}
+
+// Bakes every instance of the scene into a single mesh, for callers that just
+// want to draw the whole thing with one transform.
+StandardMesh3d load_mesh(String filename, StackAllocator *allocator)
+{
+  Scene3d scene = load_scene(filename, &system_allocator);
+
+  StandardMesh3d mesh;
+  for (u32 i = 0; i < scene.instances_size; i++) {
+    SceneMesh *scene_mesh = &scene.meshes[scene.instances[i].mesh_idx];
+    mesh.vertices_size += scene_mesh->vertices_size;
+    mesh.indexes_size += scene_mesh->indexes_size;
+  }
+  mesh.vertices =
+      (Vertex *)allocator->alloc(mesh.vertices_size * sizeof(Vertex)).data;
   mesh.indexes = (u32 *)allocator->alloc(mesh.indexes_size * sizeof(u32)).data;
-  for (u32 i = 0; i < assimp_mesh->mNumFaces; i++) {
-    mesh.indexes[i * 3 + 0] = assimp_mesh->mFaces[i].mIndices[0];
-    mesh.indexes[i * 3 + 1] = assimp_mesh->mFaces[i].mIndices[1];
-    mesh.indexes[i * 3 + 2] = assimp_mesh->mFaces[i].mIndices[2];
+
+  u32 next_vertex = 0;
+  u32 next_index  = 0;
+  for (u32 i = 0; i < scene.instances_size; i++) {
+    SceneMesh *scene_mesh = &scene.meshes[scene.instances[i].mesh_idx];
+    Mat4f t               = scene.instances[i].transform;
+    Vec3f c0              = {t[0][0], t[0][1], t[0][2]};
+    Vec3f c1              = {t[1][0], t[1][1], t[1][2]};
+    Vec3f c2              = {t[2][0], t[2][1], t[2][2]};
+    Vec3f c3              = {t[3][0], t[3][1], t[3][2]};
+
+    // normals go through the cofactor matrix, which is the inverse transpose
+    // scaled by the determinant, so non-uniform scale is handled too.
+    b8 mirrored  = dot(c0, cross(c1, c2)) < 0;
+    f32 det_sign = mirrored ? -1.f : 1.f;
+    Vec3f n0     = cross(c1, c2) * det_sign;
+    Vec3f n1     = cross(c2, c0) * det_sign;
+    Vec3f n2     = cross(c0, c1) * det_sign;
+
+    for (u32 v = 0; v < scene_mesh->vertices_size; v++) {
+      Vertex in  = scene.vertices[scene_mesh->vertex_offset + v];
+      Vertex out = in;
+      out.position =
+          c0 * in.position.x + c1 * in.position.y + c2 * in.position.z + c3;
+      Vec3f normal = n0 * in.normal.x + n1 * in.normal.y + n2 * in.normal.z;
+      out.normal   = normal.len() > 0.f ? normalize(normal) : normal;
+      mesh.vertices[next_vertex + v] = out;
+    }
+    for (u32 idx = 0; idx < scene_mesh->indexes_size; idx++) {
+      mesh.indexes[next_index + idx] =
+          next_vertex + scene.indexes[scene_mesh->index_offset + idx];
+    }
+    // a mirroring transform turns the triangles inside out, wind them back.
+    if (mirrored) {
+      for (u32 idx = 0; idx < scene_mesh->indexes_size; idx += 3) {
+        u32 *triangle = &mesh.indexes[next_index + idx];
+        u32 tmp       = triangle[1];
+        triangle[1]   = triangle[2];
+        triangle[2]   = tmp;
+      }
+    }
+    next_vertex += scene_mesh->vertices_size;
+    next_index += scene_mesh->indexes_size;
   }
 
+  free_scene(&scene);
   return mesh;
 }
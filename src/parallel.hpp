@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "types.hpp"
+
+const u32 MAX_WORKER_THREADS = 64;
+
+u32 worker_thread_count()
+{
+  u32 count = std::thread::hardware_concurrency();
+  if (count == 0) return 1;
+  return count < MAX_WORKER_THREADS ? count : MAX_WORKER_THREADS;
+}
+
+// Threads 1 to worker_thread_count() - 1, started by the first parallel_for
+// and kept for the rest of the process, so a call costs a wake up instead of
+// creating and joining threads. They sleep on wake until generation moves on,
+// and the caller sleeps on done until busy drops back to 0. The pool is never
+// torn down, its threads die with the process.
+struct WorkerPool {
+  std::mutex submit_mutex;  // one job at a time
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  u64 generation = 0;
+  u32 busy       = 0;
+
+  // the current job, see parallel_for_workers
+  void (*run)(void *fn, u32 i, u32 worker) = nullptr;
+  void *fn                                 = nullptr;
+  u32 count                                = 0;
+  u32 workers_count                        = 0;
+  std::atomic<u32> next                    = 0;
+};
+
+// pool threads and callers inside a job don't submit to the pool again, their
+// nested calls run in place as the same worker.
+thread_local u32 current_worker = 0;
+thread_local b8 in_parallel_for = false;
+
+void worker_pool_thread(WorkerPool *pool, u32 worker_i)
+{
+  current_worker  = worker_i;
+  in_parallel_for = true;
+
+  u64 seen = 0;
+  while (true) {
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    pool->wake.wait(lock, [&] { return pool->generation != seen; });
+    seen = pool->generation;
+    if (worker_i >= pool->workers_count) continue;
+    lock.unlock();
+
+    for (u32 i = pool->next++; i < pool->count; i = pool->next++) {
+      pool->run(pool->fn, i, worker_i);
+    }
+
+    lock.lock();
+    if (--pool->busy == 0) pool->done.notify_one();
+  }
+}
+
+WorkerPool *get_worker_pool()
+{
+  static WorkerPool *pool = [] {
+    WorkerPool *pool = new WorkerPool;
+    for (u32 i = 1; i < worker_thread_count(); i++) {
+      std::thread(worker_pool_thread, pool, i).detach();
+    }
+    return pool;
+  }();
+  return pool;
+}
+
+// Calls fn(i, worker) for every i in [0, count) spread over all cores,
+// including the calling thread, which is always worker 0. worker is below
+// worker_thread_count(), so it can index per thread state. Indexes are handed
+// out one at a time so uneven items (big and small meshes, glyphs, tiles)
+// still balance. fn must be thread safe. Calls from different threads take
+// turns on the pool.
+template <typename F>
+void parallel_for_workers(u32 count, F fn)
+{
+  u32 workers_count = worker_thread_count();
+  if (workers_count > count) workers_count = count;
+  if (workers_count <= 1 || in_parallel_for) {
+    for (u32 i = 0; i < count; i++) fn(i, current_worker);
+    return;
+  }
+
+  auto run = [](void *fn, u32 i, u32 worker) { (*(F *)fn)(i, worker); };
+
+  WorkerPool *pool = get_worker_pool();
+  std::lock_guard<std::mutex> submit(pool->submit_mutex);
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->run           = run;
+    pool->fn            = &fn;
+    pool->count         = count;
+    pool->workers_count = workers_count;
+    pool->next          = 0;
+    pool->busy          = workers_count - 1;
+    pool->generation++;
+  }
+  pool->wake.notify_all();
+
+  in_parallel_for = true;
+  for (u32 i = pool->next++; i < count; i = pool->next++) fn(i, 0u);
+  in_parallel_for = false;
+
+  std::unique_lock<std::mutex> lock(pool->mutex);
+  pool->done.wait(lock, [&] { return pool->busy == 0; });
+}
+
+// Calls fn(i) for every i in [0, count), see parallel_for_workers.
+template <typename F>
+void parallel_for(u32 count, F fn)
+{
+  parallel_for_workers(count, [&](u32 i, u32) { fn(i); });
+}
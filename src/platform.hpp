@@ -100,7 +100,10 @@ struct GlfwWindow {
   }
 };
 
-void fill_input(GlfwWindow *window, Input *state)
+// With wait_for_events the thread sleeps until there is at least one event
+// (or glfwPostEmptyEvent is called), for when there is nothing to do until the
+// user does something.
+void fill_input(GlfwWindow *window, Input *state, b8 wait_for_events = false)
 {
   // reset per frame data
   for (int i = 0; i < (int)Keys::COUNT; i++) {
@@ -115,14 +118,19 @@ void fill_input(GlfwWindow *window, Input *state)
   state->key_input         = {};
   state->scrollwheel_count = 0;
 
+  if (wait_for_events) {
+    glfwWaitEvents();
+  } else {
+    glfwPollEvents();
+  }
+
+  // read after the events, the wait may have been long.
   f64 mouse_x;
   f64 mouse_y;
   glfwGetCursorPos(window->ref, &mouse_x, &mouse_y);
   state->mouse_pos_prev  = state->mouse_pos;
   state->mouse_pos       = {(f32)mouse_x, (f32)mouse_y};
   state->mouse_pos_delta = state->mouse_pos - state->mouse_pos_prev;
-
-  glfwPollEvents();
 }
 
 void character_input_callback(GLFWwindow *window, u32 codepoint)
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstring>
+
+#include "types.hpp"
+
+// LSD radix sort of u64 keys, a byte per pass. Payloads go in the low bits of
+// the key, e.g. the index of what is being sorted.
+//
+// All 8 histograms are counted in one pass over the keys, and a byte that is
+// the same in every key is skipped, so keys that only use a few of their bytes
+// only pay for those. scratch must hold count keys, the sorted keys end up in
+// keys.
+void radix_sort(u64 *keys, u64 *scratch, u32 count)
+{
+  if (count == 0) return;
+
+  u32 histograms[8][256];
+  memset(histograms, 0, sizeof(histograms));
+  for (u32 i = 0; i < count; i++) {
+    for (u32 byte = 0; byte < 8; byte++) {
+      histograms[byte][(keys[i] >> (byte * 8)) & 0xFF]++;
+    }
+  }
+
+  u64 *src = keys;
+  u64 *dst = scratch;
+  for (u32 byte = 0; byte < 8; byte++) {
+    u32 *histogram = histograms[byte];
+    if (histogram[(keys[0] >> (byte * 8)) & 0xFF] == count) continue;
+
+    u32 offset = 0;
+    for (u32 i = 0; i < 256; i++) {
+      u32 bucket_count = histogram[i];
+      histogram[i]     = offset;
+      offset += bucket_count;
+    }
+    for (u32 i = 0; i < count; i++) {
+      dst[histogram[(src[i] >> (byte * 8)) & 0xFF]++] = src[i];
+    }
+
+    u64 *tmp = src;
+    src      = dst;
+    dst      = tmp;
+  }
+
+  if (src != keys) memcpy(keys, src, (u64)count * sizeof(u64));
+}
@@ -59,6 +59,50 @@ struct String {
   }
 };
 
+// Decodes the UTF-8 codepoint starting at text[*i] and moves *i past it.
+// Malformed bytes decode to U+FFFD one at a time, so bad input still advances.
+u32 next_codepoint(String text, u32 *i)
+{
+  const u32 REPLACEMENT = 0xFFFD;
+
+  u8 lead = text.data[(*i)++];
+  if (lead < 0x80) return lead;
+
+  u32 length, codepoint, min_codepoint;
+  if ((lead & 0xE0) == 0xC0) {
+    length        = 2;
+    codepoint     = lead & 0x1F;
+    min_codepoint = 0x80;
+  } else if ((lead & 0xF0) == 0xE0) {
+    length        = 3;
+    codepoint     = lead & 0x0F;
+    min_codepoint = 0x800;
+  } else if ((lead & 0xF8) == 0xF0) {
+    length        = 4;
+    codepoint     = lead & 0x07;
+    min_codepoint = 0x10000;
+  } else {
+    return REPLACEMENT;
+  }
+
+  u32 start = *i;
+  for (u32 j = 1; j < length; j++) {
+    if (start + j - 1 >= text.size) return REPLACEMENT;
+    u8 continuation = text.data[start + j - 1];
+    if ((continuation & 0xC0) != 0x80) return REPLACEMENT;
+    codepoint = (codepoint << 6) | (continuation & 0x3F);
+  }
+
+  // overlong encodings, surrogates and out of range values are malformed too.
+  if (codepoint < min_codepoint || codepoint > 0x10FFFF ||
+      (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+    return REPLACEMENT;
+  }
+
+  *i = start + length - 1;
+  return codepoint;
+}
+
 struct NullTerminatedString : String {
   static NullTerminatedString concatenate(String str1, String str2, Allocator *allocator)
   {
@@ -19,6 +19,7 @@ const u64 MB = 1024 * KB;
 const u64 GB = 1024 * MB; 
 
 enum struct PixelFormat {
+  R8U,
   RGBA8U,
   RG32F,
   RGB32F,